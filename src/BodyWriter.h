@@ -0,0 +1,191 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Consumer of HTTP request bodies received through the streaming interface
+//(see OnBody in WebSocketService.h): chunks are copied into a bounded
+//queue and passed to a sink, e.g. a file descriptor, by a dedicated
+//thread. Write returns @c false, pausing reading from the connection,
+//when the sink falls behind; the resume callback is invoked once the
+//sink has caught up. Memory is bounded by the policy, not by the size of
+//the body. A single writer can also serve consecutive bodies, e.g. the
+//messages received by a WebSocket session, see End.
+//Each writer owns a thread, started by the constructor and joined by
+//Close or the destructor: thread creation costs tens of microseconds and
+//a stack per concurrent body, acceptable for uploads but not for small,
+//frequent requests, which are better served by ASYNC_POOL tasks
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <thread>
+#include <utility>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "BufferPool.h"
+#include "LockFreeQueue.h"
+#include "PaddedBuffer.h"
+
+namespace wsp {
+
+class BodyWriter {
+public:
+    ///Called by the writer thread with each chunk, and with an empty chunk
+    ///for each call to End
+    /// @return @c false on error: the remaining chunks are discarded
+    using Sink = std::function< bool (const char*, std::size_t) >;
+    ///Called by the writer thread when reading can be resumed, typically
+    ///WebSocketService::ResumeReceive with the session handle
+    using Resume = std::function< void () >;
+    ///Queue limits
+    struct Policy {
+        ///Pause reading when more bytes are queued
+        std::size_t highWater = 8 << 20;
+        ///Resume reading when fewer bytes are queued
+        std::size_t lowWater = 2 << 20;
+        ///Max number of queued chunks; reading is paused at half of it
+        std::size_t maxChunks = 4096;
+    };
+    ///Constructor: default policy
+    BodyWriter(BufferPool& pool, Sink sink, Resume resume)
+        : BodyWriter(pool, std::move(sink), std::move(resume), Policy()) {}
+    ///Constructor: starts the writer thread
+    /// @param pool pool chunks are leased from, typically the Context's
+    ///        one, see Context::GetBufferPool
+    /// @param sink chunk consumer
+    /// @param resume invoked after Write returned @c false, when the
+    ///        queue is below the low water mark
+    /// @param policy queue limits
+    BodyWriter(BufferPool& pool, Sink sink, Resume resume,
+               const Policy& policy)
+        : sink_(std::move(sink)), resume_(std::move(resume)),
+          policy_(policy), pool_(pool), chunks_(policy.maxChunks) {
+        writer_ = std::thread([this]() { this->Run(); });
+    }
+    BodyWriter(const BodyWriter&) = delete;
+    BodyWriter& operator=(const BodyWriter&) = delete;
+    ///The queue indices are cache line aligned: plain new honors such
+    ///alignment only from C++17
+    static void* operator new(std::size_t size) {
+        void* p = nullptr;
+        if(posix_memalign(&p, alignof(BodyWriter), size) != 0)
+            throw std::bad_alloc();
+        return p;
+    }
+    static void operator delete(void* p) { std::free(p); }
+    ///Wait for queued chunks to be written
+    ~BodyWriter() { Close(); }
+    ///Sink writing to a file descriptor; the descriptor is not closed
+    static Sink FileDescriptor(int fd) {
+        return [fd](const char* p, std::size_t n) {
+            while(n) {
+                const ssize_t w = ::write(fd, p, n);
+                if(w < 0 && errno == EINTR) continue;
+                if(w <= 0) return false;
+                p += w;
+                n -= std::size_t(w);
+            }
+            return true;
+        };
+    }
+    ///Queue chunk for writing; service thread only
+    /// @return @c false if reading must be paused until the resume
+    ///         callback is invoked
+    bool Write(const char* p, std::size_t n) {
+        if(!n) return true;
+        PaddedBuffer b = pool_.Acquire(n);
+        b.assign(p, p + n);
+        queuedBytes_ += n;
+        ++queuedChunks_;
+        chunks_.Push(std::move(b));
+        if(!Behind()) return true;
+        //the writer resumes reading when it catches up; check again in
+        //case it drained the queue before the flag was set
+        paused_ = true;
+        return CaughtUp() && paused_.exchange(false);
+    }
+    ///Mark the end of a body: the sink receives an empty chunk after the
+    ///chunks queued so far; service thread only
+    void End() {
+        ++queuedChunks_;
+        chunks_.Push(PaddedBuffer());
+    }
+    ///Stop accepting chunks without waiting: @c done is invoked by the
+    ///writer thread, with the value Close would return, once all the
+    ///queued chunks are written; service thread only
+    void Finish(std::function< void (bool) > done) {
+        done_ = std::move(done);
+        chunks_.Close();
+    }
+    ///Wait until all queued chunks are written and stop the writer
+    ///thread; blocks for at most the time needed to write highWater bytes
+    /// @return @c true if all the data was written
+    bool Close() {
+        chunks_.Close();
+        if(writer_.joinable()) writer_.join();
+        return !failed_;
+    }
+    ///Number of bytes written by the sink
+    std::size_t Written() const { return written_; }
+    ///@c true if the sink reported an error
+    bool Failed() const { return failed_; }
+private:
+    bool Behind() const {
+        return queuedBytes_ >= policy_.highWater
+               || 2 * queuedChunks_ >= policy_.maxChunks;
+    }
+    bool CaughtUp() const {
+        return queuedBytes_ < policy_.lowWater
+               && 4 * queuedChunks_ < policy_.maxChunks;
+    }
+    void Run() {
+        PaddedBuffer chunk;
+        while(chunks_.Pop(chunk)) {
+            if(!failed_) {
+                if(sink_(chunk.data(), chunk.size()))
+                    written_ += chunk.size();
+                else failed_ = true;
+            }
+            queuedBytes_ -= chunk.size();
+            --queuedChunks_;
+            pool_.Release(std::move(chunk));
+            if(CaughtUp() && paused_.exchange(false) && resume_) resume_();
+        }
+        //set before the queue was closed
+        if(done_) done_(!failed_);
+    }
+private:
+    Sink sink_;
+    Resume resume_;
+    std::function< void (bool) > done_;
+    Policy policy_;
+    //buffers are recycled: no allocations once the queue is warm
+    BufferPool& pool_;
+    SPSCBlockingQueue< PaddedBuffer > chunks_;
+    std::atomic< std::size_t > queuedBytes_{0};
+    std::atomic< std::size_t > queuedChunks_{0};
+    std::atomic< std::size_t > written_{0};
+    std::atomic< bool > paused_{false};
+    std::atomic< bool > failed_{false};
+    std::thread writer_;
+};
+
+} //namespace wsp
@@ -0,0 +1,159 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Pool of padded buffers shared by all the sessions: buffers are grouped in
+//power of two size classes by capacity and recycled instead of being
+//freed, so that once the pool is warm receiving and replying allocate no
+//memory; a policy bounds the memory the pool and the sessions keep
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "PaddedBuffer.h"
+
+namespace wsp {
+
+//------------------------------------------------------------------------------
+/// Thread safe recycling pool of PaddedBuffer instances; a size class
+/// holds the free buffers whose capacity is in the range [2^c, 2^(c+1))
+class BufferPool {
+public:
+    ///Limits on retained memory
+    struct Policy {
+        ///Buffers with a larger capacity are freed when released
+        std::size_t maxBufferSize = std::size_t(1) << 22;
+        ///Max number of free buffers per size class
+        std::size_t maxPerClass = 256;
+        ///Max total capacity of the free buffers
+        std::size_t maxPooledBytes = std::size_t(64) << 20;
+        ///Buffers kept by a session between messages are returned to the
+        ///pool by Trim when their capacity exceeds this value
+        std::size_t retainSize = std::size_t(1) << 16;
+    };
+    ///Smallest capacity handed out, as a power of two
+    enum { MIN_CLASS = 6 };
+    ///Number of size classes
+    enum { CLASS_COUNT = 8 * sizeof(std::size_t) };
+public:
+    ///Default constructor: default policy
+    BufferPool() {}
+    ///Constructor
+    /// @param p retention policy
+    explicit BufferPool(const Policy& p) : policy_(p) {}
+    ///Copy constructor: copies the policy only, the new pool is empty
+    BufferPool(const BufferPool& other) : policy_(other.policy_) {}
+    BufferPool& operator=(const BufferPool&) = delete;
+    ///Set retention policy; not thread safe, call before the pool is used
+    void SetPolicy(const Policy& p) { policy_ = p; }
+    ///Current retention policy
+    const Policy& GetPolicy() const { return policy_; }
+    ///Lease an empty buffer
+    /// @param capacity min capacity: the buffer can be resized up to
+    ///        @c capacity without allocating
+    /// @return buffer with <code>size() == 0</code> and capacity rounded
+    ///         up to the next power of two
+    PaddedBuffer Acquire(std::size_t capacity) {
+        const int c = CeilLog2(capacity);
+        PaddedBuffer b;
+        if(c < CLASS_COUNT) {
+            SizeClass& sc = classes_[c];
+            std::lock_guard< std::mutex > guard(sc.mutex);
+            if(!sc.free.empty()) {
+                b.swap(sc.free.back());
+                sc.free.pop_back();
+                pooledBytes_.fetch_sub(b.capacity(),
+                                       std::memory_order_relaxed);
+                return b;
+            }
+        }
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        b.reserve(c < CLASS_COUNT ? std::size_t(1) << c : capacity);
+        return b;
+    }
+    ///Return buffer to the pool; the buffer is freed instead if the
+    ///policy does not allow retaining it
+    /// @param b buffer, empty with no capacity after the call
+    void Release(PaddedBuffer&& b) {
+        PaddedBuffer r;
+        r.swap(b);
+        const std::size_t capacity = r.capacity();
+        if(!capacity || capacity > policy_.maxBufferSize) return;
+        if(pooledBytes_.load(std::memory_order_relaxed) + capacity
+           > policy_.maxPooledBytes) return;
+        SizeClass& sc = classes_[FloorLog2(capacity)];
+        std::lock_guard< std::mutex > guard(sc.mutex);
+        if(sc.free.size() >= policy_.maxPerClass) return;
+        r.clear();
+        sc.free.push_back(std::move(r));
+        pooledBytes_.fetch_add(capacity, std::memory_order_relaxed);
+    }
+    ///Append data, moving the content to a larger buffer leased from the
+    ///pool when the capacity is not sufficient
+    /// @param b buffer
+    /// @param p data
+    /// @param n number of bytes
+    void Append(PaddedBuffer& b, const char* p, std::size_t n) {
+        if(b.size() + n > b.capacity()) {
+            PaddedBuffer g = Acquire(b.size() + n);
+            g.assign(b.begin(), b.end());
+            Release(std::move(b));
+            b.swap(g);
+        }
+        b.insert(b.end(), p, p + n);
+    }
+    ///Clear buffer, returning its memory to the pool if its capacity
+    ///exceeds Policy::retainSize; called by sessions after each message
+    ///so that a single large message does not pin memory for the
+    ///lifetime of the session
+    void Trim(PaddedBuffer& b) {
+        if(b.capacity() > policy_.retainSize) Release(std::move(b));
+        else b.clear();
+    }
+    ///Number of buffers allocated because no free buffer was available
+    std::uint64_t Allocations() const {
+        return allocations_.load(std::memory_order_relaxed);
+    }
+    ///Total capacity of the free buffers
+    std::size_t PooledBytes() const {
+        return pooledBytes_.load(std::memory_order_relaxed);
+    }
+private:
+    static int FloorLog2(std::size_t n) {
+        int l = 0;
+        while(n >>= 1) ++l;
+        return l;
+    }
+    static int CeilLog2(std::size_t n) {
+        if(n <= (std::size_t(1) << MIN_CLASS)) return MIN_CLASS;
+        return FloorLog2(n - 1) + 1;
+    }
+private:
+    struct SizeClass {
+        std::mutex mutex;
+        std::vector< PaddedBuffer > free;
+    };
+    Policy policy_;
+    SizeClass classes_[CLASS_COUNT];
+    std::atomic< std::size_t > pooledBytes_{0};
+    std::atomic< std::uint64_t > allocations_{0};
+};
+
+} //namespace wsp
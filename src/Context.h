@@ -18,20 +18,21 @@
 #pragma once
 
 #include <vector>
-#include <map>
+#include <new>
 #include <chrono>
 #include <stdexcept>
 #include <mutex>
 #include <utility>
 #include <algorithm>
+#include <cassert>
+
+#include "BufferPool.h"
 
 namespace wsp {
 
 //Implementations of WebSocketService-compatible context
 using Buffer  = std::vector< char >;
 using Buffers = std::vector< Buffer >;
-using BufferMap = std::map< void*, Buffers >;
-using TimerMap = std::map< void*, std::chrono::steady_clock::time_point >;
 
 struct ServiceDataEmpty {};
 
@@ -39,6 +40,13 @@ struct ServiceDataEmpty {};
 /// Context implementation: provides storage space to per-session services.
 /// A Context is created once when the libwebsockets context is created
 /// and destroyed when the WebSocketService instance is destroyed.
+/// Per-session buffers and timers are stored into a SessionData instance
+/// which WebSocketService places in front of each service instance in the
+/// memory libwebsockets allocates per session: access is O(1) and needs no
+/// synchronization when sessions are serviced by multiple threads; access
+/// to ServiceData is synchronized only through the *Sync methods.
+/// Message buffers are leased from a BufferPool shared by all the sessions,
+/// see GetBufferPool.
 /// @tparam ServiceDataT convenience type to store service specific data
 ///         without having to create a separate Context class.
 ///         ServiceDataT instances are used to share data among all the 
@@ -47,14 +55,21 @@ template < typename ServiceDataT = ServiceDataEmpty >
 class Context {
 public:
     using ServiceData = ServiceDataT;
+    /// Per-session data, see InitSession
+    struct SessionData {
+        /// Time of last write
+        std::chrono::steady_clock::time_point writeTime;
+        /// Per-session buffers
+        Buffers buffers;
+    };
     /// Default constructor
     Context() {} 
     /// Constructor accepting a ServiceData type instance
     Context(const ServiceData& sd) : serviceData_(sd) {}
-    /// Copy constructor
+    /// Copy constructor; the buffer pool policy is copied, the buffers are
+    /// not
     Context(const Context& c) 
-        : buffers_(c.buffers_), writeTimers_(c.writeTimers_),
-          serviceData_(c.serviceData_) {}
+        : serviceData_(c.serviceData_), bufferPool_(c.bufferPool_) {}
     /// Return constant reference to ServiceData instance: this is what
     /// services use to access data
     const ServiceData& GetServiceData() const { return serviceData_; }
@@ -69,7 +84,8 @@ public:
      /// Return constant reference to ServiceData instance: this is what
     /// services use to access data
     bool GetServiceDataTrySync(ServiceData& sd) const {
-        if(mutex_.try_lock()) return false;
+        std::unique_lock< std::mutex > lock(mutex_, std::try_to_lock);
+        if(!lock.owns_lock()) return false;
         sd = serviceData_;
         return true;
     }
@@ -96,46 +112,40 @@ public:
         std::swap(sd, serviceData_);
     }
     bool SetServiceDataTrySync(const ServiceData& sd) {
-        if(mutex_.try_lock()) {
-            SetServiceData(sd);
-            return true;
-        }
-        return false;
+        std::unique_lock< std::mutex > lock(mutex_, std::try_to_lock);
+        if(!lock.owns_lock()) return false;
+        SetServiceData(sd);
+        return true;
     }
     bool SetServiceDataTrySync(ServiceData&& sd) {
-        if(mutex_.try_lock()) {
-            SetServiceData(std::move(sd));
-            return true;
-        }
-        return false;
+        std::unique_lock< std::mutex > lock(mutex_, std::try_to_lock);
+        if(!lock.owns_lock()) return false;
+        SetServiceData(std::move(sd));
+        return true;
     }
 public:
     /// Return reference to buffer
-    /// @param p pointer key indexing the per-session buffer arrays; this is
+    /// @param p pointer to the per-session data; this is
     ///        the parameter received in the libwebsockets handler function
     /// @param i buffer index
     Buffer& GetBuffer(void* p, int i) {
-        assert(buffers_.find(p) != buffers_.end());
-        assert(buffers_[p].size() > i);
-        return buffers_[p][i];
+        assert(Session(p)->buffers.size() > i);
+        return Session(p)->buffers[i];
     }
-    /// Record current time into write timer map
+    /// Pool of message buffers shared by all the sessions; thread safe
+    BufferPool& GetBufferPool() { return bufferPool_; }
+    /// Record current time into per-session write timer
     void RecordWriteTime(void* user) {
-        writeTimers_[user] = std::chrono::steady_clock::now();
+        Session(user)->writeTime = std::chrono::steady_clock::now();
     }
     /// Compute time elapsed between time of call and value stored into
-    /// write timer map
+    /// per-session write timer
     std::chrono::duration< double > ElapsedWriteTime(void* user) const {
-        if(writeTimers_.find(user) == writeTimers_.end()) {
-            throw std::logic_error(
-                "Cannot find service instance in write timers");
-        }
-        const std::chrono::steady_clock::time_point t = 
-            writeTimers_.find(user)->second;
         const std::chrono::steady_clock::time_point now = 
             std::chrono::steady_clock::now();
         return std::chrono::duration_cast<
-                    std::chrono::duration< double > >(now - t);
+                    std::chrono::duration< double > >(
+                        now - Session(user)->writeTime);
     }
     /// Perform websocket protocol initialization
     void InitProtocol(const char*) {} 
@@ -144,65 +154,39 @@ public:
     /// One time destruction, invoked from WS callback
     void Destroy() {}
     /// Per-session initialization: buffers and timers
+    /// @param p pointer to the per-session memory region pre-allocated by
+    ///        libwebsockets, large enough to hold a SessionData instance
+    /// @param n number of buffers to create, default = 1
+    /// @param s initial size of buffers, default = 1
+    /// @param d initial value of buffer elements
     void InitSession(void* p, int n = 1, std::size_t s = 1, char d = '\0') {
-        CreateBuffers(p, n, s, d);
-        CreateTimers(p);
+        new (p) SessionData;
+        Session(p)->buffers = Buffers(n, Buffer(s, d));
+        RecordWriteTime(p);
     }
     /// Set value of write timer to now - passed value; this is usually used
     /// to ensure that the next write operation succeeds by ensuring that the
     /// delay is > that the minimum delay between writes
     void ResetWriteTimer(void* user, const std::chrono::duration< double >& d) {
-        if(writeTimers_.find(user) == writeTimers_.end()) {
-            throw std::logic_error(
-                "Cannot find service instance in write timers");
-        }
         const std::chrono::steady_clock::time_point now = 
             std::chrono::steady_clock::now();
         using D = std::chrono::steady_clock::duration;    
-        writeTimers_[user] = now - std::chrono::duration_cast< D >(d); 
+        Session(user)->writeTime = now - std::chrono::duration_cast< D >(d); 
     }
     /// Release per-session resources
     void Clear(void* user) {
-        RemoveBuffers(user);
-        RemoveTimers(user);
+        Session(user)->~SessionData();
     }
 private:
-    /// Create char buffers
-    /// @param p pointer key indexing the per-session buffer arrays; this is
-    ///        the parameter received in the libwebsockets handler function
-    /// @param n number of buffers to create, default = 1
-    /// @param s initial size of buffers, default = 1
-    /// @param d initial value of buffer elements
-    void CreateBuffers(void* p, int n = 1, std::size_t s = 1, char d = '\0') {
-        buffers_[p] = Buffers(n, Buffer(s, d));
-    }
-    /// Create write timers
-    void CreateTimers(void* user) {
-       RecordWriteTime(user);
+    static SessionData* Session(void* p) {
+        return reinterpret_cast< SessionData* >(p);
     }
-    /// Remove all buffers associated to a user session
-    /// @param p pointer key indexing the per-session buffer arrays; this is
-    ///        the parameter received in the libwebsockets handler function
-    void RemoveBuffers(void* p) {
-        assert(buffers_.find(p) != buffers_.end());
-        buffers_.erase(buffers_.find(p));
-    }
-    /// Delete time entry associated with session
-    void RemoveTimers(void* user) {
-        if(writeTimers_.find(user) == writeTimers_.end()) {
-            throw std::logic_error(
-                "Cannot find service instance in write timers");
-        }
-        writeTimers_.erase(writeTimers_.find(user));
-    }    
 private:
-    /// per-session buffer map; maps per-session user data pointer
-    /// to buffer array
-    BufferMap buffers_;    
-    TimerMap writeTimers_;
     ServiceData serviceData_;
     ///mutex to synchronize access to shared service resource
     mutable std::mutex mutex_; 
+    ///Recycled message buffers
+    BufferPool bufferPool_;
 };
 
 
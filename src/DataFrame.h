@@ -16,6 +16,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 #include <algorithm>
+#include <stdexcept>
 
 namespace wsp {
 // data frame information returned by Service::Get() and used
@@ -40,6 +41,9 @@ struct DataFrame {
     const char* frameEnd = nullptr;
     /// @c true if data is binary, @c false if it is text
     bool binary = false;
+    /// @c true if binary data is already compressed (e.g. JPEG): it is then
+    /// stored, not compressed, on connections using permessage-deflate
+    bool compressed = false;
     /// Default constructor
     DataFrame() = default;
     /// Constructor
@@ -83,4 +87,86 @@ inline void Reset(DataFrame& df, bool binary) {
     df = DataFrame(nullptr, nullptr, nullptr, nullptr, binary);
 }
 
-}
\ No newline at end of file
+//------------------------------------------------------------------------------
+/// Multi-segment data frame: the segments are sent in order as a single
+/// WebSocket message, this allows e.g. to prepend a per-session header to a
+/// payload shared among all the sessions without concatenating the two.
+/// Each segment is a DataFrame whose frameBegin/frameEnd pointers track the
+/// portion of the segment being sent; chunks never span multiple segments.
+/// When the service returns @c true from PreformattedBuffer() every segment
+/// must be padded.
+struct DataFrameChain {
+    /// Segment type, also used by WebSocketService to detect chains
+    using Segment = DataFrame;
+    /// Maximum number of segments
+    enum {MAX_SEGMENTS = 8};
+    /// Segments, only the first @c count are valid
+    Segment segments[MAX_SEGMENTS];
+    /// Number of segments
+    int count = 0;
+    /// Index of segment being sent
+    int current = 0;
+    /// @c true if data is binary, @c false if it is text
+    bool binary = false;
+    /// @c true if binary data is already compressed
+    bool compressed = false;
+};
+
+inline bool Empty(const DataFrameChain& dc) {
+    return dc.count == 0;
+}
+
+inline bool Consumed(const DataFrameChain& dc) {
+    return !Empty(dc) && dc.current >= dc.count;
+}
+
+/// Return segment being sent
+inline const DataFrame& CurrentSegment(const DataFrameChain& dc) {
+    return dc.segments[std::min(dc.current, dc.count - 1)];
+}
+
+/// Extend the end of the current segment's frame by at most @c chunkLength
+/// bytes
+inline void Update(DataFrameChain& dc, size_t chunkLength) {
+    if(Empty(dc) || Consumed(dc)) return;
+    Update(dc.segments[dc.current], chunkLength);
+}
+
+/// Advance past the consumed bytes, moving to the next segment when the
+/// current one has been fully sent
+inline void Consume(DataFrameChain& dc, size_t chunkLength) {
+    if(Empty(dc) || Consumed(dc)) return;
+    Consume(dc.segments[dc.current], chunkLength);
+    //skip consumed and empty segments
+    while(dc.current < dc.count
+          && dc.segments[dc.current].frameBegin
+             >= dc.segments[dc.current].bufferEnd) ++dc.current;
+}
+
+/// Initialize chain with no segments
+inline void Init(DataFrameChain& dc, bool binary = true) {
+    dc.count = 0;
+    dc.current = 0;
+    dc.binary = binary;
+    dc.compressed = false;
+}
+
+/// Append segment; Append does not copy segment memory, which must stay
+/// valid until the chain is consumed. WebSocketService copies each chunk
+/// before writing it unless the service returns @c true from
+/// PreformattedBuffer(): the segment is then sent in place and must be
+/// padded and not shared with other sessions
+inline void Append(DataFrameChain& dc, const char* begin, size_t size) {
+    if(dc.count == DataFrameChain::MAX_SEGMENTS)
+        throw std::length_error("Too many segments in data frame chain");
+    //empty segments carry no data: do not add
+    if(size == 0) return;
+    dc.segments[dc.count++] = DataFrame(begin, begin + size,
+                                        begin, begin, dc.binary);
+}
+
+inline void Reset(DataFrameChain& dc, bool binary) {
+    Init(dc, binary);
+}
+
+}
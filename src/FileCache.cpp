@@ -0,0 +1,416 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "FileCache.h"
+
+namespace wsp {
+
+namespace {
+#ifdef __linux__
+const std::uint32_t WATCH_EVENTS = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE
+                                   | IN_MOVE_SELF | IN_DELETE_SELF;
+#endif
+
+//entries recording the absence of a compressed variant have no response
+FileCache::EntryPtr Usable(const FileCache::EntryPtr& e) {
+    return e && !e->response.empty() ? e : FileCache::EntryPtr();
+}
+
+//memory used by an entry, including bookkeeping
+std::size_t Footprint(const std::string& key, const FileCache::Entry& e) {
+    return e.response.size() + e.notModified.size() + key.size()
+           + sizeof(FileCache::Entry) + 128;
+}
+
+bool ReadFile(const std::string& path, std::size_t maxSize,
+              std::string& content, struct stat& st) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return false;
+    if(fstat(fd, &st) || !S_ISREG(st.st_mode)
+       || std::size_t(st.st_size) > maxSize) {
+        ::close(fd);
+        return false;
+    }
+    content.resize(std::size_t(st.st_size));
+    std::size_t n = 0;
+    while(n != content.size()) {
+        const ssize_t r = ::read(fd, &content[n], content.size() - n);
+        if(r <= 0) break;
+        n += std::size_t(r);
+    }
+    ::close(fd);
+    //truncated while reading
+    return n == content.size();
+}
+
+bool Gzip(const std::string& in, std::string& out, int level) {
+    z_stream z;
+    std::memset(&z, 0, sizeof(z));
+    //window bits + 16: gzip header and trailer
+    if(deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK) return false;
+    out.resize(deflateBound(&z, uLong(in.size())));
+    z.next_in = (Bytef*) in.data();
+    z.avail_in = uInt(in.size());
+    z.next_out = (Bytef*) &out[0];
+    z.avail_out = uInt(out.size());
+    const bool ok = deflate(&z, Z_FINISH) == Z_STREAM_END;
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return ok;
+}
+
+//FNV-1a: entity tags only need to change when the content changes
+std::uint64_t Hash(const char* p, std::size_t n) {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for(const char* e = p + n; p != e; ++p) {
+        h ^= std::uint64_t((unsigned char)(*p));
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+PaddedBuffer ToBuffer(const std::string& s, std::size_t capacity) {
+    PaddedBuffer b;
+    b.reserve(capacity);
+    b.insert(b.end(), s.begin(), s.end());
+    return b;
+}
+}
+
+FileCache::FileCache() : FileCache(Policy()) {}
+
+FileCache::FileCache(const Policy& policy) : policy_(policy) {
+#ifdef __linux__
+    notify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+FileCache::~FileCache() {
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    if(compressor_.joinable()) compressor_.join();
+    if(notify_ >= 0) ::close(notify_);
+}
+
+FileCache::EntryPtr FileCache::Get(const std::string& path,
+                                   const std::string& mimeType,
+                                   ContentEncoding encoding) {
+    const std::string key = path + EncodingSuffix(encoding);
+    std::string source = path;
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        Poll();
+        Slots::iterator i = slots_.find(key);
+        if(i != slots_.end()) {
+            if(!Stale(i->second)) {
+                lru_.splice(lru_.begin(), lru_, i->second.lru);
+                return Usable(i->second.entry);
+            }
+            Erase(i);
+        }
+        //precompressed sibling file preferred to on-demand compression
+        if(encoding != ENCODING_IDENTITY) {
+            struct stat st;
+            if(!::stat(key.c_str(), &st) && S_ISREG(st.st_mode)) source = key;
+        }
+        //compressed off the service thread; the caller serves another
+        //coding in the meantime
+        if(encoding == ENCODING_GZIP && source == path && policy_.compress
+           && Compressible(mimeType)) {
+            if(pending_.insert(key).second) {
+                jobs_.push_back(Job{path, mimeType});
+                if(!compressor_.joinable())
+                    compressor_ = std::thread([this]() { Compress(); });
+                cond_.notify_one();
+            }
+            return EntryPtr();
+        }
+    }
+    return Fill(key, path, source, mimeType, encoding);
+}
+
+FileCache::EntryPtr FileCache::Fill(const std::string& key,
+                                    const std::string& path,
+                                    const std::string& source,
+                                    const std::string& mimeType,
+                                    ContentEncoding encoding) {
+    int wd = -1;
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        //watch before reading: any later change is reported
+        wd = Watch(source);
+        ++loading_[wd];
+    }
+    std::size_t sourceSize = 0;
+    EntryPtr e = 
+        Load(path, source, mimeType, encoding, policy_, sourceSize);
+    std::lock_guard< std::mutex > lock(mutex_);
+    Poll();
+    const bool changed = changed_.count(wd) != 0;
+    if(--loading_[wd] == 0) {
+        loading_.erase(wd);
+        changed_.erase(wd);
+    }
+    //a file modified while being read is served from disk; the absence
+    //of a variant is cached only if changes to the file are detected
+    if(!e || changed || (e->response.empty() && wd < 0 && notify_ >= 0)) {
+        Unwatch(wd);
+        return changed ? EntryPtr() : Usable(e);
+    }
+    Slots::iterator i = slots_.find(key);
+    //loaded concurrently by another thread
+    if(i != slots_.end()) return Usable(i->second.entry);
+    const std::size_t bytes = Footprint(key, *e);
+    Evict(bytes);
+    if(bytes_ + bytes > policy_.maxBytes) {
+        Unwatch(wd);
+        return Usable(e);
+    }
+    lru_.push_front(key);
+    slots_[key] = Slot{e, lru_.begin(), wd, source, sourceSize};
+    if(wd >= 0) watches_.insert({wd, key});
+    bytes_ += bytes;
+    return Usable(e);
+}
+
+void FileCache::Compress() {
+    std::unique_lock< std::mutex > lock(mutex_);
+    while(true) {
+        cond_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+        if(stop_) return;
+        Job j = std::move(jobs_.front());
+        jobs_.pop_front();
+        const std::string key = j.path + EncodingSuffix(ENCODING_GZIP);
+        lock.unlock();
+        Fill(key, j.path, j.path, j.mimeType, ENCODING_GZIP);
+        lock.lock();
+        //not cached if the file changed while being read or does not fit:
+        //the next request queues it again
+        pending_.erase(key);
+    }
+}
+
+void FileCache::Invalidate(const std::string& path) {
+    std::lock_guard< std::mutex > lock(mutex_);
+    for(ContentEncoding c: {ENCODING_IDENTITY, ENCODING_GZIP, ENCODING_BR}) {
+        Slots::iterator i = slots_.find(path + EncodingSuffix(c));
+        if(i != slots_.end()) Erase(i);
+    }
+}
+
+void FileCache::Clear() {
+    std::lock_guard< std::mutex > lock(mutex_);
+    while(!slots_.empty()) Erase(slots_.begin());
+}
+
+std::size_t FileCache::Bytes() const {
+    std::lock_guard< std::mutex > lock(mutex_);
+    return bytes_;
+}
+
+std::size_t FileCache::Size() const {
+    std::lock_guard< std::mutex > lock(mutex_);
+    return slots_.size();
+}
+
+bool FileCache::NotModified(const Entry& e,
+                            const char* ifNoneMatch,
+                            const char* ifModifiedSince) {
+    //If-None-Match takes precedence, RFC 7232 section 6
+    if(ifNoneMatch && *ifNoneMatch) {
+        const char* p = ifNoneMatch;
+        while(*p) {
+            while(*p == ' ' || *p == '\t' || *p == ',') ++p;
+            if(*p == '*') return true;
+            //weak comparison: W/ prefix ignored
+            if(!std::strncmp(p, "W/", 2)) p += 2;
+            const char* b = p;
+            while(*p && *p != ',' && *p != ' ' && *p != '\t') ++p;
+            if(std::size_t(p - b) == e.etag.size()
+               && !std::strncmp(b, e.etag.data(), e.etag.size()))
+                return true;
+        }
+        return false;
+    }
+    if(ifModifiedSince && *ifModifiedSince) {
+        const std::time_t t = ParseHttpDate(ifModifiedSince);
+        return t >= 0 && e.mtime <= t;
+    }
+    return false;
+}
+
+std::string FileCache::HttpDate(std::time_t t) {
+    std::tm tm;
+    gmtime_r(&t, &tm);
+    char buf[64];
+    const std::size_t n =
+        std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buf, n);
+}
+
+std::time_t FileCache::ParseHttpDate(const char* s) {
+    std::tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+    if(!strptime(s, "%a, %d %b %Y %H:%M:%S GMT", &tm)) return -1;
+    return timegm(&tm);
+}
+
+FileCache::EntryPtr FileCache::Load(const std::string& path,
+                                    const std::string& source,
+                                    const std::string& mimeType,
+                                    ContentEncoding encoding,
+                                    const Policy& policy,
+                                    std::size_t& sourceSize) {
+    std::string content;
+    struct stat st;
+    if(!ReadFile(source, policy.maxFileSize, content, st)) return EntryPtr();
+    sourceSize = content.size();
+    std::shared_ptr< Entry > e = std::make_shared< Entry >();
+    e->mtime = st.st_mtime;
+    e->mimeType = mimeType;
+    e->encoding = encoding;
+    if(encoding != ENCODING_IDENTITY && source == path) {
+        std::string compressed;
+        //no variant: empty response
+        if(encoding != ENCODING_GZIP || !policy.compress
+           || !Compressible(mimeType)
+           || content.size() < policy.minCompressSize
+           || !Gzip(content, compressed, policy.level)
+           || compressed.size() >= content.size()) return e;
+        content.swap(compressed);
+    }
+    e->size = content.size();
+    char tag[20];
+    std::snprintf(tag, sizeof(tag), "\"%016llx\"",
+                  (unsigned long long) Hash(content.data(), content.size()));
+    e->etag = tag;
+    e->validators = "ETag: " + e->etag + "\r\n"
+                    + "Last-Modified: " + HttpDate(e->mtime) + "\r\n";
+    //responses depend on Accept-Encoding if compressed variants can exist
+    if(encoding != ENCODING_IDENTITY || Compressible(mimeType))
+        e->validators += "Vary: Accept-Encoding\r\n";
+    e->headers = e->validators;
+    if(encoding != ENCODING_IDENTITY)
+        e->headers += std::string("Content-Encoding: ")
+                      + EncodingName(encoding) + "\r\n";
+    std::string header = "HTTP/1.1 200 OK\r\n";
+    if(!mimeType.empty()) header += "Content-Type: " + mimeType + "\r\n";
+    header += "Content-Length: " + std::to_string(e->size) + "\r\n"
+              + "Accept-Ranges: bytes\r\n" + e->headers + "\r\n";
+    e->headerSize = header.size();
+    e->response = ToBuffer(header, header.size() + content.size());
+    e->response.insert(e->response.end(), content.begin(), content.end());
+    const std::string notModified = "HTTP/1.1 304 Not Modified\r\n"
+                                    + e->validators + "\r\n";
+    e->notModified = ToBuffer(notModified, notModified.size());
+    return e;
+}
+
+int FileCache::Watch(const std::string& path) {
+#ifdef __linux__
+    if(notify_ < 0) return -1;
+    return inotify_add_watch(notify_, path.c_str(), WATCH_EVENTS);
+#else
+    return -1;
+#endif
+}
+
+void FileCache::Unwatch(int wd) {
+#ifdef __linux__
+    if(wd < 0 || watches_.count(wd) || loading_.count(wd)) return;
+    inotify_rm_watch(notify_, wd);
+#endif
+}
+
+void FileCache::Poll() {
+#ifdef __linux__
+    if(notify_ < 0) return;
+    alignas(inotify_event) char buf[4096];
+    while(true) {
+        const ssize_t n = ::read(notify_, buf, sizeof(buf));
+        if(n <= 0) break;
+        for(const char* p = buf; p < buf + n; ) {
+            const inotify_event* ev =
+                reinterpret_cast< const inotify_event* >(p);
+            p += sizeof(inotify_event) + ev->len;
+            if(ev->mask & IN_Q_OVERFLOW) {
+                //events lost: nothing cached can be trusted
+                while(!slots_.empty()) Erase(slots_.begin());
+                for(auto& l: loading_) changed_.insert(l.first);
+                continue;
+            }
+            if(loading_.count(ev->wd)) changed_.insert(ev->wd);
+            auto r = watches_.equal_range(ev->wd);
+            std::vector< std::string > paths;
+            for(auto i = r.first; i != r.second; ++i)
+                paths.push_back(i->second);
+            for(auto& i: paths) {
+                Slots::iterator s = slots_.find(i);
+                if(s != slots_.end()) Erase(s);
+            }
+        }
+    }
+#endif
+}
+
+void FileCache::Erase(Slots::iterator i) {
+    bytes_ -= Footprint(i->first, *i->second.entry);
+    lru_.erase(i->second.lru);
+    const int wd = i->second.watch;
+    auto r = watches_.equal_range(wd);
+    for(auto w = r.first; w != r.second; ++w) {
+        if(w->second == i->first) {
+            watches_.erase(w);
+            break;
+        }
+    }
+    slots_.erase(i);
+    Unwatch(wd);
+}
+
+void FileCache::Evict(std::size_t bytes) {
+    while(bytes_ + bytes > policy_.maxBytes && !lru_.empty())
+        Erase(slots_.find(lru_.back()));
+}
+
+bool FileCache::Stale(const Slot& s) const {
+    //modifications are reported by inotify
+    if(notify_ >= 0) return false;
+    struct stat st;
+    if(::stat(s.source.c_str(), &st)) return true;
+    return st.st_mtime != s.entry->mtime
+           || std::size_t(st.st_size) != s.sourceSize;
+}
+
+} //namespace wsp
@@ -0,0 +1,204 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//In-memory cache of the static files served by HTTP services: each entry
+//holds the complete 200 response, header included, and the matching 304
+//response, so that a cached file is answered with a single lws_write and
+//no file system access. On Linux entries are invalidated through inotify
+//when the file changes; elsewhere the modification time is checked on
+//each hit.
+//Compressed variants are cached next to the original content: they are
+//read from precompressed sibling files (file.js.br, file.js.gz) or, for
+//gzip, compressed on demand when no sibling file exists. On-demand
+//compression runs on a background thread: the service thread is never
+//blocked by it and the identity variant is served until the compressed
+//one is ready
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "PaddedBuffer.h"
+#include "http.h"
+
+namespace wsp {
+
+class FileCache {
+public:
+    ///Cache limits
+    struct Policy {
+        ///Max total size of cached responses
+        std::size_t maxBytes = 0x2000000;
+        ///Larger files are not cached and served from disk
+        std::size_t maxFileSize = 0x100000;
+        ///Compress files of compressible types with gzip when no .gz
+        ///sibling file exists
+        bool compress = true;
+        ///Smaller files are not compressed on demand
+        std::size_t minCompressSize = 256;
+        ///zlib level of on-demand compression, -1: zlib default (6)
+        int level = -1;
+    };
+    ///Cached file
+    struct Entry {
+        ///Status line, header and content; @c PRE_PADDING bytes are
+        ///available before data() as required by lws_write
+        PaddedBuffer response;
+        ///Size of status line and header in @c response
+        std::size_t headerSize = 0;
+        ///304 Not Modified response
+        PaddedBuffer notModified;
+        ///Strong entity tag, quotes included
+        std::string etag;
+        ///ETag, Last-Modified and Vary header lines, sent with 304
+        std::string validators;
+        ///Validators and Content-Encoding, sent with 206
+        std::string headers;
+        ///Content type
+        std::string mimeType;
+        ///Modification time
+        std::time_t mtime = 0;
+        ///Content size
+        std::size_t size = 0;
+        ///Content coding
+        ContentEncoding encoding = ENCODING_IDENTITY;
+        ///Start of content
+        const char* Content() const {
+            return response.data() + headerSize;
+        }
+    };
+    using EntryPtr = std::shared_ptr< const Entry >;
+    ///Default constructor
+    FileCache();
+    ///Constructor
+    explicit FileCache(const Policy& policy);
+    FileCache(const FileCache&) = delete;
+    FileCache& operator=(const FileCache&) = delete;
+    ~FileCache();
+    ///Return cached file, loading it if not cached
+    /// @param path file path
+    /// @param mimeType content type, used when the file is loaded
+    /// @param encoding content coding; the absence of a compressed variant
+    ///        is cached as well
+    /// @return @c nullptr if the file cannot be read, is larger than
+    ///         Policy::maxFileSize, has no variant with the requested
+    ///         coding or if the variant is being compressed: serve another
+    ///         coding or the file from disk
+    EntryPtr Get(const std::string& path, const std::string& mimeType,
+                 ContentEncoding encoding = ENCODING_IDENTITY);
+    ///Remove file and its compressed variants from cache
+    void Invalidate(const std::string& path);
+    ///Remove all files
+    void Clear();
+    ///Total size of cached responses
+    std::size_t Bytes() const;
+    ///Number of entries, compressed variants included
+    std::size_t Size() const;
+    ///@c true if the client already has the current version of @c e, as
+    ///stated by If-None-Match or, if absent, If-Modified-Since
+    /// @param e cached file
+    /// @param ifNoneMatch value of If-None-Match header, can be null
+    /// @param ifModifiedSince value of If-Modified-Since header, can be null
+    static bool NotModified(const Entry& e,
+                            const char* ifNoneMatch,
+                            const char* ifModifiedSince);
+    ///Format time as HTTP date (RFC 7231)
+    static std::string HttpDate(std::time_t t);
+    ///Parse HTTP date, -1 if invalid
+    static std::time_t ParseHttpDate(const char* s);
+private:
+    struct Slot {
+        ///Empty response if no variant with the requested coding exists
+        EntryPtr entry;
+        std::list< std::string >::iterator lru;
+        int watch;
+        ///File read and its size, checked when inotify is not available
+        std::string source;
+        std::size_t sourceSize;
+    };
+    ///Key: path followed by coding suffix
+    using Slots = std::unordered_map< std::string, Slot >;
+    ///On-demand compression request
+    struct Job {
+        std::string path;
+        std::string mimeType;
+    };
+    ///Load @c source and cache the result under @c key
+    EntryPtr Fill(const std::string& key, const std::string& path,
+                  const std::string& source, const std::string& mimeType,
+                  ContentEncoding encoding);
+    ///Compression thread: run queued jobs until @c stop_ is set
+    void Compress();
+    ///Read @c source, compressing it if required, and build responses;
+    ///no locking
+    /// @param source file to read: @c path or precompressed sibling file
+    /// @param sourceSize size of @c source
+    static EntryPtr Load(const std::string& path,
+                         const std::string& source,
+                         const std::string& mimeType,
+                         ContentEncoding encoding,
+                         const Policy& policy,
+                         std::size_t& sourceSize);
+    ///Start watching @c path, -1 if not possible; caller holds @c mutex_
+    int Watch(const std::string& path);
+    ///Stop watching @c wd if no cached path or load refers to it; caller
+    ///holds @c mutex_
+    void Unwatch(int wd);
+    ///Drop entries of modified files; caller holds @c mutex_
+    void Poll();
+    ///Caller holds @c mutex_
+    void Erase(Slots::iterator i);
+    ///Caller holds @c mutex_
+    void Evict(std::size_t bytes);
+    ///Caller holds @c mutex_
+    bool Stale(const Slot& s) const;
+private:
+    Policy policy_;
+    mutable std::mutex mutex_;
+    Slots slots_;
+    ///Most recently used first
+    std::list< std::string > lru_;
+    ///Watch descriptor -> paths, several paths can refer to the same file
+    std::unordered_multimap< int, std::string > watches_;
+    ///Watch descriptor -> number of loads in progress
+    std::unordered_map< int, int > loading_;
+    ///Watch descriptors of loads in progress which received events: the
+    ///content read may be out of date
+    std::unordered_set< int > changed_;
+    std::size_t bytes_ = 0;
+    ///inotify descriptor, -1 if not available
+    int notify_ = -1;
+    ///Queued compressions
+    std::deque< Job > jobs_;
+    ///Keys of queued or running compressions
+    std::unordered_set< std::string > pending_;
+    std::condition_variable cond_;
+    bool stop_ = false;
+    ///Started on the first compression
+    std::thread compressor_;
+};
+
+} //namespace wsp
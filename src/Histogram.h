@@ -0,0 +1,178 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Log-linear histograms in the style of HdrHistogram: values below
+//2 * SUB_BUCKETS are counted exactly, larger values in buckets whose width
+//doubles at each power of two, giving a relative error below
+//1 / SUB_BUCKETS over the whole range. Buckets are replicated per service
+//thread, see ThreadCounters
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Metrics.h"
+
+namespace wsp {
+
+//------------------------------------------------------------------------------
+/// Histogram of non-negative integer values e.g. sizes in bytes
+class Histogram {
+public:
+    ///Number of linear sub-buckets per power of two
+    enum { SUB_BUCKET_BITS = 5, SUB_BUCKETS = 1 << SUB_BUCKET_BITS };
+    ///Values greater than or equal to 2^MAX_BITS are counted in the last
+    ///bucket
+    enum { MAX_BITS = 41 };
+    enum { BUCKET_COUNT = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS };
+    ///Recorded values, summed over all the threads
+    class Snapshot {
+    public:
+        ///Number of recorded values
+        std::uint64_t Count() const { return count_; }
+        ///Mean value
+        double Mean() const {
+            return count_ ? double(sum_) / double(count_) : 0.;
+        }
+        ///Value below which fraction @c q of the recorded values fall,
+        ///reported as the upper bound of the bucket it falls in
+        /// @param q fraction in the range [0, 1]
+        /// @return value, zero if no value recorded
+        std::uint64_t Percentile(double q) const {
+            if(!count_) return 0;
+            std::uint64_t rank = std::uint64_t(q * double(count_) + 0.5);
+            if(rank < 1) rank = 1;
+            if(rank > count_) rank = count_;
+            std::uint64_t n = 0;
+            for(int b = 0; b != BUCKET_COUNT; ++b) {
+                n += counts_[b];
+                if(n >= rank) return UpperBound(b);
+            }
+            return UpperBound(BUCKET_COUNT - 1);
+        }
+        ///Upper bound of the highest non-empty bucket
+        std::uint64_t Max() const {
+            for(int b = BUCKET_COUNT - 1; b >= 0; --b)
+                if(counts_[b]) return UpperBound(b);
+            return 0;
+        }
+        ///Number of values in bucket @c b
+        std::uint64_t Bucket(int b) const { return counts_[b]; }
+    private:
+        friend class Histogram;
+        std::vector< std::uint64_t > counts_;
+        std::uint64_t count_ = 0;
+        std::uint64_t sum_ = 0;
+    };
+public:
+    ///Constructor
+    /// @param threads number of service threads
+    explicit Histogram(int threads = 1) { Resize(threads); }
+    ///Allocate per-thread buckets and reset the histogram
+    void Resize(int threads) {
+        values_.Resize(threads, VALUE_COUNT);
+    }
+    ///Record a value
+    /// @param thread service thread index, negative if not called from a
+    ///        service thread
+    /// @param v value
+    void Record(int thread, std::uint64_t v) {
+        values_.Add(thread, BucketIndex(v), 1);
+        values_.Add(thread, SUM, v);
+        values_.Add(thread, COUNT, 1);
+    }
+    ///Number of recorded values; cheaper than <code>Get().Count()</code>
+    std::uint64_t Count() const { return values_.Sum(COUNT); }
+    ///Copy of the current values
+    Snapshot Get() const {
+        Snapshot s;
+        s.counts_.resize(BUCKET_COUNT);
+        for(int b = 0; b != BUCKET_COUNT; ++b) {
+            s.counts_[b] = values_.Sum(b);
+            s.count_ += s.counts_[b];
+        }
+        s.sum_ = values_.Sum(SUM);
+        return s;
+    }
+    ///Append summary in Prometheus text format
+    /// @param os output stream
+    /// @param name metric name
+    /// @param protocol protocol name, used as label
+    /// @param scale factor applied to values e.g. 1E-9 for nanoseconds
+    ///        reported in seconds
+    void Write(std::ostream& os,
+               const std::string& name,
+               const std::string& protocol,
+               double scale = 1.) const {
+        const Snapshot s = Get();
+        if(!s.Count()) return;
+        static const char* quantiles[] = {"0.5", "0.9", "0.99", "0.999"};
+        static const double q[] = {0.5, 0.9, 0.99, 0.999};
+        for(int i = 0; i != 4; ++i) {
+            os << name << "{protocol=\"" << protocol << "\",quantile=\""
+               << quantiles[i] << "\"} "
+               << scale * double(s.Percentile(q[i])) << '\n';
+        }
+        os << name << "_sum{protocol=\"" << protocol << "\"} "
+           << scale * double(s.sum_) << '\n'
+           << name << "_count{protocol=\"" << protocol << "\"} "
+           << s.Count() << '\n';
+    }
+    ///Bucket containing value @c v
+    static int BucketIndex(std::uint64_t v) {
+        if(v < 2 * SUB_BUCKETS) return int(v);
+        if(v >> MAX_BITS) return BUCKET_COUNT - 1;
+        int msb = 0;
+        for(std::uint64_t x = v; x >>= 1; ++msb);
+        const int shift = msb - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + int(v >> shift) - SUB_BUCKETS;
+    }
+    ///Largest value counted in bucket @c b
+    static std::uint64_t UpperBound(int b) {
+        if(b < 2 * SUB_BUCKETS) return std::uint64_t(b);
+        const int shift = b / SUB_BUCKETS - 1;
+        const std::uint64_t sub = b % SUB_BUCKETS + SUB_BUCKETS;
+        return ((sub + 1) << shift) - 1;
+    }
+private:
+    ///Buckets followed by sum and number of recorded values
+    enum { SUM = BUCKET_COUNT, COUNT, VALUE_COUNT };
+    ThreadCounters values_;
+};
+
+//------------------------------------------------------------------------------
+/// Histogram of durations, recorded with nanosecond resolution; values
+/// of 2^MAX_BITS ns (~36 minutes) or more are counted in the last bucket
+class LatencyHistogram : public Histogram {
+public:
+    using Histogram::Histogram;
+    using Histogram::Record;
+    ///Record a duration
+    /// @param thread service thread index, negative if not called from a
+    ///        service thread
+    /// @param d duration
+    template < typename Rep, typename Period >
+    void Record(int thread, const std::chrono::duration< Rep, Period >& d) {
+        const auto ns = 
+            std::chrono::duration_cast< std::chrono::nanoseconds >(d).count();
+        Record(thread, ns > 0 ? std::uint64_t(ns) : std::uint64_t(0));
+    }
+};
+
+} //namespace wsp
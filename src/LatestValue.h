@@ -0,0 +1,97 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Single-slot mailbox holding the most recent value published by a producer
+//thread, e.g. the last rendered frame of a live stream: each reader keeps
+//track of the last version it consumed, skips straight to the newest one
+//and counts the versions it never saw
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace wsp {
+
+//------------------------------------------------------------------------------
+/// Latest value slot: publishing replaces the current value and costs one
+/// allocation plus two atomic stores regardless of the number of readers;
+/// readers check for updates with a single atomic load and only touch the
+/// reference counted value when a new version is available.
+/// Values are immutable once published and released when the last reader
+/// holding them moves on to a newer version.
+/// Publish must be called by one thread at a time.
+/// @tparam T value type
+template < typename T >
+class LatestValue {
+    struct Node {
+        std::uint64_t version;
+        T value;
+        Node(std::uint64_t ver, T&& v) : version(ver), value(std::move(v)) {}
+    };
+public:
+    using Ptr = std::shared_ptr< const T >;
+    /// Per-reader state, usually stored in each per-session service
+    /// instance
+    class Reader {
+    public:
+        /// Get latest value if newer than the one returned by the
+        /// previous call
+        /// @param lv value slot
+        /// @param v output, unchanged if no new value is available
+        /// @return @c true if @c v was updated
+        bool Get(const LatestValue& lv, Ptr& v) {
+            if(lv.version_.load(std::memory_order_acquire) == version_)
+                return false;
+            std::shared_ptr< const Node > n = std::atomic_load(&lv.node_);
+            if(!n || n->version == version_) return false;
+            //values published before the first read are not counted
+            if(version_) dropped_ += n->version - version_ - 1;
+            version_ = n->version;
+            v = Ptr(n, &n->value); //aliasing: shares ownership of node
+            return true;
+        }
+        /// Number of values published but never returned by Get
+        std::uint64_t Dropped() const { return dropped_; }
+        /// Version of last value returned by Get, zero if none
+        std::uint64_t Version() const { return version_; }
+    private:
+        std::uint64_t version_ = 0;
+        std::uint64_t dropped_ = 0;
+    };
+    LatestValue() = default;
+    LatestValue(const LatestValue&) = delete;
+    LatestValue& operator=(const LatestValue&) = delete;
+    /// Make new value available to readers
+    void Publish(T v) {
+        const std::uint64_t ver =
+            version_.load(std::memory_order_relaxed) + 1;
+        std::shared_ptr< const Node > n =
+            std::make_shared< const Node >(ver, std::move(v));
+        std::atomic_store(&node_, std::move(n));
+        version_.store(ver, std::memory_order_release);
+    }
+    /// Number of values published so far
+    std::uint64_t Version() const {
+        return version_.load(std::memory_order_acquire);
+    }
+private:
+    std::shared_ptr< const Node > node_;
+    std::atomic< std::uint64_t > version_{0};
+};
+
+} //namespace wsp
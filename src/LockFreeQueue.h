@@ -0,0 +1,259 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Bounded lock-free queues:
+// - SPSCQueue: single producer, single consumer ring buffer
+// - MPSCQueue: multiple producers, single consumer ring buffer
+// - BlockingQueue: adds blocking Push/Pop on top of either; the mutex is
+//   only touched when the consumer has to sleep
+//Elements can be move-only types.
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace wsp {
+
+/// Cache line size used to keep producer and consumer indices apart
+const std::size_t CACHE_LINE_SIZE = 64;
+
+/// Round up to next power of two, minimum 2
+inline std::size_t RoundUpPowerOfTwo(std::size_t n) {
+    std::size_t p = 2;
+    while(p < n) p <<= 1;
+    return p;
+}
+
+//------------------------------------------------------------------------------
+/// Single producer, single consumer bounded queue
+/// @tparam T element type, must be default constructible and move assignable
+template < typename T >
+class SPSCQueue {
+public:
+    using value_type = T;
+    /// Constructor
+    /// @param capacity minimum capacity, rounded up to a power of two
+    explicit SPSCQueue(std::size_t capacity = 1024)
+        : buffer_(RoundUpPowerOfTwo(capacity)), mask_(buffer_.size() - 1) {}
+    SPSCQueue(const SPSCQueue&) = delete;
+    SPSCQueue& operator=(const SPSCQueue&) = delete;
+    /// Add element, producer only; @c v is moved from only on success
+    /// @return @c false if queue is full
+    bool TryPush(T&& v) {
+        const std::size_t t = tail_.load(std::memory_order_relaxed);
+        if(t - headCache_ > mask_) {
+            headCache_ = head_.load(std::memory_order_acquire);
+            if(t - headCache_ > mask_) return false;
+        }
+        buffer_[t & mask_] = std::move(v);
+        tail_.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    /// Remove element, consumer only
+    /// @return @c false if queue is empty
+    bool TryPop(T& v) {
+        const std::size_t h = head_.load(std::memory_order_relaxed);
+        if(h == tailCache_) {
+            tailCache_ = tail_.load(std::memory_order_acquire);
+            if(h == tailCache_) return false;
+        }
+        v = std::move(buffer_[h & mask_]);
+        head_.store(h + 1, std::memory_order_release);
+        return true;
+    }
+    /// @c true if no elements available; exact when called by the consumer
+    bool Empty() const {
+        return head_.load(std::memory_order_acquire) 
+               == tail_.load(std::memory_order_acquire);
+    }
+    /// Capacity
+    std::size_t Capacity() const { return mask_ + 1; }
+private:
+    std::vector< T > buffer_;
+    const std::size_t mask_;
+    ///consumer side
+    alignas(CACHE_LINE_SIZE) std::atomic< std::size_t > head_{0};
+    std::size_t tailCache_ = 0;
+    ///producer side
+    alignas(CACHE_LINE_SIZE) std::atomic< std::size_t > tail_{0};
+    std::size_t headCache_ = 0;
+};
+
+//------------------------------------------------------------------------------
+/// Multiple producers, single consumer bounded queue: each slot carries a
+/// sequence number telling producers and consumer whose turn it is
+/// @tparam T element type, must be default constructible and move assignable
+template < typename T >
+class MPSCQueue {
+    struct Cell {
+        std::atomic< std::size_t > seq;
+        T value;
+    };
+public:
+    using value_type = T;
+    /// Constructor
+    /// @param capacity minimum capacity, rounded up to a power of two
+    explicit MPSCQueue(std::size_t capacity = 1024)
+        : mask_(RoundUpPowerOfTwo(capacity) - 1),
+          cells_(new Cell[mask_ + 1]) {
+        for(std::size_t i = 0; i != mask_ + 1; ++i)
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+    /// Add element, can be called concurrently by any number of threads;
+    /// @c v is moved from only on success
+    /// @return @c false if queue is full
+    bool TryPush(T&& v) {
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        Cell* c = nullptr;
+        while(true) {
+            c = &cells_[pos & mask_];
+            const std::size_t seq = c->seq.load(std::memory_order_acquire);
+            const std::ptrdiff_t d = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+            if(d == 0) {
+                if(tail_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+                    break;
+            } else if(d < 0) return false;
+            else pos = tail_.load(std::memory_order_relaxed);
+        }
+        c->value = std::move(v);
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    /// Remove element, consumer only
+    /// @return @c false if queue is empty
+    bool TryPop(T& v) {
+        const std::size_t pos = head_.load(std::memory_order_relaxed);
+        Cell& c = cells_[pos & mask_];
+        if(c.seq.load(std::memory_order_acquire) != pos + 1) return false;
+        v = std::move(c.value);
+        c.seq.store(pos + mask_ + 1, std::memory_order_release);
+        head_.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+    /// @c true if no elements available; exact when called by the consumer
+    bool Empty() const {
+        const std::size_t pos = head_.load(std::memory_order_relaxed);
+        return cells_[pos & mask_].seq.load(std::memory_order_acquire)
+               != pos + 1;
+    }
+    /// Capacity
+    std::size_t Capacity() const { return mask_ + 1; }
+private:
+    const std::size_t mask_;
+    std::unique_ptr< Cell[] > cells_;
+    alignas(CACHE_LINE_SIZE) std::atomic< std::size_t > head_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic< std::size_t > tail_{0};
+};
+
+//------------------------------------------------------------------------------
+/// Blocking operations on top of a lock-free queue. Waiting consumers sleep
+/// on a condition variable; producers only take the mutex when a consumer
+/// is actually sleeping, so the fast path is lock-free
+/// @tparam Q SPSCQueue or MPSCQueue
+template < typename Q >
+class BlockingQueue {
+public:
+    using value_type = typename Q::value_type;
+    using T = value_type;
+    /// Constructor
+    /// @param capacity minimum capacity, rounded up to a power of two
+    explicit BlockingQueue(std::size_t capacity = 1024) : queue_(capacity) {}
+    /// Add element, yielding while the queue is full
+    /// @return @c false if the queue was closed
+    bool Push(T v) {
+        if(closed_.load(std::memory_order_acquire)) return false;
+        while(!queue_.TryPush(std::move(v))) {
+            if(closed_.load(std::memory_order_acquire)) return false;
+            std::this_thread::yield();
+        }
+        Notify();
+        return true;
+    }
+    /// Add element without waiting
+    /// @return @c false if queue is full
+    bool TryPush(T&& v) {
+        if(!queue_.TryPush(std::move(v))) return false;
+        Notify();
+        return true;
+    }
+    /// Remove element, waiting until one is available or the queue is
+    /// closed; consumer only
+    /// @return @c false if the queue was closed and is empty
+    bool Pop(T& v) {
+        const int SPIN_COUNT = 64;
+        for(int i = 0; i != SPIN_COUNT; ++i) {
+            if(queue_.TryPop(v)) return true;
+            std::this_thread::yield();
+        }
+        while(true) {
+            if(queue_.TryPop(v)) return true;
+            if(closed_.load(std::memory_order_acquire)) return false;
+            std::unique_lock< std::mutex > lock(mutex_);
+            sleeping_.store(true, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            cond_.wait(lock, [this]() {
+                return !queue_.Empty()
+                       || closed_.load(std::memory_order_acquire);
+            });
+            sleeping_.store(false, std::memory_order_relaxed);
+        }
+    }
+    /// Remove element without waiting, consumer only
+    /// @return @c false if queue is empty
+    bool TryPop(T& v) { return queue_.TryPop(v); }
+    /// @c true if no elements available; exact when called by the consumer
+    bool Empty() const { return queue_.Empty(); }
+    /// Wake up consumer and make all subsequent Push calls fail; elements
+    /// already in the queue can still be popped
+    void Close() {
+        closed_.store(true, std::memory_order_release);
+        std::lock_guard< std::mutex > guard(mutex_);
+        cond_.notify_all();
+    }
+private:
+    void Notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sleeping_.load(std::memory_order_seq_cst)) {
+            std::lock_guard< std::mutex > guard(mutex_);
+            cond_.notify_one();
+        }
+    }
+private:
+    Q queue_;
+    std::atomic< bool > closed_{false};
+    std::atomic< bool > sleeping_{false};
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+/// Blocking single producer, single consumer queue
+template < typename T >
+using SPSCBlockingQueue = BlockingQueue< SPSCQueue< T > >;
+/// Blocking multiple producers, single consumer queue
+template < typename T >
+using MPSCBlockingQueue = BlockingQueue< MPSCQueue< T > >;
+
+} //namespace wsp
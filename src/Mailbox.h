@@ -0,0 +1,94 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Lock-free multiple producer, single consumer mailbox: producers push
+//from any thread, the consumer takes all the pending messages at once
+
+#include <atomic>
+#include <utility>
+
+namespace wsp {
+
+template < typename T >
+class Mailbox {
+    struct Node {
+        T value;
+        Node* next;
+    };
+public:
+    Mailbox() = default;
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+    ~Mailbox() {
+        Delete(head_.exchange(nullptr));
+    }
+    /// Add message; can be called concurrently from any thread
+    void Push(T value) {
+        Node* n = new Node{std::move(value),
+                           head_.load(std::memory_order_relaxed)};
+        while(!head_.compare_exchange_weak(n->next, n,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed));
+    }
+    /// Remove all messages and invoke @c f on each of them in the order they
+    /// were pushed; must be called from a single thread at a time
+    /// @param f callable object invoked as <code>f(T&)</code>
+    /// @return number of messages
+    template < typename F >
+    int Drain(F&& f) {
+        Node* n = head_.exchange(nullptr, std::memory_order_acquire);
+        //stack -> FIFO order
+        Node* fifo = nullptr;
+        while(n) {
+            Node* next = n->next;
+            n->next = fifo;
+            fifo = n;
+            n = next;
+        }
+        int count = 0;
+        while(fifo) {
+            Node* next = fifo->next;
+            T value(std::move(fifo->value));
+            delete fifo;
+            fifo = next;
+            ++count;
+            try {
+                f(value);
+            } catch(...) {
+                Delete(fifo);
+                throw;
+            }
+        }
+        return count;
+    }
+    /// Return @c true if there are no pending messages
+    bool Empty() const {
+        return head_.load(std::memory_order_acquire) == nullptr;
+    }
+private:
+    static void Delete(Node* n) {
+        while(n) {
+            Node* next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+private:
+    std::atomic< Node* > head_{nullptr};
+};
+
+} //namespace wsp
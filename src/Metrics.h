@@ -0,0 +1,214 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Per-protocol counters updated from the service threads: each thread owns
+//a slot padded to a cache line, written with plain relaxed stores and
+//summed by readers, so that counting costs no shared atomic operation
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include "LockFreeQueue.h" //CACHE_LINE_SIZE
+
+namespace wsp {
+
+//------------------------------------------------------------------------------
+/// Array of counters replicated per service thread: each thread owns a
+/// slot followed by a cache line of padding and updates it with plain
+/// relaxed stores; one extra slot, updated with atomic increments, is
+/// shared by all the other threads
+class ThreadCounters {
+public:
+    ///Constructor
+    /// @param threads number of service threads
+    /// @param n number of counters
+    explicit ThreadCounters(int threads = 1, int n = 1) { Resize(threads, n); }
+    ///Allocate slots and reset all the counters
+    void Resize(int threads, int n) {
+        const int perLine = int(CACHE_LINE_SIZE / sizeof(std::uint64_t));
+        stride_ = (n + perLine - 1) / perLine * perLine + perLine;
+        count_ = threads + 1;
+        size_ = n;
+        values_.reset(new std::atomic< std::uint64_t >[stride_ * count_]);
+        for(int i = 0; i != stride_ * count_; ++i)
+            values_[i].store(0, std::memory_order_relaxed);
+    }
+    ///Increment counter
+    /// @param thread service thread index, negative if not called from a
+    ///        service thread
+    /// @param i counter index
+    /// @param n increment
+    void Add(int thread, int i, std::uint64_t n) {
+        if(thread < 0 || thread >= count_ - 1) {
+            Slot(count_ - 1)[i].fetch_add(n, std::memory_order_relaxed);
+            return;
+        }
+        //single writer: no read-modify-write needed
+        std::atomic< std::uint64_t >& v = Slot(thread)[i];
+        v.store(v.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+    }
+    ///Value of counter summed over all the threads
+    std::uint64_t Sum(int i) const {
+        std::uint64_t v = 0;
+        for(int t = 0; t != count_; ++t)
+            v += Slot(t)[i].load(std::memory_order_relaxed);
+        return v;
+    }
+    ///Number of counters
+    int Size() const { return size_; }
+private:
+    std::atomic< std::uint64_t >* Slot(int t) const {
+        return &values_[t * stride_];
+    }
+private:
+    std::unique_ptr< std::atomic< std::uint64_t >[] > values_;
+    int stride_ = 0;
+    int count_ = 0;
+    int size_ = 0;
+};
+
+//------------------------------------------------------------------------------
+/// Counters of a single protocol
+class ProtocolMetrics {
+public:
+    ///Counter ids
+    enum Counter {
+        SESSIONS_OPENED,
+        SESSIONS_CLOSED,
+        MESSAGES_IN,
+        BYTES_IN,
+        MESSAGES_OUT,
+        BYTES_OUT,
+        ///Write callbacks
+        WRITABLE,
+        ///Write callbacks deferred because the write slot was not open
+        THROTTLED,
+        ///Messages which did not fit into the socket at once and were
+        ///completed in later write callbacks
+        PARTIAL_WRITES,
+        ///lws_write failures
+        WRITE_ERRORS,
+        ///Connections closed for exceeding the message size or fragment
+        ///limits
+        OVERSIZED,
+        ///HTTP requests
+        HTTP_REQUESTS,
+        ///Files served from the file cache
+        FILE_CACHE_HITS,
+        ///Files not cached, served from disk
+        FILE_CACHE_MISSES,
+        COUNTER_COUNT
+    };
+    ///HTTP status codes counted individually, any other code is counted
+    ///as "other"
+    static const int* StatusCodes() {
+        static const int codes[] = {200, 206, 301, 302, 304, 400, 401, 403,
+                                    404, 413, 416, 500, 503, 0};
+        return codes;
+    }
+    enum { STATUS_COUNT = 14 }; //including "other"
+    ///Constructor
+    /// @param threads number of service threads
+    explicit ProtocolMetrics(int threads = 1) { Resize(threads); }
+    ///Allocate one slot per service thread plus one shared slot for
+    ///updates from other threads; resets all the counters
+    void Resize(int threads) {
+        values_.Resize(threads, VALUE_COUNT);
+    }
+    ///Increment counter
+    /// @param thread service thread index, negative if not called from a
+    ///        service thread
+    /// @param c counter
+    /// @param n increment
+    void Add(int thread, Counter c, std::uint64_t n = 1) {
+        values_.Add(thread, int(c), n);
+    }
+    ///Count HTTP response
+    /// @param thread service thread index, negative if not called from a
+    ///        service thread
+    /// @param code HTTP status code
+    void Status(int thread, int code) {
+        values_.Add(thread, COUNTER_COUNT + StatusIndex(code), 1);
+    }
+    ///Current value of counter, summed over all the threads
+    std::uint64_t Get(Counter c) const {
+        return values_.Sum(int(c));
+    }
+    ///Number of responses with status @c code, zero for "other"
+    std::uint64_t GetStatus(int code) const {
+        return values_.Sum(COUNTER_COUNT + StatusIndex(code));
+    }
+    ///Sessions currently open
+    std::uint64_t OpenSessions() const {
+        //read closed first: opened >= closed even while counting
+        const std::uint64_t closed = Get(SESSIONS_CLOSED);
+        const std::uint64_t opened = Get(SESSIONS_OPENED);
+        return opened > closed ? opened - closed : 0;
+    }
+    ///Metric name, without prefix and suffix
+    static const char* Name(Counter c) {
+        static const char* names[] = {
+            "sessions_opened", "sessions_closed", "messages_in", "bytes_in",
+            "messages_out", "bytes_out", "writable_callbacks",
+            "throttled_writes", "partial_writes", "write_errors",
+            "oversized_messages", "http_requests", "file_cache_hits",
+            "file_cache_misses"
+        };
+        return names[c];
+    }
+    ///Append metrics in Prometheus text format
+    /// @param os output stream
+    /// @param protocol protocol name, used as label
+    void Write(std::ostream& os, const std::string& protocol) const {
+        const std::string label = "{protocol=\"" + protocol + "\"}";
+        os << "wsp_sessions_open" << label << ' ' << OpenSessions() << '\n';
+        for(int c = 0; c != COUNTER_COUNT; ++c) {
+            os << "wsp_" << Name(Counter(c)) << "_total" << label << ' '
+               << Get(Counter(c)) << '\n';
+        }
+        for(const int* s = StatusCodes(); ; ++s) {
+            const std::uint64_t n = GetStatus(*s);
+            if(n) {
+                os << "wsp_http_responses_total{protocol=\"" << protocol
+                   << "\",code=\"";
+                if(*s) os << *s;
+                else os << "other";
+                os << "\"} " << n << '\n';
+            }
+            if(!*s) break;
+        }
+    }
+private:
+    ///Counters followed by HTTP status counts
+    enum { VALUE_COUNT = COUNTER_COUNT + STATUS_COUNT };
+    static int StatusIndex(int code) {
+        int i = 0;
+        for(const int* s = StatusCodes(); *s; ++s, ++i)
+            if(*s == code) return i;
+        return i; //other
+    }
+private:
+    ThreadCounters values_;
+};
+
+} //namespace wsp
@@ -0,0 +1,95 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Memory with the head and tail room libwebsockets requires around the
+//payload passed to lws_write: services storing their data in these buffers
+//can return @c true from PreformattedBuffer() and have WebSocketService::Send
+//write straight from their own storage, without an intermediate copy
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <memory>
+
+#include <libwebsockets.h>
+
+namespace wsp {
+
+/// Number of bytes reserved before the payload
+const std::size_t PRE_PADDING = LWS_SEND_BUFFER_PRE_PADDING;
+/// Number of bytes reserved after the payload
+const std::size_t POST_PADDING = LWS_SEND_BUFFER_POST_PADDING;
+
+/// Allocate raw memory with @c PRE_PADDING bytes before and @c POST_PADDING
+/// bytes after the returned pointer; release with FreePadded.
+/// Use this function to hand padded memory to C libraries which write into
+/// caller supplied buffers (e.g. turbojpeg with TJFLAG_NOREALLOC)
+inline char* AllocatePadded(std::size_t size) {
+    char* p = static_cast< char* >(
+        ::operator new(PRE_PADDING + size + POST_PADDING));
+    return p + PRE_PADDING;
+}
+
+/// Release memory returned by AllocatePadded
+inline void FreePadded(char* p) {
+    if(p) ::operator delete(p - PRE_PADDING);
+}
+
+/// Deleter for smart pointers wrapping memory returned by AllocatePadded
+struct PaddedDeleter {
+    void operator()(char* p) const { FreePadded(p); }
+};
+
+/// Allocate reference counted padded memory, usually shared among all
+/// the per-session service instances streaming the same content
+inline std::shared_ptr< char > MakeSharedPadded(std::size_t size) {
+    return std::shared_ptr< char >(AllocatePadded(size), PaddedDeleter());
+}
+
+/// Standard allocator adding libwebsockets' padding around each allocation;
+/// an @c std::vector using this allocator has writable space before
+/// <code>data()</code> and after <code>data() + capacity()</code>
+template < typename T >
+struct PaddedAllocator {
+    using value_type = T;
+    PaddedAllocator() = default;
+    template < typename U >
+    PaddedAllocator(const PaddedAllocator< U >&) {}
+    T* allocate(std::size_t n) {
+        return reinterpret_cast< T* >(AllocatePadded(n * sizeof(T)));
+    }
+    void deallocate(T* p, std::size_t) {
+        FreePadded(reinterpret_cast< char* >(p));
+    }
+};
+
+template < typename T, typename U >
+bool operator==(const PaddedAllocator< T >&, const PaddedAllocator< U >&) {
+    return true;
+}
+
+template < typename T, typename U >
+bool operator!=(const PaddedAllocator< T >&, const PaddedAllocator< U >&) {
+    return false;
+}
+
+/// Byte buffer suitable as storage for data frames of services returning
+/// @c true from PreformattedBuffer(); not to be shared among sessions when
+/// sent in place, see SharedFrame.h to send the same data to many clients
+using PaddedBuffer = std::vector< char, PaddedAllocator< char > >;
+
+} //namespace wsp
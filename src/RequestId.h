@@ -0,0 +1,67 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Request id envelope for concurrent request-reply protocols: requests
+//start with a 32 bit id in network byte order, which the service copies
+//in front of the reply so that clients pipelining requests over a single
+//connection can match replies arriving in completion order
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wsp {
+
+/// Size of the id in front of tagged requests and replies
+const std::size_t REQUEST_ID_SIZE = 4;
+
+/// Read id from the beginning of a tagged message
+/// @param msg message
+/// @param size message size
+/// @param id output
+/// @return @c false if the message is too short to hold an id
+inline bool ReadRequestId(const char* msg,
+                          std::size_t size,
+                          std::uint32_t& id) {
+    if(size < REQUEST_ID_SIZE) return false;
+    const unsigned char* p = reinterpret_cast< const unsigned char* >(msg);
+    id = (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16)
+         | (std::uint32_t(p[2]) << 8) | std::uint32_t(p[3]);
+    return true;
+}
+
+/// Write id in network byte order
+/// @param p output, at least REQUEST_ID_SIZE bytes
+/// @param id request id
+inline void WriteRequestId(char* p, std::uint32_t id) {
+    p[0] = char(id >> 24);
+    p[1] = char(id >> 16);
+    p[2] = char(id >> 8);
+    p[3] = char(id);
+}
+
+/// Insert id in front of reply
+/// @tparam B contiguous byte container e.g. PaddedBuffer
+/// @param reply reply payload
+/// @param id id of the request @c reply answers
+template < typename B >
+void TagReply(B& reply, std::uint32_t id) {
+    char h[REQUEST_ID_SIZE];
+    WriteRequestId(h, id);
+    reply.insert(reply.begin(), h, h + REQUEST_ID_SIZE);
+}
+
+} //namespace wsp
@@ -0,0 +1,116 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Immutable, reference counted WebSocket message shared by all the sessions
+//of a broadcast protocol: the frame header is built once, in the padding
+//in front of the payload, and each session writes the very same bytes
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#include "PaddedBuffer.h"
+
+namespace wsp {
+
+/// Maximum size of a server to client frame header
+const std::size_t MAX_FRAME_HEADER_SIZE = 10;
+
+/// Write unmasked WebSocket frame header with RSV bits clear
+/// @param h output, at least MAX_FRAME_HEADER_SIZE bytes
+/// @param opcode frame opcode: 0 continuation, 1 text, 2 binary
+/// @param fin @c true if last frame of message
+/// @param len payload length
+/// @return header size
+inline std::size_t WriteFrameHeader(unsigned char* h,
+                                    int opcode,
+                                    bool fin,
+                                    std::uint64_t len) {
+    std::size_t n = 0;
+    h[n++] = (fin ? 0x80 : 0) | (opcode & 0xf);
+    if(len < 126) h[n++] = (unsigned char) len;
+    else if(len < 0x10000) {
+        h[n++] = 126;
+        h[n++] = (unsigned char) (len >> 8);
+        h[n++] = (unsigned char) len;
+    } else {
+        h[n++] = 127;
+        for(int i = 7; i >= 0; --i) h[n++] = (unsigned char) (len >> 8 * i);
+    }
+    return n;
+}
+
+/// Complete, unfragmented WebSocket frame: header followed by payload
+class SharedFrame {
+public:
+    static_assert(PRE_PADDING >= MAX_FRAME_HEADER_SIZE,
+                  "Not enough padding to store frame header");
+    /// Constructor: takes ownership of payload, no copy is performed
+    /// @param payload message content
+    /// @param binary @c true for binary, @c false for text messages
+    SharedFrame(PaddedBuffer&& payload, bool binary)
+        : payload_(std::move(payload)), binary_(binary) {
+        //make sure the padding in front of data() is allocated
+        if(payload_.capacity() == 0) payload_.reserve(1);
+        unsigned char h[MAX_FRAME_HEADER_SIZE];
+        const std::size_t n = 
+            WriteFrameHeader(h, binary ? 0x2 : 0x1, true, payload_.size());
+        begin_ = payload_.data() - n;
+        std::memcpy(begin_, h, n);
+    }
+    /// Constructor: copies payload
+    /// @param data message content
+    /// @param size message size
+    /// @param binary @c true for binary, @c false for text messages
+    SharedFrame(const char* data, std::size_t size, bool binary)
+        : SharedFrame(PaddedBuffer(data, data + size), binary) {}
+    SharedFrame(const SharedFrame&) = delete;
+    SharedFrame& operator=(const SharedFrame&) = delete;
+    /// Beginning of frame header
+    const char* Begin() const { return begin_; }
+    /// One past the last payload element
+    const char* End() const { return payload_.data() + payload_.size(); }
+    /// Size of header + payload
+    std::size_t Size() const { return End() - Begin(); }
+    /// Payload
+    const PaddedBuffer& Payload() const { return payload_; }
+    /// @c true if binary message
+    bool Binary() const { return binary_; }
+private:
+    PaddedBuffer payload_;
+    char* begin_ = nullptr;
+    bool binary_ = true;
+};
+
+using SharedFramePtr = std::shared_ptr< const SharedFrame >;
+
+/// Create shared frame taking ownership of the payload
+inline SharedFramePtr MakeSharedFrame(PaddedBuffer&& payload,
+                                      bool binary = true) {
+    return std::make_shared< const SharedFrame >(std::move(payload), binary);
+}
+
+/// Create shared frame copying the payload
+inline SharedFramePtr MakeSharedFrame(const char* data,
+                                      std::size_t size,
+                                      bool binary = true) {
+    return std::make_shared< const SharedFrame >(data, size, binary);
+}
+
+} //namespace wsp
@@ -0,0 +1,64 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Non-owning reference to a character sequence, usable in constant
+//expressions; a C++11 subset of std::string_view
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <ostream>
+
+namespace wsp {
+
+class StringView {
+public:
+    constexpr StringView() : data_(""), size_(0) {}
+    constexpr StringView(const char* data, std::size_t size)
+        : data_(data), size_(size) {}
+    ///@c s must be null terminated
+    StringView(const char* s) : data_(s), size_(std::strlen(s)) {}
+    StringView(const std::string& s) : data_(s.data()), size_(s.size()) {}
+    constexpr const char* data() const { return data_; }
+    constexpr std::size_t size() const { return size_; }
+    constexpr bool empty() const { return size_ == 0; }
+    constexpr char operator[](std::size_t i) const { return data_[i]; }
+    constexpr const char* begin() const { return data_; }
+    constexpr const char* end() const { return data_ + size_; }
+    ///Sub-sequence starting at @c pos, @c pos <= size()
+    constexpr StringView substr(std::size_t pos) const {
+        return StringView(data_ + pos, size_ - pos);
+    }
+    std::string str() const { return std::string(data_, size_); }
+    operator std::string() const { return str(); }
+private:
+    const char* data_;
+    std::size_t size_;
+};
+
+inline bool operator==(StringView a, StringView b) {
+    return a.size() == b.size()
+           && std::memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+inline bool operator!=(StringView a, StringView b) { return !(a == b); }
+
+inline std::ostream& operator<<(std::ostream& os, StringView s) {
+    return os.write(s.data(), s.size());
+}
+
+} //namespace wsp
@@ -0,0 +1,160 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Fixed size thread pool with one task queue per worker: tasks submitted
+//from outside the pool are distributed round-robin, tasks submitted by a
+//worker go to its own queue, idle workers steal from the others
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace wsp {
+
+//------------------------------------------------------------------------------
+/// Work-stealing thread pool. Workers pop tasks from the back of their own
+/// queue and steal from the front of the other queues; each queue has its
+/// own lock so that submitters and workers rarely contend on the same one.
+/// Workers with nothing to do sleep until a task is submitted.
+/// Exceptions thrown by tasks are caught and discarded.
+class ThreadPool {
+public:
+    using Task = std::function< void () >;
+    /// Constructor: starts worker threads
+    /// @param threads number of threads, hardware concurrency if zero
+    explicit ThreadPool(int threads = 0) {
+        if(threads < 1)
+            threads = std::max(1, int(std::thread::hardware_concurrency()));
+        queues_.reserve(threads);
+        for(int i = 0; i != threads; ++i)
+            queues_.push_back(std::unique_ptr< Queue >(new Queue));
+        workers_.reserve(threads);
+        for(int i = 0; i != threads; ++i)
+            workers_.push_back(std::thread([this, i]() { Run(i); }));
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    /// Destructor: waits for running tasks to complete, queued tasks are
+    /// discarded
+    ~ThreadPool() {
+        {
+            std::lock_guard< std::mutex > guard(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        for(auto& t: workers_) t.join();
+    }
+    /// Queue task for execution; thread safe
+    void Submit(Task t) {
+        const int self = WorkerIndex();
+        const std::size_t i = self >= 0 ? std::size_t(self)
+                              : next_.fetch_add(1, std::memory_order_relaxed)
+                                % queues_.size();
+        //counted before it is visible: Pop never makes the count negative
+        queued_.fetch_add(1, std::memory_order_seq_cst);
+        {
+            std::lock_guard< std::mutex > guard(queues_[i]->mutex);
+            queues_[i]->tasks.push_back(std::move(t));
+        }
+        if(idle_.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard< std::mutex > guard(mutex_);
+            cond_.notify_one();
+        }
+    }
+    /// Number of worker threads
+    int Size() const { return int(workers_.size()); }
+    /// Number of tasks queued and not yet started
+    std::size_t Queued() const {
+        return queued_.load(std::memory_order_relaxed);
+    }
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque< Task > tasks;
+    };
+    /// Pool and index of the worker running on the calling thread
+    struct Worker {
+        const ThreadPool* pool = nullptr;
+        int index = -1;
+    };
+    static Worker& CurrentWorker() {
+        static thread_local Worker w;
+        return w;
+    }
+    /// Index of calling thread if it is a worker of this pool, -1 otherwise
+    int WorkerIndex() const {
+        const Worker& w = CurrentWorker();
+        return w.pool == this ? w.index : -1;
+    }
+    /// Pop from own queue first, then steal
+    bool Pop(int self, Task& t) {
+        const std::size_t n = queues_.size();
+        for(std::size_t k = 0; k != n; ++k) {
+            Queue& q = *queues_[(self + k) % n];
+            std::lock_guard< std::mutex > guard(q.mutex);
+            if(q.tasks.empty()) continue;
+            if(k == 0) {
+                t = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            } else {
+                t = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            queued_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+    void Run(int self) {
+        CurrentWorker().pool = this;
+        CurrentWorker().index = self;
+        while(true) {
+            Task t;
+            if(Pop(self, t)) {
+                try {
+                    t();
+                } catch(...) {}
+                continue;
+            }
+            std::unique_lock< std::mutex > lock(mutex_);
+            idle_.fetch_add(1, std::memory_order_seq_cst);
+            cond_.wait(lock, [this]() {
+                return stop_ || queued_.load(std::memory_order_seq_cst) > 0;
+            });
+            idle_.fetch_sub(1, std::memory_order_relaxed);
+            if(stop_) return;
+        }
+    }
+private:
+    std::vector< std::unique_ptr< Queue > > queues_;
+    std::vector< std::thread > workers_;
+    std::atomic< std::size_t > next_{0};
+    std::atomic< std::size_t > queued_{0};
+    std::atomic< int > idle_{0};
+    bool stop_ = false;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+} //namespace wsp
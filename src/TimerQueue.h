@@ -0,0 +1,139 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Intrusive min-heap of deadlines used to wake throttled sessions exactly
+//when their next write slot opens: nodes live in per-session memory, so
+//scheduling and cancelling never allocate
+
+#include <vector>
+#include <chrono>
+#include <utility>
+#include <cassert>
+
+namespace wsp {
+
+class TimerQueue;
+
+/// Timer entry, embedded into the object to be notified
+struct TimerNode {
+    using TimePoint = std::chrono::steady_clock::time_point;
+    /// Expiration time
+    TimePoint deadline;
+    /// User data passed back on expiration
+    void* data = nullptr;
+    /// Queue the node is scheduled in, @c nullptr if not scheduled
+    TimerQueue* queue = nullptr;
+    /// Position in heap
+    int index = -1;
+};
+
+/// Min-heap of TimerNode pointers ordered by deadline; each operation is
+/// O(log n), Next() is O(1). Not thread safe: each service thread owns
+/// its own queue
+class TimerQueue {
+public:
+    using TimePoint = TimerNode::TimePoint;
+    TimerQueue() = default;
+    TimerQueue(const TimerQueue&) = delete;
+    TimerQueue& operator=(const TimerQueue&) = delete;
+    TimerQueue(TimerQueue&&) = default;
+    /// Schedule node or move its deadline if already scheduled in this
+    /// queue
+    /// @param n timer node, must outlive its scheduling
+    /// @param t expiration time
+    void Schedule(TimerNode* n, const TimePoint& t) {
+        assert(n->queue == nullptr || n->queue == this);
+        if(n->queue == this) {
+            const bool earlier = t < n->deadline;
+            n->deadline = t;
+            if(earlier) SiftUp(n->index);
+            else SiftDown(n->index);
+            return;
+        }
+        n->deadline = t;
+        n->queue = this;
+        n->index = int(heap_.size());
+        heap_.push_back(n);
+        SiftUp(n->index);
+    }
+    /// Remove node from queue, no-op if not scheduled
+    void Cancel(TimerNode* n) {
+        if(n->queue != this) return;
+        const int i = n->index;
+        const int last = int(heap_.size()) - 1;
+        if(i != last) {
+            Swap(i, last);
+            heap_.pop_back();
+            SiftDown(i);
+            SiftUp(i);
+        } else heap_.pop_back();
+        n->queue = nullptr;
+        n->index = -1;
+    }
+    /// Return @c true if no timer is scheduled
+    bool Empty() const { return heap_.empty(); }
+    /// Number of scheduled timers
+    std::size_t Size() const { return heap_.size(); }
+    /// Earliest deadline; queue must not be empty
+    const TimePoint& Next() const {
+        assert(!heap_.empty());
+        return heap_.front()->deadline;
+    }
+    /// Remove all the nodes with a deadline <= @c now and invoke @c f
+    /// on each of them; @c f can re-schedule the node
+    /// @param now current time
+    /// @param f callable object invoked as <code>f(TimerNode*)</code>
+    template < typename F >
+    void Expire(const TimePoint& now, F&& f) {
+        while(!heap_.empty() && !(now < heap_.front()->deadline)) {
+            TimerNode* n = heap_.front();
+            Cancel(n);
+            f(n);
+        }
+    }
+private:
+    void Swap(int i, int j) {
+        std::swap(heap_[i], heap_[j]);
+        heap_[i]->index = i;
+        heap_[j]->index = j;
+    }
+    void SiftUp(int i) {
+        while(i > 0) {
+            const int p = (i - 1) / 2;
+            if(!(heap_[i]->deadline < heap_[p]->deadline)) break;
+            Swap(i, p);
+            i = p;
+        }
+    }
+    void SiftDown(int i) {
+        const int n = int(heap_.size());
+        while(true) {
+            const int l = 2 * i + 1;
+            const int r = l + 1;
+            int m = i;
+            if(l < n && heap_[l]->deadline < heap_[m]->deadline) m = l;
+            if(r < n && heap_[r]->deadline < heap_[m]->deadline) m = r;
+            if(m == i) break;
+            Swap(i, m);
+            i = m;
+        }
+    }
+private:
+    std::vector< TimerNode* > heap_;
+};
+
+} //namespace wsp
@@ -19,6 +19,14 @@
 #include <algorithm>
 #include <sstream>
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+
 namespace wsp {
 
 
@@ -44,5 +52,495 @@ const std::map< std::string, lws_log_levels > WebSocketService::levelNames_ =
                                                      {"CLIENT", LLL_CLIENT},
                                                      {"LATENCY", LLL_LATENCY}};
 
+std::atomic< bool > WebSocketService::adaptiveFragmentSize_(true);
+
+const lws_extension WebSocketService::extensions_[] = {
+    {"permessage-deflate",
+     lws_extension_callback_pm_deflate,
+     "permessage-deflate; client_no_context_takeover; client_max_window_bits"},
+    {nullptr, nullptr, nullptr}
+};
+
+bool WebSocketService::ConfigureDeflate(lws* wsi) {
+    const ProtocolState* ps = 
+        static_cast< const ProtocolState* >(lws_get_protocol(wsi)->user);
+    if(!ps || !ps->deflate.enabled) return false;
+    const Deflate& d = ps->deflate;
+    //fails if the client did not negotiate the extension: libwebsockets
+    //2.x looks the name up in the connection's active extensions; the
+    //compressor is created on the first message, after these options are
+    //set
+    const char* ext = "permessage-deflate";
+    if(lws_set_extension_option(wsi, ext, "server_max_window_bits",
+                                std::to_string(d.windowBits).c_str()) < 0)
+        return false;
+    lws_set_extension_option(wsi, ext, "mem_level",
+                             std::to_string(d.memLevel).c_str());
+    lws_set_extension_option(wsi, ext, "compression_level",
+                             std::to_string(d.level).c_str());
+    if(d.noContextTakeover)
+        lws_set_extension_option(wsi, ext, "server_no_context_takeover", "");
+    return true;
+}
+
+void WebSocketService::StoreMessage(lws* wsi, WriteState* ws,
+                                    const FrameView& f) {
+    const ProtocolState* ps = 
+        static_cast< const ProtocolState* >(lws_get_protocol(wsi)->user);
+    if(!ps) return;
+    const bool store = (f.binary && f.compressed)
+                       || f.messageSize < ps->deflate.minSize;
+    if(store == ws->stored) return;
+    //between messages: the previous one was flushed by libwebsockets
+    const std::string level = store ? "0" : std::to_string(ps->deflate.level);
+    lws_set_extension_option(wsi, "permessage-deflate", "compression_level",
+                             level.c_str());
+    ws->stored = store;
+}
+
+int WebSocketService::FragmentSize(lws* wsi, int suggested) {
+    suggested = std::max(1, suggested);
+    if(!adaptiveFragmentSize_) return suggested;
+#ifdef TIOCOUTQ
+    const int fd = lws_get_socket_fd(wsi);
+    if(fd < 0) return suggested;
+    int sndBuf = 0;
+    socklen_t len = sizeof(sndBuf);
+    if(getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndBuf, &len) != 0)
+        return suggested;
+    //bytes not yet acknowledged by the peer
+    int queued = 0;
+    if(ioctl(fd, TIOCOUTQ, &queued) != 0) return suggested;
+    //Linux reports twice the payload capacity, the other half accounting
+    //for bookkeeping overhead; leave room for the frame header
+    const int headroom = sndBuf / 2 - queued - int(LWS_PRE);
+    //never below the suggested size: the estimate is conservative, the
+    //socket stays writable past it and returning less would either spin
+    //on write callbacks or send tiny fragments; lws_send_pipe_choked
+    //stops the sender when the socket is really full. SO_SNDBUF can be
+    //several MiB: bound the size of the copy buffer
+    return std::min(std::max(suggested, headroom),
+                    std::max(suggested, int(MAX_FRAGMENT_SIZE)));
+#else
+    return suggested;
+#endif
+}
+
+
+void WebSocketService::AddMetricsHandler() {
+    if(metricsPath_.empty()
+       || protocolStates_.find("http-only") != protocolStates_.end()) return;
+    lws_protocols p;
+    std::memset(&p, 0, sizeof(p));
+    p.name = new char[sizeof("http-only")];
+    std::strcpy((char*) p.name, "http-only");
+    p.callback = &WebSocketService::MetricsCallback;
+    p.per_session_data_size = 0;
+    ProtocolState* ps = new ProtocolState;
+    protocolStates_[p.name].reset(ps);
+    ps->service = this;
+    ps->metricsPath = metricsPath_;
+    p.user = ps;
+    //http protocol must be the first
+    protocolHandlers_.insert(protocolHandlers_.begin(), p);
+}
+
+bool WebSocketService::ServeMetrics(lws* wsi, const char* uri, int& status) {
+    const ProtocolState* ps = 
+        static_cast< const ProtocolState* >(lws_get_protocol(wsi)->user);
+    if(!ps || ps->metricsPath.empty() || !uri || ps->metricsPath != uri
+       || lws_hdr_total_length(wsi, WSI_TOKEN_GET_URI) < 1) return false;
+    const std::string body = ps->service->MetricsText();
+    std::ostringstream os;
+    os << "HTTP/1.1 200 OK\r\n"
+       << "Content-Type: text/plain; version=0.0.4\r\n"
+       << "Content-Length: " << body.size() << "\r\n\r\n"
+       << body;
+    const std::string r = os.str();
+    //libwebsockets buffers what the socket cannot take
+    std::vector< char > buffer(LWS_SEND_BUFFER_PRE_PADDING + r.size()
+                               + LWS_SEND_BUFFER_POST_PADDING);
+    std::copy(r.begin(), r.end(),
+              buffer.begin() + LWS_SEND_BUFFER_PRE_PADDING);
+    CountStatus(wsi, HTTP_STATUS_OK);
+    const int w = lws_write(wsi, 
+                      (unsigned char*) &buffer[LWS_SEND_BUFFER_PRE_PADDING],
+                      r.size(), LWS_WRITE_HTTP);
+    if(w < 0) {
+        Count(wsi, ProtocolMetrics::WRITE_ERRORS);
+        status = -1;
+        return true;
+    }
+    Count(wsi, ProtocolMetrics::BYTES_OUT, w);
+    //keep connection alive if the client asked for it
+    status = lws_http_transaction_completed(wsi) ? -1 : 0;
+    return true;
+}
+
+bool WebSocketService::ServeCachedFile(lws* wsi, const Request& req,
+                                       const std::string& path,
+                                       const std::string& mimeType,
+                                       int& status) {
+    const ProtocolState* ps = 
+        static_cast< const ProtocolState* >(lws_get_protocol(wsi)->user);
+    if(!ps || !ps->files) return false;
+    const int accepted = AcceptedEncodings(req.Get(HDR_ACCEPT_ENCODING));
+    FileCache::EntryPtr e;
+    for(ContentEncoding c: {ENCODING_BR, ENCODING_GZIP, ENCODING_IDENTITY}) {
+        if(accepted & c) e = ps->files->Get(path, mimeType, c);
+        if(e) break;
+    }
+    if(!e) {
+        Count(wsi, ProtocolMetrics::FILE_CACHE_MISSES);
+        return false;
+    }
+    Count(wsi, ProtocolMetrics::FILE_CACHE_HITS);
+    const bool notModified = 
+        FileCache::NotModified(*e, req.Get(HDR_IF_NONE_MATCH),
+                               req.Get(HDR_IF_MODIFIED_SINCE));
+    ByteRanges ranges;
+    const RangeStatus rs = !notModified && req.Has(HDR_RANGE)
+                           ? ParseRange(req.Get(HDR_RANGE), e->size, ranges)
+                           : RANGE_NONE;
+    if(rs != RANGE_NONE) {
+        ServiceLoop* l = CurrentLoop();
+        if(!l) return false;
+        std::unique_ptr< FileTransfer > t(new FileTransfer);
+        if(rs == RANGE_PARTIAL) {
+            t->parts = PartialContent(ranges, e->size, e->mimeType,
+                                      e->headers);
+            CountStatus(wsi, HTTP_STATUS_PARTIAL_CONTENT);
+        } else {
+            t->parts.resize(1);
+            t->parts[0].text = RangeNotSatisfiable(e->size);
+            CountStatus(wsi, HTTP_STATUS_REQ_RANGE_NOT_SATISFIABLE);
+        }
+        //ranges are sent in place from the cached response
+        t->content = e->Content();
+        t->entry = e;
+        l->files[wsi] = std::move(t);
+        lws_callback_on_writable(wsi);
+        status = 0;
+        return true;
+    }
+    const PaddedBuffer& r = notModified ? e->notModified : e->response;
+    CountStatus(wsi, notModified ? HTTP_STATUS_NOT_MODIFIED
+                                 : HTTP_STATUS_OK);
+    //the response is shared by all the sessions: lws_write does not modify
+    //HTTP data and copies what the socket cannot take
+    const int w = lws_write(wsi, (unsigned char*) r.data(), r.size(),
+                            LWS_WRITE_HTTP);
+    if(w < 0) {
+        Count(wsi, ProtocolMetrics::WRITE_ERRORS);
+        status = -1;
+        return true;
+    }
+    Count(wsi, ProtocolMetrics::BYTES_OUT, w);
+    status = lws_http_transaction_completed(wsi) ? -1 : 0;
+    return true;
+}
+
+WebSocketService::FileTransfer::~FileTransfer() {
+    if(fd >= 0) ::close(fd);
+}
+
+std::string WebSocketService::Precompressed(const Request& req,
+                                            const std::string& path,
+                                            std::string& headers) {
+    const int accepted = AcceptedEncodings(req.Get(HDR_ACCEPT_ENCODING));
+    for(ContentEncoding c: {ENCODING_BR, ENCODING_GZIP}) {
+        if(!(accepted & c)) continue;
+        const std::string p = path + EncodingSuffix(c);
+        struct stat st;
+        if(::stat(p.c_str(), &st) || !S_ISREG(st.st_mode)) continue;
+        headers += std::string("Content-Encoding: ") + EncodingName(c)
+                   + "\r\nVary: Accept-Encoding\r\n";
+        return p;
+    }
+    return path;
+}
+
+bool WebSocketService::ServeFileRange(lws* wsi, const Request& req,
+                                      const std::string& path,
+                                      const std::string& mimeType,
+                                      const std::string& headers,
+                                      int& status) {
+    if(!req.Has(HDR_RANGE)) return false;
+    ServiceLoop* l = CurrentLoop();
+    if(!l) return false;
+    std::unique_ptr< FileTransfer > t(new FileTransfer);
+    t->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(t->fd < 0 || fstat(t->fd, &st) || !S_ISREG(st.st_mode)) return false;
+    const std::uint64_t size = std::uint64_t(st.st_size);
+    ByteRanges ranges;
+    switch(ParseRange(req.Get(HDR_RANGE), size, ranges)) {
+    case RANGE_NONE:
+        return false;
+    case RANGE_UNSATISFIABLE:
+        t->parts.resize(1);
+        t->parts[0].text = RangeNotSatisfiable(size);
+        CountStatus(wsi, HTTP_STATUS_REQ_RANGE_NOT_SATISFIABLE);
+        break;
+    case RANGE_PARTIAL: {
+        const std::string lastModified = 
+            "Last-Modified: " + FileCache::HttpDate(st.st_mtime) + "\r\n";
+        t->parts = PartialContent(ranges, size, mimeType,
+                                  headers + lastModified);
+        CountStatus(wsi, HTTP_STATUS_PARTIAL_CONTENT);
+        }
+        break;
+    }
+    l->files[wsi] = std::move(t);
+    lws_callback_on_writable(wsi);
+    status = 0;
+    return true;
+}
+
+int WebSocketService::ContinueFileRange(lws* wsi) {
+    ServiceLoop* l = CurrentLoop();
+    if(!l || l->files.empty()) return -1;
+    auto i = l->files.find(wsi);
+    if(i == l->files.end()) return -1;
+    FileTransfer& t = *i->second;
+    t.buffer.reserve(FILE_CHUNK_SIZE);
+    while(!lws_send_pipe_choked(wsi)) {
+        const char* data = nullptr;
+        std::size_t size = 0;
+        if(t.content && t.parts[t.part].text.empty()) {
+            //slice of a response held in memory, written in place
+            const ResponsePart& p = t.parts[t.part];
+            size = std::size_t(std::min(std::uint64_t(FILE_CHUNK_SIZE),
+                                        p.size - t.offset));
+            data = t.content + p.offset + t.offset;
+            t.offset += size;
+            if(t.offset == p.size) {
+                ++t.part;
+                t.offset = 0;
+            }
+        } else {
+            //file truncated: the response cannot be completed
+            if(!FillChunk(t)) {
+                l->files.erase(i);
+                return 1;
+            }
+            data = t.buffer.data();
+            size = t.buffer.size();
+        }
+        const int w = lws_write(wsi, (unsigned char*) data, size,
+                                LWS_WRITE_HTTP);
+        if(w < 0) {
+            Count(wsi, ProtocolMetrics::WRITE_ERRORS);
+            l->files.erase(i);
+            return 1;
+        }
+        Count(wsi, ProtocolMetrics::BYTES_OUT, w);
+        if(t.part == t.parts.size()) {
+            l->files.erase(i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+bool WebSocketService::FillChunk(FileTransfer& t) {
+    t.buffer.resize(0);
+    while(t.part != t.parts.size() && t.buffer.size() < FILE_CHUNK_SIZE) {
+        const ResponsePart& p = t.parts[t.part];
+        //content held in memory is not copied
+        if(t.content && p.text.empty()) break;
+        const std::size_t room = FILE_CHUNK_SIZE - t.buffer.size();
+        if(!p.text.empty()) {
+            const std::size_t n = 
+                std::min(room, std::size_t(p.text.size() - t.offset));
+            t.buffer.insert(t.buffer.end(), p.text.begin() + t.offset,
+                            p.text.begin() + t.offset + n);
+            t.offset += n;
+            if(t.offset == p.text.size()) {
+                ++t.part;
+                t.offset = 0;
+            }
+            continue;
+        }
+        const std::size_t n = 
+            std::size_t(std::min(std::uint64_t(room), p.size - t.offset));
+        const std::size_t b = t.buffer.size();
+        t.buffer.resize(b + n);
+        const ssize_t r = ::pread(t.fd, t.buffer.data() + b, n,
+                                  off_t(p.offset + t.offset));
+        if(r <= 0) return false;
+        t.buffer.resize(b + std::size_t(r));
+        t.offset += std::uint64_t(r);
+        if(t.offset == p.size) {
+            ++t.part;
+            t.offset = 0;
+        }
+    }
+    return true;
+}
+
+void WebSocketService::EndFileRange(lws* wsi) {
+    ServiceLoop* l = CurrentLoop();
+    if(!l) return;
+    if(!l->files.empty()) l->files.erase(wsi);
+    if(!l->ranges.empty()) l->ranges.erase(wsi);
+}
+
+void WebSocketService::KeepRange(lws* wsi, const Request& req) {
+    ServiceLoop* l = CurrentLoop();
+    if(!l) return;
+    if(req.Has(HDR_RANGE)) l->ranges[wsi] = req.Get(HDR_RANGE);
+    else if(!l->ranges.empty()) l->ranges.erase(wsi);
+}
+
+std::string WebSocketService::TakeRange(lws* wsi) {
+    ServiceLoop* l = CurrentLoop();
+    if(!l || l->ranges.empty()) return std::string();
+    auto i = l->ranges.find(wsi);
+    if(i == l->ranges.end()) return std::string();
+    std::string r = std::move(i->second);
+    l->ranges.erase(i);
+    return r;
+}
+
+bool WebSocketService::StartBody(lws* wsi, const Request& req,
+                                 Session& session, int& status) {
+    const ProtocolState* ps = static_cast< const ProtocolState* >(
+                                            lws_get_protocol(wsi)->user);
+    const std::int64_t size = GetContentSize(req);
+    int code = 0;
+    if(req.Has(HDR_CONTENT_LENGTH) && size < 0) code = HTTP_STATUS_BAD_REQUEST;
+    if(!code && ps && ps->maxMessageSize
+            && size > std::int64_t(ps->maxMessageSize)) {
+        code = HTTP_STATUS_REQ_ENTITY_TOO_LARGE;
+        Count(wsi, ProtocolMetrics::OVERSIZED);
+    }
+    if(code) {
+        lws_return_http_status(wsi, code, NULL);
+        CountStatus(wsi, code);
+        status = -1;
+        return false;
+    }
+    ServiceLoop* l = CurrentLoop();
+    if(!l) return true;
+    session = NewSession(l, wsi);
+    RequestBody& b = l->bodies[wsi];
+    b.session = session.id;
+    b.limit = size >= 0 || !ps || !ps->maxMessageSize
+              ? size : std::int64_t(ps->maxMessageSize);
+    b.received = 0;
+    return true;
+}
+
+bool WebSocketService::ReceiveBody(lws* wsi, std::size_t len, int& status) {
+    ServiceLoop* l = CurrentLoop();
+    if(!l) return true;
+    auto i = l->bodies.find(wsi);
+    if(i == l->bodies.end()) return true;
+    i->second.received += std::int64_t(len);
+    if(i->second.limit < 0 || i->second.received <= i->second.limit)
+        return true;
+    EndBody(wsi);
+    Count(wsi, ProtocolMetrics::OVERSIZED);
+    lws_return_http_status(wsi, HTTP_STATUS_REQ_ENTITY_TOO_LARGE, NULL);
+    CountStatus(wsi, HTTP_STATUS_REQ_ENTITY_TOO_LARGE);
+    status = -1;
+    return false;
+}
+
+bool WebSocketService::EndBody(lws* wsi) {
+    ServiceLoop* l = CurrentLoop();
+    if(!l) return false;
+    auto i = l->bodies.find(wsi);
+    if(i == l->bodies.end()) return false;
+    l->sessions.erase(i->second.session);
+    l->bodies.erase(i);
+    return true;
+}
+
+void WebSocketService::CompleteBody(lws* wsi) {
+    ServiceLoop* l = CurrentLoop();
+    if(!l) return;
+    auto i = l->bodies.find(wsi);
+    if(i != l->bodies.end()) i->second.complete = true;
+}
+
+bool WebSocketService::SendRange(lws* wsi, const char* range,
+                                 const char* response, std::size_t size) {
+    if(!*range || ResponseStatus(response, size) != HTTP_STATUS_OK)
+        return false;
+    const char* end = response + size;
+    static const char sep[] = "\r\n\r\n";
+    const char* body = std::search(response, end, sep, sep + 4);
+    if(body == end) return false;
+    body += 4;
+    const std::uint64_t length = std::uint64_t(end - body);
+    //keep header lines except the ones describing the complete content
+    std::string headers;
+    std::string mimeType;
+    const char* line = std::find(response, body, '\n') + 1;
+    while(line < body - 2) {
+        const char* next = std::find(line, body, '\n') + 1;
+        const std::string h(line, next);
+        if(!strncasecmp(h.c_str(), "Content-Length:", 15)) {
+            //response not complete
+            if(std::strtoull(h.c_str() + 15, nullptr, 10) != length)
+                return false;
+        } else if(!strncasecmp(h.c_str(), "Content-Type:", 13)) {
+            const std::size_t b = h.find_first_not_of(" \t", 13);
+            const std::size_t e = h.find_last_not_of(" \t\r\n");
+            if(b != std::string::npos && e >= b)
+                mimeType = h.substr(b, e - b + 1);
+        } else if(strncasecmp(h.c_str(), "Content-Range:", 14)) {
+            headers += h;
+        }
+        line = next;
+    }
+    ServiceLoop* l = CurrentLoop();
+    if(!l) return false;
+    ByteRanges ranges;
+    std::unique_ptr< FileTransfer > t(new FileTransfer);
+    switch(ParseRange(range, length, ranges)) {
+    case RANGE_NONE:
+        return false;
+    case RANGE_UNSATISFIABLE:
+        t->parts.resize(1);
+        t->parts[0].text = RangeNotSatisfiable(length);
+        CountStatus(wsi, HTTP_STATUS_REQ_RANGE_NOT_SATISFIABLE);
+        break;
+    case RANGE_PARTIAL:
+        t->parts = PartialContent(ranges, length, mimeType, headers);
+        CountStatus(wsi, HTTP_STATUS_PARTIAL_CONTENT);
+        break;
+    }
+    //sent in place from the service's buffer, see HttpSend
+    t->content = body;
+    l->files[wsi] = std::move(t);
+    lws_callback_on_writable(wsi);
+    return true;
+}
+
+int WebSocketService::MetricsCallback(lws *wsi,
+                                      lws_callback_reasons reason,
+                                      void *,
+                                      void *in,
+                                      size_t) {
+    switch(reason) {
+    case LWS_CALLBACK_HTTP: {
+        Count(wsi, ProtocolMetrics::HTTP_REQUESTS);
+        int status = 0;
+        if(ServeMetrics(wsi, (const char*) in, status)) return status;
+        lws_return_http_status(wsi, HTTP_STATUS_NOT_FOUND, NULL);
+        CountStatus(wsi, HTTP_STATUS_NOT_FOUND);
+        return -1;
+    }
+    case LWS_CALLBACK_GET_THREAD_ID:
+        return ThreadId();
+    default:
+        break;
+    }
+    return 0;
+}
+
 
 } //namespace wsp
\ No newline at end of file
@@ -28,9 +28,28 @@
 #include <memory>
 #include <unordered_map>
 #include <cassert>
+#include <functional>
+#include <type_traits>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <sstream>
 
 #include <libwebsockets.h>
 
+#include "TimerQueue.h"
+#include "SharedFrame.h"
+#include "Mailbox.h"
+#include "ThreadPool.h"
+#include "Metrics.h"
+#include "Histogram.h"
+#include "FileCache.h"
+#include "http.h"
+
 #include <iostream>
 
 namespace wsp {
@@ -41,18 +60,26 @@ using Protocols = std::vector< lws_protocols >;
 //TYPE INTERFACES
 
 //Context:
-// /// @param p pointer key indexing the per-session buffer arrays; this is
+// /// Optional: type of per-session data; when present WebSocketService
+// /// reserves sizeof(SessionData) bytes in front of the service instance
+// /// in the per-session memory and passes its address as the @c user
+// /// parameter of the methods below
+// struct SessionData;
+// /// @param p pointer to the per-session data; this is
 // ///        the parameter received in the libwebsockets handler function
 // /// @param i buffer index
 // Buffer& GetBuffer(void* p, int i) 
-// /// Record current time into write timer map
+// /// Record current time into per-session write timer; write throttling
+// /// itself is performed by WebSocketService, the timer methods are
+// /// available to services
 // void RecordWriteTime(void* user) 
 // /// Compute time elapsed between time of call and value stored into
-// /// write timer map
+// /// per-session write timer
 // std::chrono::duration< double > ElapsedWriteTime(void* user) const 
 // /// Perform websocket protocol initialization
 // void InitProtocol(const char*)
-// /// Per-session initialization: buffers and timers
+// /// Per-session initialization: buffers and timers, constructs the
+// /// SessionData instance
 // void InitSession(void* p, int n = 1, std::size_t s = 1, char d = '\0')
 // /// Set value of write timer to now - passed value; this is usually used
 // /// to ensure that the next write operation succeeds by ensuring that the
@@ -75,6 +102,10 @@ using Protocols = std::vector< lws_protocols >;
 // /// this method returns @c true @c false otherwise. In case the buffer is not
 // /// pre-formatted WebSocketService takes care of the formatting by
 // /// performing an additional copy of the data into another buffer.
+// /// A pre-formatted buffer must be writable and is sent in place; allocate
+// /// it with the helpers in PaddedBuffer.h. The padding is overwritten while
+// /// sending, the buffer must therefore not be shared with sessions which
+// /// might be serviced by other threads.
 // virtual bool PreformattedBuffer() const
 // /// Returns true if data is ready, false otherwise. In this case Data()
 // /// returns @c false after each Get() to make sure that data in buffer
@@ -85,6 +116,14 @@ using Protocols = std::vector< lws_protocols >;
 // virtual const DataFrame& Get(int requestedChunkLength) const 
 // /// Called when libwebsockets receives data from clients
 // virtual void Put(void* p, size_t len, bool done)
+// /// Optional, replaces Put: streaming receive, called with each fragment
+// /// as it arrives; return @c false to pause reading from the connection
+// /// until WebSocketService::ResumeReceive is called with the session
+// /// handle. The fragment is owned by libwebsockets and must be consumed
+// /// or copied before returning
+// bool OnFragment(const char* p, size_t len, bool binary)
+// /// Required with OnFragment: called after the last fragment of a message
+// void OnMessageEnd()
 // /// Set size of suggested send chunk size; WebSocketService might
 // /// decide to use a different size if/when needed 
 // virtual void SetSuggestedOutChunkSize(int cs)
@@ -110,7 +149,8 @@ using Protocols = std::vector< lws_protocols >;
 // ///@param c context
 // ///@param req request bytes
 // ///@param request length in number of bytes
-// ///@param m request stored as a key-value store
+// ///@param m request header fields, valid during the constructor call
+// ///only: copy the fields needed later
 // HttpService(wsp::Context<>* c, const char* req, size_t len,
 //             const wsp::Request& m);
 // ///Check if requested passed to constructor is valid
@@ -151,6 +191,24 @@ using Protocols = std::vector< lws_protocols >;
 // ///@param len copied over from libwebsockets, can be discarded
 // ///@param in copied over from libwebsockets, can be discarded
 // void ReceiveComplete(int len, void* in);
+// ///Optional, replaces ReceiveStart, Receive and ReceiveComplete: streaming
+// ///POST body, called with each chunk as it arrives; return @c false to
+// ///pause reading from the connection until WebSocketService::ResumeReceive
+// ///is called with the session handle passed to SetSession, see
+// ///BodyWriter.h. The chunk is owned by libwebsockets and must be consumed
+// ///or copied before returning
+// bool OnBody(const char* p, size_t len);
+// ///Required with OnBody: called after the last chunk
+// ///@return status of the response, e.g. HTTP_STATUS_OK, or zero to answer
+// ///later: the response is then sent through Data and Get once the service
+// ///calls WebSocketService::Wake with the session handle, which allows
+// ///finishing the request on another thread without blocking the service
+// ///thread
+// int OnBodyEnd();
+// ///Optional with OnBody: receives the session handle before the first
+// ///chunk. If the client disconnects before the end of the body Destroy
+// ///is called without OnBodyEnd
+// void SetSession(const WebSocketService::Session&);
 //------------------------------------------------------------------------------
 
 //types to detect the presence of an HTTP member type inside a type to select
@@ -175,6 +233,166 @@ template < typename T > struct IsHttp {
                         == sizeof(yes) >::type type;
 };
 
+//types to detect the presence of a Segment member type inside a DataFrame
+//type to select the single or multi-segment (DataFrameChain) send path
+struct SingleFrame {};
+struct ChainedFrame {};
+//SFINAE
+template < typename T > struct IsChain {
+    typedef char yes[1];
+    typedef char no[2];
+    template < typename S >
+    static const yes& Check(typename S::Segment*);
+    template < typename S >
+    static const no& Check(...);
+    typedef typename std::conditional< sizeof(Check< T >(0)) == sizeof(yes),
+                                       ChainedFrame,
+                                       SingleFrame >::type type;
+};
+
+//detect the presence of a 'compressed' flag inside a DataFrame type
+//SFINAE
+template < typename T > struct HasCompressedFlag {
+    typedef char yes[1];
+    typedef char no[2];
+    template < typename S >
+    static const yes& Check(decltype(&S::compressed));
+    template < typename S >
+    static const no& Check(...);
+    typedef std::integral_constant< bool, sizeof(Check< T >(0)) 
+                                          == sizeof(yes) > type;
+};
+
+//detect the presence of a SetSession method inside a service type
+//SFINAE
+template < typename T > struct HasSetSession {
+    typedef char yes[1];
+    typedef char no[2];
+    template < typename S >
+    static const yes& Check(decltype(&S::SetSession));
+    template < typename S >
+    static const no& Check(...);
+    typedef std::integral_constant< bool, sizeof(Check< T >(0)) 
+                                          == sizeof(yes) > type;
+};
+
+//detect the presence of the streaming receive interface inside a service
+//type
+//SFINAE
+template < typename T > struct HasOnFragment {
+    typedef char yes[1];
+    typedef char no[2];
+    template < typename S >
+    static const yes& Check(decltype(&S::OnFragment));
+    template < typename S >
+    static const no& Check(...);
+    typedef std::integral_constant< bool, sizeof(Check< T >(0)) 
+                                          == sizeof(yes) > type;
+};
+
+//detect the presence of the streaming POST body interface inside an HTTP
+//service type
+//SFINAE
+template < typename T > struct HasOnBody {
+    typedef char yes[1];
+    typedef char no[2];
+    template < typename S >
+    static const yes& Check(decltype(&S::OnBody));
+    template < typename S >
+    static const no& Check(...);
+    typedef std::integral_constant< bool, sizeof(Check< T >(0)) 
+                                          == sizeof(yes) > type;
+};
+
+//per-session memory layout: the Context's SessionData, if the Context
+//type declares one, followed by the write throttling state and the
+//service instance; all live in the block libwebsockets allocates for
+//each session
+//SFINAE
+template < typename T > struct HasSessionData {
+    typedef char yes[1];
+    typedef char no[2];
+    template < typename S >
+    static const yes& Check(typename S::SessionData*);
+    template < typename S >
+    static const no& Check(...);
+    enum { value = sizeof(Check< T >(0)) == sizeof(yes) };
+};
+template < typename C, bool > struct SessionDataSize {
+    enum { value = 0 };
+};
+template < typename C > struct SessionDataSize< C, true > {
+    enum { value = sizeof(typename C::SessionData) };
+};
+/// Per-session write state, owned by WebSocketService
+struct WriteState {
+    /// Time of last completed write
+    TimerNode::TimePoint lastWrite;
+    /// Wakes the session when its next write slot opens
+    TimerNode timer;
+    /// Broadcast protocols only: frame being sent or last frame sent
+    SharedFramePtr frame;
+    /// Broadcast protocols only: number of bytes of @c frame already sent
+    std::size_t frameOffset = 0;
+    /// Session id, see WebSocketService::Session
+    std::uint64_t session = 0;
+    /// ASYNC_POOL protocols only: number of tasks submitted to the pool
+    /// and not yet completed
+    int inFlight = 0;
+    /// ASYNC_POOL protocols only: tasks waiting for a free slot
+    std::deque< std::function< void () > > pending;
+    /// ASYNC_POOL protocols only: @c true if a task threw, the session is
+    /// closed with status 1011 at the next write callback
+    bool taskFailed = false;
+    /// Time the oldest unanswered request was completely received
+    std::chrono::steady_clock::time_point requestTime;
+    /// @c true if @c requestTime refers to a request not yet answered
+    bool replyPending = false;
+    /// Bytes received of the current message
+    std::size_t rxBytes = 0;
+    /// Frames received of the current message
+    int rxFragments = 0;
+    /// @c true if the next received data starts a new frame
+    bool rxFrameStart = true;
+    /// @c true if the client negotiated permessage-deflate
+    bool deflate = false;
+    /// @c true if the compression level is set to zero for the current
+    /// message, see Deflate::minSize
+    bool stored = false;
+};
+/// libwebsockets allocates per-session memory with malloc, whose alignment
+/// can be smaller than the one of the service, e.g. a service holding
+/// cache line aligned queues: the write state and the service are aligned
+/// from the actual address of the block, which is over-allocated to make
+/// room for the worst case padding
+template < typename C, typename S > struct SessionLayout {
+    enum { DATA_SIZE = SessionDataSize< C, HasSessionData< C >::value >::value,
+           STATE_ALIGN = alignof(WriteState),
+           ALIGN = alignof(S) };
+    /// total size of per-session memory
+    enum { size = DATA_SIZE + STATE_ALIGN - 1 + sizeof(WriteState)
+                  + ALIGN - 1 + sizeof(S) };
+};
+/// Round address up to a multiple of @c a
+inline char* AlignUp(char* p, std::size_t a) {
+    return p + (a - std::uintptr_t(p) % a) % a;
+}
+/// Return write state stored in per-session memory
+template < typename C, typename S >
+WriteState* WriteStateOf(void* user) {
+    using L = SessionLayout< C, S >;
+    return reinterpret_cast< WriteState* >(
+        AlignUp(static_cast< char* >(user) + L::DATA_SIZE, L::STATE_ALIGN));
+}
+/// Return service instance stored in per-session memory
+template < typename C, typename S >
+S* ServiceOf(void* user) {
+    using L = SessionLayout< C, S >;
+    return reinterpret_cast< S* >(
+        AlignUp(reinterpret_cast< char* >(WriteStateOf< C, S >(user))
+                + sizeof(WriteState), L::ALIGN));
+}
+
 //-----------------------------------------------------------------------------
 /// libwebsockets wrapper: map your service to a protocol and call StartLoop
 /// Use only one single @c WebSocketService instance per process
@@ -200,21 +418,58 @@ private:
         C* d;
         bool erase_ = true;
     };    
+    struct ServiceLoop;
 public:
     ///Communication type:
     /// - REQ_REP: sync request-reply
     /// - ASYNC_REP: async reply
-    enum Type {REQ_REP, ASYNC_REP};
+    /// - BROADCAST: sessions receive the messages passed to Broadcast; the
+    ///   service receives data through Put and is never asked for data
+    ///   to send
+    /// - ASYNC_POOL: async reply computed in the worker pool shared by all
+    ///   the sessions, see SetWorkerThreads; when a complete request has
+    ///   been received the service's <code>Task()</code> method returns a
+    ///   callable object which is executed by a pool thread, its result
+    ///   is then passed to <code>Done(R&&)</code> in the thread servicing
+    ///   the session, followed by a write callback. Requests of a session
+    ///   are processed one at a time unless Entry::Concurrent is used
+    enum Type {REQ_REP, ASYNC_REP, BROADCAST, ASYNC_POOL};
     ///Send mode:
     /// - SEND_GREEDY: data is retrieved form service and sent in a loop
     ///                until no more data is available
     /// - SEND_PACKET: a single packet of data is sent at each write
     enum SendMode {SEND_GREEDY, SEND_PACKET};
+    ///Number of messages between receive buffer size updates, see
+    ///Entry::AutoRxBuffer
+    enum { RX_TUNE_INTERVAL = 1024 };
+    ///Max size of fragments sized from the socket send buffer, see
+    ///AdaptiveFragmentSize; bounds the per-session copy buffer of services
+    ///not sending in place
+    enum { MAX_FRAGMENT_SIZE = 0x40000 };
+    ///permessage-deflate (RFC 7692) settings for a protocol
+    struct Deflate {
+        ///@c true to negotiate compression with clients offering it
+        bool enabled = false;
+        ///Base two logarithm of the compression window, 8 to 15
+        int windowBits = 15;
+        ///zlib memory level, 1 to 9: higher is faster and uses more memory
+        int memLevel = 8;
+        ///zlib compression level, 1 to 9
+        int level = 1;
+        ///Reset the compression context after each message: lower memory
+        ///per session, lower compression ratio
+        bool noContextTakeover = false;
+        ///Messages smaller than this are sent with compression level zero:
+        ///stored in the deflate stream, not compressed
+        std::size_t minSize = 0;
+    };
     ///Service information
     /// @tparam S service type
     /// @tparam T processing type:
     /// - REQ_REP for synchronous,
     /// - ASYNC_REP for asynchronous
+    /// - BROADCAST for broadcast
+    /// - ASYNC_POOL for asynchronous, executed by shared worker pool
     template < typename S,
                Type T,
                SendMode SM = SEND_PACKET >
@@ -225,17 +480,83 @@ public:
         std::string name;
          ///Receive buffer size
         int rxBufSize = 0; //use default (should be 4096 bytes)
-        ///Processing type REQ_REP, ASYNC_REP
+        ///Processing type REQ_REP, ASYNC_REP, BROADCAST, ASYNC_POOL
         const static Type type = T;
         ///Send processing mode: 
         /// - SEND_GREEDY: send all the content in a loop
         /// - SEND_ASYNC:  send content one packet at a time, yielding control
         ///                back after each send
         const static SendMode sendMode = SM;
+        ///Compression settings, disabled by default
+        Deflate deflate;
+        ///ASYNC_POOL only: max number of requests per session processed
+        ///concurrently
+        int maxInFlight = 1;
+        ///Max size of received messages in bytes, zero for no limit
+        std::size_t maxMessageSize = 0;
+        ///Max number of frames of received messages, zero for no limit
+        int maxFragments = 0;
+        ///Bounds of the auto-tuned receive buffer size, zero if disabled
+        std::size_t minRxBufSize = 0;
+        std::size_t maxRxBufSize = 0;
         ///Constructor
         /// @param n protocol name
         /// @param rx receive buffer size, zero for default
         Entry(const std::string& n, int rx = 0) : name(n), rxBufSize(rx) {}
+        ///Enable permessage-deflate; binary data frames flagged as
+        ///@c compressed are sent with compression level zero; ignored
+        ///by BROADCAST protocols, whose frames are built once for all the
+        ///sessions
+        /// @param d compression settings
+        Entry& Compress(const Deflate& d = Deflate()) {
+            deflate = d;
+            deflate.enabled = true;
+            return *this;
+        }
+        ///ASYNC_POOL only: process up to @c n requests of the same session
+        ///in parallel; replies are sent in completion order, use request
+        ///ids (see RequestId.h) to match them with requests. Reading from
+        ///the connection is paused while @c n requests are in progress
+        /// @param n max number of requests in progress per session
+        Entry& Concurrent(int n) {
+            if(n < 1) throw std::logic_error("Invalid concurrency level");
+            maxInFlight = n;
+            return *this;
+        }
+        ///Close connections receiving a message larger than @c size bytes
+        ///or made of more than @c fragments frames with status 1009
+        ///(message too big); the check is performed when a frame starts,
+        ///using the frame length, before its payload reaches the service.
+        ///HTTP service: POST requests with a Content-Length larger than
+        ///@c size are answered with 413 before the body is read
+        /// @param size max message size in bytes, zero for no limit
+        /// @param fragments max number of frames, zero for no limit
+        Entry& MaxMessage(std::size_t size, int fragments = 0) {
+            if(fragments < 0) 
+                throw std::logic_error("Invalid number of fragments");
+            maxMessageSize = size;
+            maxFragments = fragments;
+            return *this;
+        }
+        ///Tune the receive buffer size of new connections to the power of
+        ///two which holds 90% of the messages received so far, re-evaluated
+        ///every RX_TUNE_INTERVAL messages: most messages are then received
+        ///in a single callback without sizing all the buffers for the
+        ///largest ones. Tuning writes the size into the protocol table
+        ///libwebsockets reads when connections are accepted, so it only
+        ///takes place with a single service thread: with more threads the
+        ///receive buffer keeps its initial size
+        /// @param minSize initial and minimum size
+        /// @param maxSize maximum size
+        Entry& AutoRxBuffer(std::size_t minSize = 4096,
+                            std::size_t maxSize = 1 << 20) {
+            if(!minSize || minSize > maxSize)
+                throw std::logic_error("Invalid receive buffer size range");
+            minRxBufSize = minSize;
+            maxRxBufSize = maxSize;
+            if(!rxBufSize) rxBufSize = int(minSize);
+            return *this;
+        }
     };
 public:
     ///Default constructor    
@@ -253,6 +574,32 @@ public:
     ~WebSocketService() {
         Clear();
     }
+    ///Number of service threads, passed to Init; each thread services
+    ///its own subset of connections through @c lws_service_tsi.
+    ///Libwebsockets writes frame headers into the padding before data sent
+    ///in place: with more than one thread pre-formatted buffers must not be
+    ///shared among sessions
+    struct ServiceThreads {
+        ///Constructor
+        /// @param n number of threads, must be in the range
+        ///        [1, LWS_MAX_SMP] as configured when building libwebsockets
+        explicit ServiceThreads(int n) : count(n) {}
+        ///Number of threads
+        int count = 1;
+    };
+    ///Handle to a session, passed to services implementing
+    ///<code>void SetSession(const WebSocketService::Session&)</code> when
+    ///the connection is established; used to wake the session from other
+    ///threads. Valid for the lifetime of the WebSocketService instance,
+    ///waking a closed session is a no-op
+    struct Session {
+        ///Loop servicing the session
+        ServiceLoop* loop = nullptr;
+        ///libwebsockets context
+        lws_context* context = nullptr;
+        ///Unique id: per-loop counter << 8 | service thread index
+        std::uint64_t id = 0;
+    };
 public:
     ///Create libwebsockets context
     /// @tparam ContextT context type: used to store reusable char buffers
@@ -273,91 +620,311 @@ public:
                    const char* keyPath,
                    const ContextT& c,
                    const ArgsT&...entries) {
+        return Init(port, ServiceThreads(1), certPath, keyPath, c, entries...);
+    }
+    ///Create libwebsockets context
+    /// @tparam ContextT context type: used to store reusable char buffers
+    ///         as well as global and per-session configuration information   
+    /// @tparam ArgsT list of Entry types with protocol-service mapping
+    ///         information
+    /// @param port tcp/ip port
+    /// @param certPath ssl certificate path
+    /// @param keyPath ssl key path
+    /// @param c shared pointer wrapping a context instance
+    /// @param entries Entry list with protocol-service mapping information
+    template < typename ContextT, typename... ArgsT >
+    void Init(int port,
+              const char* certPath,
+              const char* keyPath,
+              std::shared_ptr< ContextT > c,
+              const ArgsT&...entries) {
+        Init(port, ServiceThreads(1), certPath, keyPath, c, entries...);
+    }
+    ///Create libwebsockets context serviced by multiple threads; callbacks
+    ///for different sessions run concurrently and the context must
+    ///therefore be thread safe, as is the case with wsp::Context
+    /// @tparam ContextT context type: used to store reusable char buffers
+    ///         as well as global and per-session configuration information   
+    /// @tparam ArgsT list of Entry types with protocol-service mapping
+    ///         information
+    /// @param port tcp/ip port
+    /// @param threads number of service threads, see StartLoop
+    /// @param certPath ssl certificate path
+    /// @param keyPath ssl key path
+    /// @param c context instance copied to internal storage
+    /// @param entries Entry list with protocol-service mapping information
+    /// @return reference to context allocated in libwebsockets memory space;
+    ///         reference will be invalid after libwebsockets context is
+    ///         destroyed
+    template < typename ContextT, typename... ArgsT >
+    ContextT& Init(int port,
+                   const ServiceThreads& threads,
+                   const char* certPath,
+                   const char* keyPath,
+                   const ContextT& c,
+                   const ArgsT&...entries) {
         Clear();
-        if(certPath) certPath_ = certPath;
-        if(keyPath) keyPath_  = keyPath; 
         AddHandlers< ContextT >(0, entries...); 
+        AddMetricsHandler();
         protocolHandlers_.push_back({0,0,0,0}); //termination marker
-        info_.port = port;
-        info_.iface = nullptr;
-        info_.protocols = &protocolHandlers_[0];
-        info_.ssl_cert_filepath = certPath_.size() ? certPath_.c_str() 
-                                                   : nullptr;
-        info_.ssl_private_key_filepath = keyPath_.size() ? keyPath_.c_str() 
-                                                         : nullptr;
-        //There is no longer a set internal extensions table.  The table is provided
-        //* by user code along with application-specific settings.  See the test
-        //* client and server for how to do.
-        //info_.extensions = lws_get_internal_extensions();
-
-        info_.options = 0;
         ContextT* ctx = new ContextT(c);
-        info_.user = ctx;
-        context_ = lws_create_context(&info_);
-        if(!context_) 
-            throw std::runtime_error("Cannot create WebSocket context");
-        userDataDeleter_.reset(new Deleter< ContextT >(
-            reinterpret_cast< ContextT* >(info_.user)));
+        userDataDeleter_.reset(new Deleter< ContextT >(ctx));
+        CreateContext(port, threads.count, certPath, keyPath, ctx);
         return *ctx;
     }
-    ///Create libwebsockets context
+    ///Create libwebsockets context serviced by multiple threads
     /// @tparam ContextT context type: used to store reusable char buffers
     ///         as well as global and per-session configuration information   
     /// @tparam ArgsT list of Entry types with protocol-service mapping
     ///         information
     /// @param port tcp/ip port
+    /// @param threads number of service threads, see StartLoop
     /// @param certPath ssl certificate path
     /// @param keyPath ssl key path
     /// @param c shared pointer wrapping a context instance
     /// @param entries Entry list with protocol-service mapping information
     template < typename ContextT, typename... ArgsT >
     void Init(int port,
+              const ServiceThreads& threads,
               const char* certPath,
               const char* keyPath,
               std::shared_ptr< ContextT > c,
               const ArgsT&...entries) {
         Clear();
-        if(certPath) certPath_ = certPath;
-        if(keyPath) keyPath_  = keyPath; 
         AddHandlers< ContextT >(0, entries...); 
+        AddMetricsHandler();
         protocolHandlers_.push_back({0,0,0,0}); //termination marker
-        info_.port = port;
-        info_.iface = nullptr;
-        info_.protocols = &protocolHandlers_[0];
-        info_.ssl_cert_filepath = certPath_.size() ? certPath_.c_str() 
-                                                   : nullptr;
-        info_.ssl_private_key_filepath = keyPath_.size() ? keyPath_.c_str() 
-                                                         : nullptr;
-        //There is no longer a set internal extensions table.  The table is provided
-        //* by user code along with application-specific settings.  See the test
-        //* client and server for how to do.
-        //info_.extensions = lws_get_internal_extensions();
-        info_.options = 0;
-        info_.user = c.get();
-        context_ = lws_create_context(&info_);
-        if(!context_) 
-            throw std::runtime_error("Cannot create WebSocket context");
         //do not delete context, will be deleted by shared_ptr when needed
-        userDataDeleter_.reset(new Deleter< ContextT >(
-            reinterpret_cast< ContextT* >(info_.user), false));
+        userDataDeleter_.reset(new Deleter< ContextT >(c.get(), false));
+        CreateContext(port, threads.count, certPath, keyPath, c.get());
     }
     ///Next iteration: performs a single loop iteration calling
     ///lws_service
-    /// @param ms min execution time: if no sockets need service it
-    /// returns after at least @c ms milliseconds 
+    /// @param ms min execution time: if no sockets need service and no
+    /// throttled session is due to write it returns after at least @c ms
+    /// milliseconds 
     int Next(int ms = 0) {
-        return lws_service(context_, ms);
+        return Next(ms, 0);
+    }
+    ///Next iteration for a specific service thread: must always be called
+    ///from the same thread for the same index.
+    ///The clock is read once before servicing if write timers are pending,
+    ///to bound the wait, then at most once after, by the first callback
+    ///which needs it or, failing that, when expiring write timers
+    /// @param ms min execution time: if no sockets need service and no
+    /// throttled session is due to write it returns after at least @c ms
+    /// milliseconds 
+    /// @param tsi service thread index in the range [0, ServiceThreadCount())
+    int Next(int ms, int tsi) {
+        assert(tsi >= 0 && tsi < int(loops_.size()));
+        ServiceLoop& l = loops_[tsi];
+        //do not sleep past the earliest write slot; l.now is as old as
+        //the previous iteration's wait, read the clock
+        if(!l.writeTimers.Empty()) {
+            const long long due = std::chrono::duration_cast< 
+                std::chrono::milliseconds >(l.writeTimers.Next()
+                    - std::chrono::steady_clock::now()).count() + 1;
+            if(due < ms) ms = int(std::max< long long >(0, due));
+        }
+        l.nowValid = false;
+        int ret = 0;
+        {
+            CurrentLoopScope scope(&l);
+            ret = lws_service_tsi(context_, ms, tsi);
+            //wake sessions whose write slot has opened: the clock is read
+            //only if no callback did during this iteration
+            l.writeTimers.Expire(Now(), [](TimerNode* n) {
+                lws_callback_on_writable(static_cast< lws* >(n->data));
+            });
+            //cross-thread requests
+            l.mailbox.Drain([&l](Message& m) {
+                if(!m.session) {
+                    m.f();
+                    return;
+                }
+                auto i = l.sessions.find(m.session);
+                if(i == l.sessions.end()) return; //closed
+                if(m.deliver) m.deliver(i->second);
+                lws_callback_on_writable(i->second);
+            });
+            WakeBroadcast(l);
+        }
+        //the protocol table is read by all the service threads
+        if(loops_.size() == 1) {
+            for(auto& i: protocolStates_) TuneRxBuffer(*i.second);
+        }
+        return ret;
+    }
+    ///Set number of threads of the worker pool used by ASYNC_POOL
+    ///protocols; must be called before Init
+    /// @param n number of threads, zero for hardware concurrency
+    void SetWorkerThreads(int n) {
+        workerThreads_ = n;
+    }
+    ///Serve metrics in Prometheus text format from the http-only protocol:
+    ///GET requests for @c path are answered by the built-in handler, all
+    ///the others are passed to the HTTP service, if any; when no HTTP
+    ///service is registered an http-only protocol serving metrics only is
+    ///added. Must be called before Init
+    /// @param path request path, empty to disable the endpoint
+    void MetricsEndpoint(const std::string& path = "/metrics") {
+        metricsPath_ = path;
+    }
+    ///Serve the files returned by HttpService::FilePath from memory:
+    ///responses are built once, with strong ETag and Last-Modified
+    ///validators, and conditional requests are answered with 304 without
+    ///accessing the file; files are reloaded after they change.
+    ///Must be called before Init
+    /// @param policy cache size limits
+    void CacheFiles(const FileCache::Policy& policy = FileCache::Policy()) {
+        fileCache_.reset(new FileCache(policy));
+    }
+    ///File cache, @c nullptr if not enabled with CacheFiles
+    FileCache* Files() { return fileCache_.get(); }
+    ///Counters of a protocol; values can be read from any thread while
+    ///the service is running
+    /// @param protocol protocol name
+    /// @return counters or @c nullptr if protocol not found
+    const ProtocolMetrics* Metrics(const std::string& protocol) const {
+        auto i = protocolStates_.find(protocol);
+        return i == protocolStates_.end() ? nullptr : &i->second->metrics;
+    }
+    ///Request to reply latency of a REQ_REP, ASYNC_REP or ASYNC_POOL
+    ///protocol: time from the arrival of the last fragment of a request
+    ///to the write of the last fragment of the next reply. With pipelined
+    ///requests, a reply is matched with the oldest unanswered request and
+    ///requests received while a reply is pending are not measured
+    /// @param protocol protocol name
+    /// @return histogram or @c nullptr if protocol not found
+    const LatencyHistogram* Latency(const std::string& protocol) const {
+        auto i = protocolStates_.find(protocol);
+        return i == protocolStates_.end() ? nullptr : &i->second->latency;
+    }
+    ///Write latency percentiles of all the protocols which recorded at
+    ///least one reply, one protocol per line, in microseconds
+    void DumpLatency(std::ostream& os) const {
+        for(const auto& i: protocolStates_) {
+            const LatencyHistogram::Snapshot s = i.second->latency.Get();
+            if(!s.Count()) continue;
+            os << i.first << ": count " << s.Count()
+               << " mean " << 1E-3 * s.Mean()
+               << " p50 " << 1E-3 * double(s.Percentile(0.5))
+               << " p99 " << 1E-3 * double(s.Percentile(0.99))
+               << " p999 " << 1E-3 * double(s.Percentile(0.999))
+               << " max " << 1E-3 * double(s.Max()) << " us\n";
+        }
+    }
+    ///Counters and latency summaries of all the protocols in Prometheus
+    ///text format
+    std::string MetricsText() const {
+        std::ostringstream os;
+        for(const auto& i: protocolStates_) {
+            i.second->metrics.Write(os, i.first);
+            i.second->latency.Write(os, "wsp_reply_latency_seconds",
+                                    i.first, 1E-9);
+            i.second->messageSizes.Write(os, "wsp_message_size_bytes",
+                                         i.first);
+            if(i.second->active)
+                os << "wsp_rx_buffer_bytes{protocol=\"" << i.first << "\"} "
+                   << i.second->active->rx_buffer_size << '\n';
+        }
+        return os.str();
+    }
+    ///Number of service threads as returned by libwebsockets, which might
+    ///be lower than the requested number
+    int ServiceThreadCount() const {
+        return context_ ? lws_get_count_threads(context_) : 0;
     }
-    ///Start event loop
+    ///Request a write callback for a session; use it to notify the service
+    ///loop that data produced by another thread is ready to be sent.
+    ///Thread safe and lock-free: the request is queued into the mailbox of
+    ///the thread servicing the session, which is woken up immediately
+    /// @param session session handle
+    static void Wake(const Session& session) {
+        if(!session.loop) return;
+        session.loop->mailbox.Push(Message{std::function< void () >(),
+                                           session.id,
+                                           std::function< void (lws*) >()});
+        lws_cancel_service(session.context);
+    }
+    ///Resume reading from a session paused by its service returning
+    ///@c false from OnFragment; thread safe and lock-free, the request is
+    ///executed by the thread servicing the session
+    /// @param session session handle
+    static void ResumeReceive(const Session& session) {
+        if(!session.loop) return;
+        session.loop->mailbox.Push(Message{std::function< void () >(),
+                                           session.id,
+                                           [](lws* wsi) {
+                                               lws_rx_flow_control(wsi, 1);
+                                           }});
+        lws_cancel_service(session.context);
+    }
+    ///Execute callable object in the first service thread, where any
+    ///libwebsockets function can be called safely.
+    ///Thread safe and lock-free
+    /// @param f callable object invoked as <code>f()</code>
+    template < typename F >
+    void Post(F&& f) {
+        assert(!loops_.empty());
+        loops_[0].mailbox.Push(Message{std::forward< F >(f), 0,
+                                       std::function< void (lws*) >()});
+        lws_cancel_service(context_);
+    }
+    ///Send message to all the sessions of a BROADCAST protocol; the frame
+    ///is shared by all the sessions, each one tracking its own progress.
+    ///Sessions still sending the previous message complete it and then
+    ///move to the latest one: intermediate messages are skipped by slow
+    ///clients. Sessions connecting later receive the latest message.
+    ///Can be called from any thread
+    /// @param protocol name of protocol, added with a BROADCAST Entry
+    /// @param frame message to send
+    void Broadcast(const std::string& protocol, SharedFramePtr frame) {
+        auto i = protocolStates_.find(protocol);
+        if(i == protocolStates_.end() || !i->second->broadcast)
+            throw std::logic_error("Not a broadcast protocol: " + protocol);
+        std::atomic_store(&i->second->frame, frame);
+        ++i->second->published;
+        //each service thread wakes the writers of its own sessions
+        lws_cancel_service(context_);
+    }
+    ///Start event loop; with multiple service threads one loop per thread
+    ///is started, the calling thread running the first one; the function
+    ///returns after all the loops have terminated
     /// @tparam C continuation condition type
     /// @param ms minimum interval between consecutive iterations
     /// @param c continuation condition: loops continues until
-    ///        c() returns @c true
+    ///        c() returns @c true; called concurrently by all the service
+    ///        threads
     template < typename C >
     void StartLoop(int ms, C&& c) {
+        const int threads = ServiceThreadCount();
+        if(threads < 2) {
+            while(c()) {
+                Next(ms);
+            }
+            return;
+        }
+        std::vector< std::thread > loops;
+        for(int tsi = 1; tsi < threads; ++tsi) {
+            loops.push_back(std::thread([this, ms, tsi, &c]() {
+                while(c()) {
+                    Next(ms, tsi);
+                }
+            }));
+        }
         while(c()) {
-            Next(ms);
+            Next(ms, 0);
         }
+        for(auto& t: loops) t.join();
+    }
+
+    ///Enable or disable adaptive fragment sizing, enabled by default:
+    ///outgoing fragments are as large as the free space in the socket send
+    ///buffer, up to the larger of MAX_FRAGMENT_SIZE and the size suggested
+    ///by the service; when disabled, the suggested size is used
+    static void AdaptiveFragmentSize(bool on) {
+        adaptiveFragmentSize_ = on;
     }
 
     /// @note
@@ -457,7 +1024,21 @@ private:
                                       typename ArgT::ServiceType,
                                       ArgT::type,
                                       ArgT::sendMode >;
-        p.per_session_data_size = sizeof(typename ArgT::ServiceType);
+        p.per_session_data_size =
+            SessionLayout< ContextT, typename ArgT::ServiceType >::size;
+        ProtocolState* ps = new ProtocolState;
+        protocolStates_[entry.name].reset(ps);
+        ps->broadcast = ArgT::type == BROADCAST;
+        ps->pooled = ArgT::type == ASYNC_POOL;
+        ps->maxInFlight = entry.maxInFlight;
+        ps->maxMessageSize = entry.maxMessageSize;
+        ps->maxFragments = entry.maxFragments;
+        ps->minRxBufSize = entry.minRxBufSize;
+        ps->maxRxBufSize = entry.maxRxBufSize;
+        ps->deflate = entry.deflate;
+        //broadcast frames are written pre-framed: never compressed
+        if(ps->broadcast) ps->deflate.enabled = false;
+        p.user = ps;
         protocolHandlers_.push_back(p);
     }
     ///Add handler: http case
@@ -474,7 +1055,15 @@ private:
         std::strcpy((char*) p.name, entry.name.c_str());       
         p.callback = &WebSocketService::HttpCallback< ContextT,
                                                 typename ArgT::ServiceType >;
-        p.per_session_data_size = sizeof(typename ArgT::ServiceType);
+        p.per_session_data_size =
+            SessionLayout< ContextT, typename ArgT::ServiceType >::size;
+        ProtocolState* ps = new ProtocolState;
+        protocolStates_[entry.name].reset(ps);
+        ps->service = this;
+        ps->metricsPath = metricsPath_;
+        ps->files = fileCache_.get();
+        ps->maxMessageSize = entry.maxMessageSize;
+        p.user = ps;
         //http service *MUST* be the first
         if(pos != 0) protocolHandlers_.insert(protocolHandlers_.begin(), p);
         else protocolHandlers_.push_back(p);                                        
@@ -482,6 +1071,101 @@ private:
     ///Termination condition for variadic templates
     template < typename T >
     void AddHandlers(int) {}
+    ///Add http-only protocol serving metrics only, if metrics are enabled
+    ///and no HTTP service is registered
+    void AddMetricsHandler();
+    ///Answer request for the metrics endpoint
+    /// @param wsi lws struct pointer
+    /// @param uri request path
+    /// @param status set to the value to return from the callback
+    /// @return @c true if the request was for the metrics endpoint
+    static bool ServeMetrics(lws* wsi, const char* uri, int& status);
+    ///Callback of the built-in http-only protocol
+    static int MetricsCallback(lws *wsi,
+                               lws_callback_reasons reason,
+                               void *user,
+                               void *in,
+                               size_t len);
+    ///Record request to reply latency, see Latency
+    static void RecordLatency(lws* wsi, WriteState* ws) {
+        if(!ws->replyPending) return;
+        ws->replyPending = false;
+        ProtocolState* ps = static_cast< ProtocolState* >(
+                                            lws_get_protocol(wsi)->user);
+        if(!ps) return;
+        const ServiceLoop* l = CurrentLoop();
+        ps->latency.Record(l ? l->index : -1,
+                           std::chrono::steady_clock::now() - ws->requestTime);
+    }
+    struct ProtocolState;
+    ///Track size and frame count of the message being received; closes
+    ///the connection with status 1009 if the protocol's limits are
+    ///exceeded. The length of the rest of the current frame is known when
+    ///the frame starts: oversized frames are rejected before their payload
+    ///is passed to the service
+    /// @param wsi lws struct pointer
+    /// @param ws session state
+    /// @param len bytes received
+    /// @param remaining bytes of the current frame still to be received
+    /// @param done @c true if last data of message
+    /// @return @c false if the connection must be closed
+    static bool TrackMessage(lws* wsi, WriteState* ws, std::size_t len,
+                             std::size_t remaining, bool done) {
+        ProtocolState* ps = static_cast< ProtocolState* >(
+                                            lws_get_protocol(wsi)->user);
+        if(ws->rxFrameStart) ++ws->rxFragments;
+        ws->rxFrameStart = remaining == 0;
+        ws->rxBytes += len;
+        if(!ps) return true;
+        if((ps->maxMessageSize 
+            && ws->rxBytes + remaining > ps->maxMessageSize)
+           || (ps->maxFragments && ws->rxFragments > ps->maxFragments)) {
+            static const char reason[] = "Message too big";
+            lws_close_reason(wsi, LWS_CLOSE_STATUS_MESSAGE_TOO_LARGE,
+                             (unsigned char*) reason, sizeof(reason) - 1);
+            Count(wsi, ProtocolMetrics::OVERSIZED);
+            return false;
+        }
+        if(done) {
+            const ServiceLoop* l = CurrentLoop();
+            ps->messageSizes.Record(l ? l->index : -1, ws->rxBytes);
+            ws->rxBytes = 0;
+            ws->rxFragments = 0;
+        }
+        return true;
+    }
+    ///Set the receive buffer size used for new connections, see 
+    ///Entry::AutoRxBuffer; libwebsockets reads it when a connection is
+    ///upgraded to WebSocket. Single service thread only: the table is
+    ///not synchronized with the threads accepting connections
+    static void TuneRxBuffer(ProtocolState& ps) {
+        if(!ps.maxRxBufSize || !ps.active) return;
+        const std::uint64_t n = ps.messageSizes.Count();
+        if(n < ps.tunedAt + RX_TUNE_INTERVAL) return;
+        ps.tunedAt = n;
+        const std::uint64_t target = ps.messageSizes.Get().Percentile(0.9);
+        std::size_t size = ps.minRxBufSize;
+        while(size < target && size < ps.maxRxBufSize) size *= 2;
+        const_cast< lws_protocols* >(ps.active)->rx_buffer_size =
+            std::min(size, ps.maxRxBufSize);
+    }
+    ///Increment counter of the protocol serving @c wsi
+    static void Count(lws* wsi, ProtocolMetrics::Counter c,
+                      std::uint64_t n = 1) {
+        ProtocolState* ps = static_cast< ProtocolState* >(
+                                            lws_get_protocol(wsi)->user);
+        if(!ps) return;
+        const ServiceLoop* l = CurrentLoop();
+        ps->metrics.Add(l ? l->index : -1, c, n);
+    }
+    ///Count HTTP response of the protocol serving @c wsi
+    static void CountStatus(lws* wsi, int code) {
+        ProtocolState* ps = static_cast< ProtocolState* >(
+                                            lws_get_protocol(wsi)->user);
+        if(!ps) return;
+        const ServiceLoop* l = CurrentLoop();
+        ps->metrics.Status(l ? l->index : -1, code);
+    }
     ///Actual callback function passed to lws to handle the
     ///WebSockets protocol communication
     /// @tparam ContextT shared context
@@ -505,15 +1189,13 @@ private:
     ///HTTP communication
     /// @tparam ContextT shared context
     /// @tparam T Service type
-    /// @param context lws context
     /// @param wsi lws struct pointer
     /// @param reason one of libsockets' LWS_* values
     /// @param in input buffer
     /// @param len length of input buffer
     /// @return true if all packets sent, false otherwise
     template < typename ContextT, typename T >
-    static int HttpCallback(lws_context *context,
-               lws *wsi,
+    static int HttpCallback(lws *wsi,
                lws_callback_reasons reason,
                void *user,
                void *in,
@@ -526,70 +1208,184 @@ private:
                      lws* wsi,
                      void* user,
                      bool greedy) {
-        S* s = reinterpret_cast< S* >(user);
+        S* s = ServiceOf< C, S >(user);
         assert(s);
         if(!s->Data()) return true;
         C* c = reinterpret_cast< C* >(lws_context_user(context));
         assert(c);
         using DF = typename S::DataFrame;  
         bool done = false;
-        const int chunkSize = s->GetSuggestedOutChunkSize();   
         while(!done) {
-            //retrieve data frame
-            const DF df = s->Get(chunkSize);    
-            const size_t bsize = df.frameEnd - df.frameBegin;
-            //done iff end of frame equals the end of buffer
-            done = df.frameEnd == df.bufferEnd;
-            const bool begin = df.frameBegin == df.bufferBegin;
-            const size_t bytesToWrite = s->PreformattedBuffer() 
-                             ? LWS_SEND_BUFFER_PRE_PADDING + bsize +
-                               LWS_SEND_BUFFER_POST_PADDING
-                             : bsize;
-            if(bytesToWrite < 1) return true;                      
-            int writeMode = df.binary == true ? LWS_WRITE_BINARY 
-                                              : LWS_WRITE_TEXT;
+            //retrieve data frame, sized to what the socket can take now
+            const int chunkSize = 
+                FragmentSize(wsi, s->GetSuggestedOutChunkSize());
+            const DF& df = s->Get(chunkSize);    
+            const FrameView f = View(df, typename IsChain< DF >::type());
+            const size_t bsize = f.end - f.begin;
+            //done iff end of frame equals the end of (last) buffer
+            done = f.last;
+            if(bsize < 1) return true;                      
+            int writeMode = f.binary == true ? LWS_WRITE_BINARY 
+                                             : LWS_WRITE_TEXT;
             int bytesWritten = 0;                                   
-            if(!begin) writeMode = LWS_WRITE_CONTINUATION;
+            if(!f.first) writeMode = LWS_WRITE_CONTINUATION;
             if(!done) writeMode |= LWS_WRITE_NO_FIN;
-           
+            //pre-compressed and small messages are stored, not
+            //compressed, on connections which negotiated compression
+            if(f.first && WriteStateOf< C, S >(user)->deflate)
+                StoreMessage(wsi, WriteStateOf< C, S >(user), f);
             if(s->PreformattedBuffer()) {
-                bytesWritten = lws_write(
-                               wsi, 
-                               (unsigned char*) df.frameBegin,
-                               bytesToWrite, // <= padding + chunkSize
-                               lws_write_protocol(writeMode));
-                                
+                bytesWritten = WritePadded(wsi, f.begin, bsize,
+                                           !f.segmentBegin, !f.segmentEnd,
+                                           lws_write_protocol(writeMode));
             } else {
                 std::vector< char >& buffer = c->GetBuffer(user, 0);
-                buffer.resize(LWS_SEND_BUFFER_PRE_PADDING + bsize +
-                              LWS_SEND_BUFFER_POST_PADDING);
-                //std::cout << bsize << std::endl;
-                //memset(buffer.data(), 0, buffer.size());
-                std::copy(df.frameBegin, df.frameEnd, buffer.begin()
-                                                + LWS_SEND_BUFFER_PRE_PADDING);
-                
+                //grow only: the buffer is reused for all the chunks
+                if(buffer.size() < LWS_SEND_BUFFER_PRE_PADDING + bsize +
+                                   LWS_SEND_BUFFER_POST_PADDING)
+                    buffer.resize(LWS_SEND_BUFFER_PRE_PADDING + bsize +
+                                  LWS_SEND_BUFFER_POST_PADDING);
+                std::copy(f.begin, f.end, buffer.begin()
+                                          + LWS_SEND_BUFFER_PRE_PADDING);
                 bytesWritten = lws_write(
                           wsi, 
                           (unsigned char*) &buffer[LWS_SEND_BUFFER_PRE_PADDING],
-                          bytesToWrite, //<= chunkSize
+                          bsize, //<= chunkSize
                           lws_write_protocol(writeMode));
             }
-            if(bytesWritten < 0) break;
+            if(bytesWritten < 0) {
+                Count(wsi, ProtocolMetrics::WRITE_ERRORS);
+                break;
                //throw std::runtime_error("Send error");
-            else {
+            } else {
                 s->UpdateOutBuffer(bytesWritten);
+                Count(wsi, ProtocolMetrics::BYTES_OUT, bytesWritten);
+                if(done) {
+                    Count(wsi, ProtocolMetrics::MESSAGES_OUT);
+                    RecordLatency(wsi, WriteStateOf< C, S >(user));
+                }
             }
-            if(!greedy) break;
+            //do not let libwebsockets buffer what the socket cannot take
+            if(!greedy || lws_send_pipe_choked(wsi)) break;
         }
         return done;
     }
-
+    ///Size of the next outgoing fragment: the free space in the socket
+    ///send buffer, so that the kernel accepts the whole fragment and
+    ///libwebsockets does not have to copy and buffer the remainder of a
+    ///partial write. A large message is therefore sent in a few
+    ///fragments as big as the socket allows instead of many fixed size ones
+    /// @param wsi lws struct pointer
+    /// @param suggested service suggested size, used as the minimum size,
+    ///        when the send buffer cannot be queried and as the max size if
+    ///        larger than MAX_FRAGMENT_SIZE
+    static int FragmentSize(lws* wsi, int suggested);
+    ///Region of data frame to send and its position within the message
+    struct FrameView {
+        ///First byte to send
+        const char* begin = nullptr;
+        ///One byte past the last byte to send
+        const char* end = nullptr;
+        ///@c true if first chunk of message
+        bool first = false;
+        ///@c true if last chunk of message
+        bool last = true;
+        ///@c true if @c begin is the start of a (padded) buffer
+        bool segmentBegin = false;
+        ///@c true if @c end is the end of a (padded) buffer
+        bool segmentEnd = false;
+        ///@c true if data is binary, @c false if it is text
+        bool binary = false;
+        ///@c true if data is already compressed
+        bool compressed = false;
+        ///Size of the whole message
+        std::size_t messageSize = 0;
+    };
+    ///Return value of compressed flag, if present
+    template < typename DF >
+    static bool Compressed(const DF& df, const std::true_type&) {
+        return df.compressed;
+    }
+    template < typename DF >
+    static bool Compressed(const DF&, const std::false_type&) {
+        return false;
+    }
+    ///Single buffer data frame
+    template < typename DF >
+    static FrameView View(const DF& df, const SingleFrame&) {
+        FrameView f;
+        f.begin = df.frameBegin;
+        f.end = df.frameEnd;
+        f.first = f.segmentBegin = df.frameBegin == df.bufferBegin;
+        f.last = f.segmentEnd = df.frameEnd == df.bufferEnd;
+        f.binary = df.binary;
+        f.compressed = 
+            Compressed(df, typename HasCompressedFlag< DF >::type());
+        f.messageSize = df.bufferEnd - df.bufferBegin;
+        return f;
+    }
+    ///Multi-segment data frame: the current segment is sent; the message
+    ///starts at the beginning of the first segment and terminates at the end
+    ///of the last one
+    template < typename DF >
+    static FrameView View(const DF& dc, const ChainedFrame&) {
+        FrameView f;
+        f.binary = dc.binary;
+        f.compressed = 
+            Compressed(dc, typename HasCompressedFlag< DF >::type());
+        for(int i = 0; i != dc.count; ++i)
+            f.messageSize += dc.segments[i].bufferEnd 
+                             - dc.segments[i].bufferBegin;
+        if(Empty(dc) || Consumed(dc)) return f;
+        const typename DF::Segment& s = CurrentSegment(dc);
+        f.begin = s.frameBegin;
+        f.end = s.frameEnd;
+        f.segmentBegin = s.frameBegin == s.bufferBegin;
+        f.segmentEnd = s.frameEnd == s.bufferEnd;
+        f.first = dc.current == 0 && f.segmentBegin;
+        f.last = dc.current == dc.count - 1 && f.segmentEnd;
+        return f;
+    }
+    ///Write data in place: libwebsockets writes the frame header into the
+    ///LWS_SEND_BUFFER_PRE_PADDING bytes preceding the data; these bytes are
+    ///padding at the start of the buffer and payload already sent for
+    ///any following chunk, in which case they are saved and restored after
+    ///the write; the same applies to the post padding area which overlaps
+    ///the next chunk
+    /// @param wsi lws struct pointer
+    /// @param p first byte to send
+    /// @param size number of bytes to send
+    /// @param savePre @c true if the bytes before @c p hold payload data
+    /// @param savePost @c true if the bytes after @c p + @c size hold
+    ///        payload data
+    /// @param mode lws write mode
+    /// @return number of bytes written, negative in case of error
+    static int WritePadded(lws* wsi,
+                           const char* p,
+                           size_t size,
+                           bool savePre,
+                           bool savePost,
+                           lws_write_protocol mode) {
+        unsigned char* b = (unsigned char*) p;
+        unsigned char pre[LWS_SEND_BUFFER_PRE_PADDING + 1];
+        unsigned char post[LWS_SEND_BUFFER_POST_PADDING + 1];
+        if(savePre) std::memcpy(pre, b - LWS_SEND_BUFFER_PRE_PADDING,
+                                LWS_SEND_BUFFER_PRE_PADDING);
+        if(savePost) std::memcpy(post, b + size,
+                                 LWS_SEND_BUFFER_POST_PADDING);
+        const int bytesWritten = lws_write(wsi, b, size, mode);
+        if(savePre) std::memcpy(b - LWS_SEND_BUFFER_PRE_PADDING, pre,
+                                LWS_SEND_BUFFER_PRE_PADDING);
+        if(savePost) std::memcpy(b + size, post,
+                                 LWS_SEND_BUFFER_POST_PADDING);
+        return bytesWritten;
+    }
     ///Send data to HTTP clients 
     template < typename C, typename S >
     static bool HttpSend(lws_context *context,
                          lws* wsi,
                          void* user) {
-        S* s = reinterpret_cast< S* >(user);
+        S* s = ServiceOf< C, S >(user);
         assert(s);
         if(!s->Data()) return true;
         C* c = reinterpret_cast< C* >(lws_context_user(context));
@@ -599,24 +1395,593 @@ private:
         const DF df = s->Get(chunkSize);    
         const size_t bytesToWrite = df.frameEnd - df.frameBegin;
         if(bytesToWrite < 1) return true;         
+        //complete response available: send requested ranges only, from
+        //the write callbacks; the buffer is not released until the
+        //session ends
+        if(df.frameBegin == df.bufferBegin) {
+            const std::string range = TakeRange(wsi);
+            if(SendRange(wsi, range.c_str(), df.bufferBegin,
+                         df.bufferEnd - df.bufferBegin)) return false;
+        }
         const int bytesWritten                                    
                  = lws_write(wsi,
                              (unsigned char*) df.frameBegin,
                              bytesToWrite, //<= chunkSize
                              LWS_WRITE_HTTP);
-        if(bytesWritten < 0) return true;
+        if(bytesWritten < 0) {
+            Count(wsi, ProtocolMetrics::WRITE_ERRORS);
+            return true;
+        }
+        //status line is at the start of the first chunk
+        if(df.frameBegin == df.bufferBegin) {
+            const int code = ResponseStatus(df.frameBegin, bytesToWrite);
+            if(code > 0) CountStatus(wsi, code);
+        }
+        Count(wsi, ProtocolMetrics::BYTES_OUT, bytesWritten);
         const bool done = df.frameBegin + bytesWritten == df.frameEnd;
         s->UpdateOutBuffer(bytesWritten);
         return done;
     }
 
+    ///Answer file request from the file cache, with 304 if the client's
+    ///copy is current; requested ranges are sent in place from the write
+    ///callbacks, see SendingFile
+    /// @param wsi lws struct pointer
+    /// @param req request header
+    /// @param path file path
+    /// @param mimeType content type
+    /// @param status set to the value the callback must return
+    /// @return @c false if the file cache is disabled or the file is not
+    ///         cacheable: serve the file from disk
+    static bool ServeCachedFile(lws* wsi, const Request& req,
+                                const std::string& path,
+                                const std::string& mimeType, int& status);
+    ///Answer request with a Range header for a file not in the file cache:
+    ///the requested ranges are read from the file and sent from the write
+    ///callbacks, see ContinueFileRange
+    /// @param wsi lws struct pointer
+    /// @param req request header
+    /// @param path file path
+    /// @param mimeType content type
+    /// @param headers additional header lines, each terminated by CRLF
+    /// @param status set to the value the callback must return
+    /// @return @c false if the request has no valid Range header or the
+    ///         file cannot be opened: serve the complete file
+    static bool ServeFileRange(lws* wsi, const Request& req,
+                               const std::string& path,
+                               const std::string& mimeType,
+                               const std::string& headers, int& status);
+    ///Precompressed sibling file of @c path (path.br, path.gz) accepted by
+    ///the client, @c path if none
+    /// @param req request header
+    /// @param headers Content-Encoding and Vary header lines are appended
+    ///        when a sibling file is returned
+    static std::string Precompressed(const Request& req,
+                                     const std::string& path,
+                                     std::string& headers);
+    ///Send the next chunks of the file ranges being sent to @c wsi
+    /// @return -1 if no file ranges are being sent, 1 if all the data was
+    ///         sent or on error, 0 if more data needs to be sent
+    static int ContinueFileRange(lws* wsi);
+    ///@c true if ranges are being sent to @c wsi
+    static bool SendingFile(lws* wsi) {
+        const ServiceLoop* l = CurrentLoop();
+        return l && !l->files.empty() && l->files.count(wsi);
+    }
+    ///Release file range transfer and kept Range header of @c wsi, if any
+    static void EndFileRange(lws* wsi);
+    ///Keep the Range header of a request answered by the service: the
+    ///response is sent from the write callbacks, after the request header
+    ///was overwritten by other requests
+    static void KeepRange(lws* wsi, const Request& req);
+    ///Range header kept for @c wsi, removed; empty if none
+    static std::string TakeRange(lws* wsi);
+    ///Check the Content-Length of a POST request against the protocol's
+    ///max message size, answering 413 or 400 if not acceptable, and
+    ///register the body transfer; called before any of the body is read
+    /// @param wsi lws struct pointer
+    /// @param req request header
+    /// @param session set to the handle of the HTTP session
+    /// @param status set to the value the callback must return
+    /// @return @c false if the request was rejected
+    static bool StartBody(lws* wsi, const Request& req, Session& session,
+                          int& status);
+    ///Account for a received body chunk; answers 413 and ends the body
+    ///transfer if the body is larger than declared or than the max
+    ///message size
+    /// @return @c false if the request was rejected
+    static bool ReceiveBody(lws* wsi, std::size_t len, int& status);
+    ///Release body transfer of @c wsi, if any
+    /// @return @c true if a body was being received or the response to
+    ///         it was pending
+    static bool EndBody(lws* wsi);
+    ///Mark the body of @c wsi as complete, keeping the session registered
+    ///until the service wakes it to send the response
+    static void CompleteBody(lws* wsi);
+    ///@c true if @c wsi is receiving a POST body or the deferred response
+    ///to it is not ready yet: write callbacks requested through Wake or
+    ///ResumeReceive are then ignored
+    /// @param wsi lws struct pointer
+    /// @param ready @c true if the service has data to send
+    static bool ReceivingBody(lws* wsi, bool ready) {
+        const ServiceLoop* l = CurrentLoop();
+        if(!l || l->bodies.empty()) return false;
+        auto i = l->bodies.find(wsi);
+        return i != l->bodies.end() && (!i->second.complete || !ready);
+    }
+    ///Pass body start to a service accumulating the body
+    template < typename S >
+    static void BodyStart(S* s, const Session&, void* in, size_t len,
+                          const std::false_type&) {
+        s->ReceiveStart(len, in);
+    }
+    ///Pass session handle to a streaming body service
+    template < typename S >
+    static void BodyStart(S* s, const Session& h, void*, size_t,
+                          const std::true_type&) {
+        SetSession(s, h, typename HasSetSession< S >::type());
+    }
+    ///Pass body chunk to a service accumulating the body
+    template < typename S >
+    static void Body(lws*, S* s, void* in, size_t len,
+                     const std::false_type&) {
+        s->Receive(len, in);
+    }
+    ///Pass body chunk to a streaming body service, pausing reading if the
+    ///service cannot take more data
+    template < typename S >
+    static void Body(lws* wsi, S* s, void* in, size_t len,
+                     const std::true_type&) {
+        if(len && !s->OnBody(static_cast< const char* >(in), len))
+            lws_rx_flow_control(wsi, 0);
+    }
+    ///Signal end of body to a service accumulating the body
+    /// @return response status
+    template < typename S >
+    static int BodyEnd(S* s, void* in, size_t len, const std::false_type&) {
+        s->ReceiveComplete(int(len), in);
+        return HTTP_STATUS_OK;
+    }
+    ///Signal end of body to a streaming body service
+    /// @return response status
+    template < typename S >
+    static int BodyEnd(S* s, void*, size_t, const std::true_type&) {
+        return s->OnBodyEnd();
+    }
+    ///Answer request with a Range header with the requested ranges of a
+    ///complete 200 response built by an HTTP service
+    /// @param wsi lws struct pointer
+    /// @param range value of the Range header, empty if none
+    /// @param response status line, header and content
+    /// @param size response size; the response must stay available until
+    ///        the ranges are sent, see ContinueFileRange
+    /// @return @c false if the request has no valid Range header or the
+    ///         response is not a complete 200 response: send it as is
+    static bool SendRange(lws* wsi, const char* range,
+                          const char* response, std::size_t size);
+    ///Status code in "HTTP/1.x NNN" line, -1 if @c p does not start
+    ///with a status line
+    static int ResponseStatus(const char* p, std::size_t size) {
+        if(size < 12 || std::strncmp(p, "HTTP/1.", 7)) return -1;
+        int code = 0;
+        for(int i = 9; i != 12; ++i) {
+            if(p[i] < '0' || p[i] > '9') return -1;
+            code = 10 * code + (p[i] - '0');
+        }
+        return code;
+    }
+    ///Id of calling thread, returned to libwebsockets when running
+    ///multiple service threads
+    static int ThreadId() {
+        return int(std::hash< std::thread::id >()(std::this_thread::get_id()));
+    }
+    ///Per-protocol state, accessible from callbacks through the @c user
+    ///field of the protocol
+    struct ProtocolState {
+        ///Compression settings
+        Deflate deflate;
+        ///@c true for BROADCAST protocols
+        bool broadcast = false;
+        ///Broadcast only: latest message, accessed through 
+        ///std::atomic_load/store only
+        SharedFramePtr frame;
+        ///Broadcast only: number of messages published, compared by each
+        ///service thread with the last value it has seen
+        std::atomic< std::uint64_t > published{0};
+        ///ASYNC_POOL only: worker pool, set when the context is created
+        ThreadPool* pool = nullptr;
+        ///@c true for ASYNC_POOL protocols
+        bool pooled = false;
+        ///ASYNC_POOL only: max number of requests in progress per session
+        int maxInFlight = 1;
+        ///Counters
+        ProtocolMetrics metrics;
+        ///Request to reply latency
+        LatencyHistogram latency;
+        ///Size of received messages
+        Histogram messageSizes;
+        ///Max size of received messages, zero for no limit
+        std::size_t maxMessageSize = 0;
+        ///Max number of frames of received messages, zero for no limit
+        int maxFragments = 0;
+        ///Receive buffer size bounds, zero if not tuned
+        std::size_t minRxBufSize = 0;
+        std::size_t maxRxBufSize = 0;
+        ///Number of messages at the time of the last tuning
+        std::uint64_t tunedAt = 0;
+        ///Protocol as used by libwebsockets, set at protocol init
+        const lws_protocols* active = nullptr;
+        ///HTTP only: file cache, @c nullptr if disabled
+        FileCache* files = nullptr;
+        ///http-only only: owner of the protocol, used to read counters
+        const WebSocketService* service = nullptr;
+        ///http-only only: path of the metrics endpoint, empty if disabled
+        std::string metricsPath;
+    };
+    ///Send current broadcast message, or move to the latest one
+    /// @return -1 to close connection, 0 otherwise
+    template < typename C, typename S, SendMode sm >
+    static int SendBroadcast(lws* wsi, void* user) {
+        S* s = ServiceOf< C, S >(user);
+        WriteState* ws = WriteStateOf< C, S >(user);
+        const ProtocolState* bc = static_cast< const ProtocolState* >(
+                                        lws_get_protocol(wsi)->user);
+        using D = std::chrono::steady_clock::duration;
+        const D minDelay = 
+            std::chrono::duration_cast< D >(s->MinDelayBetweenWrites());
+        if(!ws->frame || ws->frameOffset == ws->frame->Size()) {
+            SharedFramePtr latest = std::atomic_load(&bc->frame);
+            if(!latest || latest == ws->frame) return 0;
+            if(Now() < ws->lastWrite + minDelay) {
+                Count(wsi, ProtocolMetrics::THROTTLED);
+                ScheduleWrite(wsi, ws, ws->lastWrite + minDelay);
+                return 0;
+            }
+            ws->frame = std::move(latest);
+            ws->frameOffset = 0;
+        }
+        //the frame header is already in place: write raw bytes, any 
+        //unsent remainder of a partial write is buffered by libwebsockets
+        const std::size_t size = ws->frame->Size();
+        do {
+            const std::size_t chunkSize = std::size_t(
+                FragmentSize(wsi, s->GetSuggestedOutChunkSize()));
+            const std::size_t n = std::min(chunkSize, size - ws->frameOffset);
+            unsigned char* p = reinterpret_cast< unsigned char* >(
+                const_cast< char* >(ws->frame->Begin() + ws->frameOffset));
+            if(lws_write(wsi, p, n, LWS_WRITE_HTTP) < 0) {
+                Count(wsi, ProtocolMetrics::WRITE_ERRORS);
+                return -1;
+            }
+            ws->frameOffset += n;
+            Count(wsi, ProtocolMetrics::BYTES_OUT, n);
+        } while(sm == SendMode::SEND_GREEDY
+                && ws->frameOffset < size
+                && !lws_send_pipe_choked(wsi));
+        if(ws->frameOffset < size) {
+            Count(wsi, ProtocolMetrics::PARTIAL_WRITES);
+            lws_callback_on_writable(wsi);
+            return 0;
+        }
+        Count(wsi, ProtocolMetrics::MESSAGES_OUT);
+        ws->lastWrite = Now();
+        //a newer message might have been published while sending
+        if(std::atomic_load(&bc->frame) != ws->frame) {
+            if(minDelay > D::zero())
+                ScheduleWrite(wsi, ws, ws->lastWrite + minDelay);
+            else lws_callback_on_writable(wsi);
+        }
+        return 0;
+    }
+    ///Request a write callback for the sessions of this loop belonging to
+    ///broadcast protocols with new messages; libwebsockets calls may not
+    ///cross service threads, so each loop wakes only its own sessions
+    void WakeBroadcast(ServiceLoop& l) {
+        l.woken.clear();
+        for(auto& i: protocolStates_) {
+            const ProtocolState* ps = i.second.get();
+            if(!ps->broadcast) continue;
+            const std::uint64_t n = ps->published;
+            std::uint64_t& seen = l.published[ps];
+            if(n == seen) continue;
+            seen = n;
+            l.woken.push_back(ps);
+        }
+        if(l.woken.empty()) return;
+        for(const auto& i: l.sessions) {
+            const void* ps = lws_get_protocol(i.second)->user;
+            if(std::find(l.woken.begin(), l.woken.end(), ps)
+               != l.woken.end())
+                lws_callback_on_writable(i.second);
+        }
+    }
+    ///Register new session with the calling thread's loop and hand its
+    ///handle to the service, if it accepts one
+    template < typename S >
+    static void OpenSession(lws* wsi, WriteState* ws, S* s) {
+        ServiceLoop* l = CurrentLoop();
+        if(!l) return;
+        const Session h = NewSession(l, wsi);
+        ws->session = h.id;
+        SetSession(s, h, typename HasSetSession< S >::type());
+    }
+    ///Register session with loop @c l and return its handle
+    static Session NewSession(ServiceLoop* l, lws* wsi) {
+        Session h;
+        h.loop = l;
+        h.context = lws_get_context(wsi);
+        h.id = (++l->lastId << 8) | std::uint64_t(l->index);
+        l->sessions[h.id] = wsi;
+        return h;
+    }
+    template < typename S >
+    static void SetSession(S* s, const Session& h, const std::true_type&) {
+        s->SetSession(h);
+    }
+    template < typename S >
+    static void SetSession(S*, const Session&, const std::false_type&) {}
+    ///Execute the service's task in the worker pool and post the result
+    ///back to the loop servicing the session; the task must not access
+    ///the service, which might be destroyed before the task completes.
+    ///Tasks exceeding the per-session concurrency level wait in the
+    ///session's pending queue and reading is paused until they start.
+    ///A task throwing an exception closes the session with status 1011
+    template < typename C, typename S >
+    static void SubmitTask(lws* wsi, void* user, const std::true_type&) {
+        const ProtocolState* ps = static_cast< const ProtocolState* >(
+                                        lws_get_protocol(wsi)->user);
+        S* s = ServiceOf< C, S >(user);
+        WriteState* ws = WriteStateOf< C, S >(user);
+        using T = decltype(s->Task());
+        using R = typename std::decay< decltype(std::declval< T& >()()) >
+                    ::type;
+        //std::function requires copyable targets: share the task instead
+        //of copying it
+        std::shared_ptr< T > task = std::make_shared< T >(s->Task());
+        ServiceLoop* l = CurrentLoop();
+        if(!l || !ps || !ps->pool) {
+            //not serviced through Next: no mailbox to post results to
+            try {
+                s->Done((*task)());
+            } catch(...) {
+                ws->taskFailed = true;
+            }
+            lws_callback_on_writable(wsi);
+            return;
+        }
+        const std::uint64_t id = ws->session;
+        lws_context* context = lws_get_context(wsi);
+        ThreadPool* pool = ps->pool;
+        std::function< void () > job = [task, l, id, context, pool]() {
+            std::shared_ptr< R > r;
+            try {
+                r = std::make_shared< R >((*task)());
+            } catch(...) {
+                //completion must still be posted to release the slot
+            }
+            l->mailbox.Push(Message{std::function< void () >(), id,
+                [r, pool](lws* wsi) {
+                    void* user = lws_wsi_user(wsi);
+                    WriteState* ws = WriteStateOf< C, S >(user);
+                    if(r) ServiceOf< C, S >(user)->Done(std::move(*r));
+                    else ws->taskFailed = true;
+                    TaskDone(wsi, ws, pool);
+                }});
+            lws_cancel_service(context);
+        };
+        if(ws->inFlight < ps->maxInFlight) {
+            ++ws->inFlight;
+            pool->Submit(std::move(job));
+        } else {
+            //also re-applies the pause if reading was resumed elsewhere,
+            //see ResumeReceive
+            lws_rx_flow_control(wsi, 0);
+            ws->pending.push_back(std::move(job));
+        }
+    }
+    ///Start next pending task, if any, and resume reading when no task is
+    ///waiting
+    static void TaskDone(lws* wsi, WriteState* ws, ThreadPool* pool) {
+        --ws->inFlight;
+        if(ws->pending.empty()) return;
+        ++ws->inFlight;
+        pool->Submit(std::move(ws->pending.front()));
+        ws->pending.pop_front();
+        if(ws->pending.empty()) lws_rx_flow_control(wsi, 1);
+    }
+    template < typename C, typename S >
+    static void SubmitTask(lws*, void*, const std::false_type&) {}
+    ///Pass received data to a service accumulating whole messages
+    template < typename S >
+    static void Receive(lws*, S* s, void* in, size_t len, bool done,
+                        const std::false_type&) {
+        s->Put(in, len, done);
+    }
+    ///Pass received fragment to a streaming service, pausing reading if
+    ///the service cannot take more data
+    template < typename S >
+    static void Receive(lws* wsi, S* s, void* in, size_t len, bool done,
+                        const std::true_type&) {
+        if(len && !s->OnFragment(static_cast< const char* >(in), len,
+                                 lws_frame_is_binary(wsi) != 0))
+            lws_rx_flow_control(wsi, 0);
+        if(done) s->OnMessageEnd();
+    }
+    ///Unregister session
+    static void CloseSession(WriteState* ws) {
+        ServiceLoop* l = CurrentLoop();
+        if(l && ws->session) l->sessions.erase(ws->session);
+    }
+    ///Apply per-protocol compression settings to new connection
+    /// @return @c true if permessage-deflate is active on @c wsi
+    static bool ConfigureDeflate(lws* wsi);
+    ///Set the compression level of the message starting with @c f: zero
+    ///for binary data flagged as compressed and for messages smaller than
+    ///Deflate::minSize, the protocol's level otherwise. libwebsockets
+    ///applies the level through deflateParams; if it refuses the change
+    ///the message is compressed
+    static void StoreMessage(lws* wsi, WriteState* ws, const FrameView& f);
+    ///Request from other threads: wake session or, if @c session is zero,
+    ///execute function
+    struct Message {
+        std::function< void () > f;
+        std::uint64_t session;
+        ///Invoked with the session's wsi before waking it, if set
+        std::function< void (lws*) > deliver;
+    };
+    ///Max size of the chunks of file ranges written at once
+    enum { FILE_CHUNK_SIZE = 0x10000 };
+    ///Ranges being sent in response to a Range request, read from a file
+    ///or from a response held in memory
+    struct FileTransfer {
+        ///Open file
+        int fd = -1;
+        ///Complete content, written in place instead of read from @c fd
+        const char* content = nullptr;
+        ///Keeps a cached @c content alive
+        FileCache::EntryPtr entry;
+        ///Header and ranges
+        std::vector< ResponsePart > parts;
+        ///Part being sent
+        std::size_t part = 0;
+        ///Bytes of current part already sent
+        std::uint64_t offset = 0;
+        ///Chunk being written
+        PaddedBuffer buffer;
+        ~FileTransfer();
+    };
+    ///Fill @c t.buffer with the next text and file data, stopping before
+    ///content held in memory
+    /// @return @c false if the file was truncated
+    static bool FillChunk(FileTransfer& t);
+    ///POST body being received
+    struct RequestBody {
+        ///Session id, see Session
+        std::uint64_t session = 0;
+        ///Max bytes accepted: Content-Length or, if absent, the max
+        ///message size; -1 for no limit
+        std::int64_t limit = -1;
+        ///Bytes received
+        std::int64_t received = 0;
+        ///@c true once the body is complete and the service is preparing
+        ///the response, see OnBodyEnd
+        bool complete = false;
+    };
+    ///Per service thread state
+    struct ServiceLoop {
+        ///Service thread index
+        int index = 0;
+        ///Last session id issued
+        std::uint64_t lastId = 0;
+        ///Open sessions serviced by this thread: id -> wsi
+        std::unordered_map< std::uint64_t, lws* > sessions;
+        ///Requests from other threads
+        Mailbox< Message > mailbox;
+        ///Sessions waiting for their next write slot
+        TimerQueue writeTimers;
+        ///Time cached for the current iteration
+        TimerNode::TimePoint now;
+        ///@c true if @c now was read during the current iteration
+        bool nowValid = false;
+        ///File ranges being sent by HTTP sessions of this thread
+        std::unordered_map< lws*, std::unique_ptr< FileTransfer > > files;
+        ///POST bodies being received by HTTP sessions of this thread
+        std::unordered_map< lws*, RequestBody > bodies;
+        ///Range headers of requests answered by HTTP services, see KeepRange
+        std::unordered_map< lws*, std::string > ranges;
+        ///Broadcast protocols: number of published messages last seen
+        std::unordered_map< const ProtocolState*, std::uint64_t > published;
+        ///Broadcast protocols with new messages, reused by WakeBroadcast
+        std::vector< const ProtocolState* > woken;
+    };
+    ///Loop serviced by the calling thread, @c nullptr outside of Next
+    static ServiceLoop*& CurrentLoop() {
+        static thread_local ServiceLoop* loop = nullptr;
+        return loop;
+    }
+    ///Sets the loop serviced by the calling thread for the duration of
+    ///a service call
+    struct CurrentLoopScope {
+        CurrentLoopScope(ServiceLoop* l) { CurrentLoop() = l; }
+        ~CurrentLoopScope() { CurrentLoop() = nullptr; }
+    };
+    ///Current time, read once per loop iteration
+    static TimerNode::TimePoint Now() {
+        ServiceLoop* l = CurrentLoop();
+        if(!l) return std::chrono::steady_clock::now();
+        if(!l->nowValid) {
+            l->now = std::chrono::steady_clock::now();
+            l->nowValid = true;
+        }
+        return l->now;
+    }
+    ///Request a write callback at time @c t; falls back to an immediate
+    ///request when invoked outside of a service loop iteration
+    static void ScheduleWrite(lws* wsi,
+                              WriteState* ws,
+                              const TimerNode::TimePoint& t) {
+        ServiceLoop* l = CurrentLoop();
+        if(!l) {
+            lws_callback_on_writable(wsi);
+            return;
+        }
+        ws->timer.data = wsi;
+        l->writeTimers.Schedule(&ws->timer, t);
+    }
+    ///Create libwebsockets context, protocol handlers and context deleter
+    ///must already be set
+    void CreateContext(int port,
+                       int threads,
+                       const char* certPath,
+                       const char* keyPath,
+                       void* user) {
+        if(certPath) certPath_ = certPath;
+        if(keyPath) keyPath_  = keyPath; 
+        info_.port = port;
+        info_.iface = nullptr;
+        info_.protocols = &protocolHandlers_[0];
+        info_.ssl_cert_filepath = certPath_.size() ? certPath_.c_str() 
+                                                   : nullptr;
+        info_.ssl_private_key_filepath = keyPath_.size() ? keyPath_.c_str() 
+                                                         : nullptr;
+        //extensions are enabled per protocol, see Entry::Compress and
+        //LWS_CALLBACK_CONFIRM_EXTENSION_OKAY
+        info_.extensions = nullptr;
+        for(const auto& i: protocolStates_)
+            if(i.second->deflate.enabled) info_.extensions = extensions_;
+        info_.options = 0;
+        info_.count_threads = threads;
+        info_.user = user;
+        for(const auto& i: protocolStates_) {
+            i.second->metrics.Resize(std::max(1, threads));
+            i.second->latency.Resize(std::max(1, threads));
+            i.second->messageSizes.Resize(std::max(1, threads));
+        }
+        for(const auto& i: protocolStates_) {
+            if(!i.second->pooled) continue;
+            if(!pool_) pool_.reset(new ThreadPool(workerThreads_));
+            i.second->pool = pool_.get();
+        }
+        context_ = lws_create_context(&info_);
+        if(!context_) 
+            throw std::runtime_error("Cannot create WebSocket context");
+        loops_ = std::vector< ServiceLoop >(
+                    std::max(1, lws_get_count_threads(context_)));
+        for(int i = 0; i != int(loops_.size()); ++i) loops_[i].index = i;
+    }
     ///Release resources
     void Clear() {
+        //running tasks complete and post their results to the loops,
+        //which must therefore still exist
+        pool_.reset();
         for(auto& i: protocolHandlers_) {
             delete [] i.name;
         }
         protocolHandlers_.clear();
         if(context_) lws_context_destroy(context_);
+        context_ = nullptr;
+        loops_.clear();
+        protocolStates_.clear();
         if(userDataDeleter_.get()) {
             userDataDeleter_->Destroy();
             userDataDeleter_.reset(nullptr);
@@ -629,6 +1994,20 @@ private:
     lws_context* context_ = nullptr;
     ///Array of protocol->service mappings
     Protocols protocolHandlers_;
+    ///Per service thread state, indexed by service thread index
+    std::vector< ServiceLoop > loops_;
+    ///Worker pool shared by ASYNC_POOL protocols
+    std::unique_ptr< ThreadPool > pool_;
+    ///Number of worker pool threads, zero for hardware concurrency
+    int workerThreads_ = 0;
+    ///Path of the metrics endpoint, empty if disabled
+    std::string metricsPath_;
+    ///Cache of files served by the HTTP service, see CacheFiles
+    std::unique_ptr< FileCache > fileCache_;
+    ///Protocol name -> protocol state
+    std::map< std::string, std::unique_ptr< ProtocolState > > protocolStates_;
+    ///Extensions offered to clients
+    static const lws_extension extensions_[];
     ///SSL certificate path
     std::string certPath_;
     ///SSL key path
@@ -638,6 +2017,8 @@ private:
     std::unique_ptr< UserDataDeleter > userDataDeleter_;
     ///libwebsockets log levels -> logger
     static std::function< void (int, const char*) > logger_;
+    ///Size fragments from the socket send buffer, see FragmentSize
+    static std::atomic< bool > adaptiveFragmentSize_;
     ///libwebsockets' log levels -> text map
     const static std::map< lws_log_levels, std::string > levels_;
     ///log level name -> libwebsockets' log level map
@@ -658,13 +2039,26 @@ int WebSocketService::WSCallback(
         case LWS_CALLBACK_ESTABLISHED: {
             C* c = reinterpret_cast< C* >(lws_context_user(context));
             c->InitSession(user);
+            new (WriteStateOf< C, S >(user)) WriteState;
+            WriteStateOf< C, S >(user)->deflate = ConfigureDeflate(wsi);
             // user points to a memory region pre-allocated by
-            // libwesockets of size = sizeof(S), see
-            new (user) S(c, lws_get_protocol(wsi)->name);
-            const S* s = reinterpret_cast< const S* >(user);
+            // libwesockets of size = SessionLayout< C, S >::size, see
+            // AddHandler
+            new (ServiceOf< C, S >(user)) S(c, lws_get_protocol(wsi)->name);
+            OpenSession(wsi, WriteStateOf< C, S >(user),
+                        ServiceOf< C, S >(user));
+            Count(wsi, ProtocolMetrics::SESSIONS_OPENED);
+            const S* s = ServiceOf< C, S >(user);
             //schedule read in case of async reply to schedule
             //first write callback
-            if(s->Sending() || type == Type::ASYNC_REP) {
+            if(type == Type::BROADCAST) {
+                //deliver latest message, if any
+                const ProtocolState* bc = 
+                    static_cast< const ProtocolState* >(
+                        lws_get_protocol(wsi)->user);
+                if(std::atomic_load(&bc->frame))
+                    lws_callback_on_writable(wsi);
+            } else if(s->Sending() || type == Type::ASYNC_REP) {
                 lws_callback_on_writable(wsi);
             }
         }
@@ -675,6 +2069,8 @@ int WebSocketService::WSCallback(
             if(!wsi) break;
             const lws_protocols* p =  lws_get_protocol(wsi);
             if(p) c->InitProtocol(p->name);
+            if(p && p->user)
+                static_cast< ProtocolState* >(p->user)->active = p;
         }
         break;
         case LWS_CALLBACK_PROTOCOL_DESTROY: {
@@ -690,47 +2086,97 @@ int WebSocketService::WSCallback(
         }
         break;
         case LWS_CALLBACK_RECEIVE: {
-            S* s = reinterpret_cast< S* >(user);
-            const bool done = lws_remaining_packet_payload(wsi) == 0;
-            s->Put(in, len, done);
+            S* s = ServiceOf< C, S >(user);
+            WriteState* ws = WriteStateOf< C, S >(user);
+            const std::size_t remaining = lws_remaining_packet_payload(wsi);
+            //end of message, not of frame: messages can span many frames
+            const bool done = remaining == 0 && lws_is_final_fragment(wsi);
+            if(!TrackMessage(wsi, ws, len, remaining, done)) return -1;
+            Receive(wsi, s, in, len, done,
+                    typename HasOnFragment< S >::type());
+            Count(wsi, ProtocolMetrics::BYTES_IN, len);
+            if(done) Count(wsi, ProtocolMetrics::MESSAGES_IN);
+            if(done && type != Type::BROADCAST && !ws->replyPending) {
+                ws->requestTime = std::chrono::steady_clock::now();
+                ws->replyPending = true;
+            }
             if(type == Type::REQ_REP && done) {
                 const bool GREEDY_OPTION = sm == SendMode::SEND_GREEDY;
                 C* c = 
                   reinterpret_cast< C* >(lws_context_user(context));
-                if(!Send< C, S >(context, wsi, user, GREEDY_OPTION))
+                if(!Send< C, S >(context, wsi, user, GREEDY_OPTION)) {
+                    Count(wsi, ProtocolMetrics::PARTIAL_WRITES);
                     lws_callback_on_writable(wsi);
+                }
             } else if(type == Type::ASYNC_REP && done) {
                   lws_callback_on_writable(wsi);
+            } else if(type == Type::ASYNC_POOL && done) {
+                SubmitTask< C, S >(wsi, user, std::integral_constant< bool,
+                                          type == Type::ASYNC_POOL >());
             }
         }
         break;
         case LWS_CALLBACK_SERVER_WRITEABLE: {
-            C* c = reinterpret_cast< C* >(lws_context_user(context));
-            S* s = reinterpret_cast< S* >(user);
-            if(c->ElapsedWriteTime(user) < s->MinDelayBetweenWrites()) {
-                lws_callback_on_writable(wsi);
+            if(type == Type::BROADCAST) return SendBroadcast< C, S, sm >(wsi,
+                                                                   user);
+            S* s = ServiceOf< C, S >(user);
+            WriteState* ws = WriteStateOf< C, S >(user);
+            Count(wsi, ProtocolMetrics::WRITABLE);
+            if(ws->taskFailed) {
+                static const char reason[] = "Task failed";
+                lws_close_reason(wsi, LWS_CLOSE_STATUS_UNEXPECTED_CONDITION,
+                                 (unsigned char*) reason, sizeof(reason) - 1);
+                return -1;
+            }
+            using D = std::chrono::steady_clock::duration;
+            const D minDelay = 
+                std::chrono::duration_cast< D >(s->MinDelayBetweenWrites());
+            const TimerNode::TimePoint now = Now();
+            //too early: sleep until the write slot opens instead of
+            //re-requesting a write callback at each iteration
+            if(now < ws->lastWrite + minDelay) {
+                Count(wsi, ProtocolMetrics::THROTTLED);
+                ScheduleWrite(wsi, ws, ws->lastWrite + minDelay);
                 break;
             }
             const bool GREEDY_OPTION = sm == SendMode::SEND_GREEDY;
             const bool allSent = Send< C, S >(context, wsi, user,
                                               GREEDY_OPTION);
-            //if data still pending reset timer, if not data will have to wait 
-            //until next available time frame, the timer is reset to current
-            //time - min delay time to ensure that the next write operation is
-            //executed 
-            if(!allSent) c->ResetWriteTimer(user, s->MinDelayBetweenWrites());
-            else c->RecordWriteTime(user);
-            if(!allSent 
-               || s->Sending()) {
+            //if data still pending send the rest as soon as the socket is
+            //writable; the write slot closes only after the whole frame 
+            //is sent
+            if(!allSent) {
+                Count(wsi, ProtocolMetrics::PARTIAL_WRITES);
                 lws_callback_on_writable(wsi);
+            } else {
+                ws->lastWrite = now;
+                if(s->Sending()) {
+                    if(minDelay > D::zero())
+                        ScheduleWrite(wsi, ws, now + minDelay);
+                    else lws_callback_on_writable(wsi);
+                }
             }
         }
         break;
-        case LWS_CALLBACK_CLOSED:
-            reinterpret_cast< S* >(user)->Destroy();
+        case LWS_CALLBACK_GET_THREAD_ID:
+            //allows libwebsockets to detect calls from non-service threads
+            return ThreadId();
+        case LWS_CALLBACK_CONFIRM_EXTENSION_OKAY: {
+            //extensions are enabled per protocol: non zero denies
+            const ProtocolState* ps = static_cast< const ProtocolState* >(
+                                                lws_get_protocol(wsi)->user);
+            return ps && ps->deflate.enabled ? 0 : 1;
+        }
+        case LWS_CALLBACK_CLOSED: {
+            Count(wsi, ProtocolMetrics::SESSIONS_CLOSED);
+            WriteState* ws = WriteStateOf< C, S >(user);
+            if(ws->timer.queue) ws->timer.queue->Cancel(&ws->timer);
+            CloseSession(ws);
+            ws->~WriteState();
+            ServiceOf< C, S >(user)->Destroy();
             reinterpret_cast< C* >(lws_context_user(context))
                                                           ->Clear(user);
-
+        }
         break;
         default:
             break;
@@ -740,77 +2186,139 @@ int WebSocketService::WSCallback(
 }
 
 //------------------------------------------------------------------------------
-std::unordered_map< std::string, std::string >
-ParseHttpHeader(lws *wsi);
-
 template < typename C, typename S >
 int WebSocketService::HttpCallback(
-               lws_context *context,
                lws *wsi,
                lws_callback_reasons reason,
                void *user,
                void *in,
                size_t len) {
-
+    lws_context* context = lws_get_context(wsi);
     int status = 0;
     switch (reason) {
     case LWS_CALLBACK_HTTP: {
+        Count(wsi, ProtocolMetrics::HTTP_REQUESTS);
         if (len < 1) {
             lws_return_http_status(wsi,
                         HTTP_STATUS_BAD_REQUEST, NULL);
-            status = -1;
-            break;
+            CountStatus(wsi, HTTP_STATUS_BAD_REQUEST);
+            //nothing constructed yet in per-session memory
+            return -1;
         }
-        C* c = reinterpret_cast< C* >(lws_get_context(wsi));
+        if(ServeMetrics(wsi, (const char*) in, status)) return status;
+        C* c = reinterpret_cast< C* >(lws_context_user(lws_get_context(wsi)));
         c->InitSession(user);
-        new (user) S(c,(const char *) in, len, ParseHttpHeader(wsi));
-        S* s = reinterpret_cast< S* >(user);
+        //filled in place: no allocations, lives until the next request
+        //serviced by this thread
+        static thread_local Request header;
+        ParseHttpHeader(wsi, header);
+        new (ServiceOf< C, S >(user)) S(c,(const char *) in, len, header);
+        S* s = ServiceOf< C, S >(user);
         /* this server has no concept of directories */
         if(!s->Valid()) {
             lws_return_http_status(wsi,
                         HTTP_STATUS_FORBIDDEN, NULL);
+            CountStatus(wsi, HTTP_STATUS_FORBIDDEN);
             status = -1;
             break;
         }
         //if a legal POST URL, let it continue and accept data
         if(lws_hdr_total_length(wsi, WSI_TOKEN_POST_URI)) {
-            s->ReceiveStart(len, in);
+            Session h;
+            if(!StartBody(wsi, header, h, status)) break;
+            BodyStart(s, h, in, len, typename HasOnBody< S >::type());
             break;
         }
 
         if(!s->FilePath().empty()) {
+            if(ServeCachedFile(wsi, header, s->FilePath(),
+                               s->FileMimeType(), status)) {
+                if(SendingFile(wsi)) break;
+                s->Destroy();
+                c->Clear(user);
+                return status;
+            }
+            //mime type of the original file, not of the sibling file
+            std::string headers;
+            const std::string path = 
+                Precompressed(header, s->FilePath(), headers);
+            if(ServeFileRange(wsi, header, path, s->FileMimeType(), headers,
+                              status)) break;
+            headers += "Accept-Ranges: bytes\r\n";
             //async, won't stop thread
-            if(lws_serve_http_file(context, wsi,
-                                             s->FilePath().c_str(),
-                                             s->FileMimeType().c_str(),
-                                             nullptr, //other headers
-                                             0)) {    //other headers length
+            const int r = lws_serve_http_file(wsi,
+                                   path.c_str(),
+                                   s->FileMimeType().c_str(),
+                                   headers.c_str(), //other headers
+                                   int(headers.size()));
+            //a missing file is answered with 404 by libwebsockets
+            CountStatus(wsi, r < 0 ? HTTP_STATUS_NOT_FOUND : HTTP_STATUS_OK);
+            if(r) {
                 //status = -1; //stop anyway: either error or file sent
                 break;
             }
         } else {
+           KeepRange(wsi, header);
            lws_callback_on_writable(wsi);
         }
         }
         break;
+    case LWS_CALLBACK_GET_THREAD_ID:
+        return ThreadId();
     case LWS_CALLBACK_HTTP_BODY:
-        reinterpret_cast< S* >(user)->Receive(len, in);
+        Count(wsi, ProtocolMetrics::BYTES_IN, len);
+        if(!ReceiveBody(wsi, len, status)) break;
+        Body(wsi, ServiceOf< C, S >(user), in, len,
+             typename HasOnBody< S >::type());
         break;
-    case LWS_CALLBACK_HTTP_BODY_COMPLETION:
-        reinterpret_cast< S* >(user)->ReceiveComplete(len, in);
-        lws_return_http_status(wsi, HTTP_STATUS_OK, NULL);
+    case LWS_CALLBACK_HTTP_BODY_COMPLETION: {
+        const int code = BodyEnd(ServiceOf< C, S >(user), in, len,
+                                 typename HasOnBody< S >::type());
+        //answered later: the service wakes the session when ready
+        if(!code) {
+            CompleteBody(wsi);
+            break;
+        }
+        EndBody(wsi);
+        lws_return_http_status(wsi, code, NULL);
+        CountStatus(wsi, code);
         status = -1;
+        }
         break;
     case LWS_CALLBACK_HTTP_FILE_COMPLETION:
         status = -1;
         break;
+    case LWS_CALLBACK_CLOSED_HTTP:
+        //closed by the client while sending file ranges
+        EndFileRange(wsi);
+        //closed by the client while sending the body or before the
+        //deferred response was sent: the service was not destroyed yet
+        if(EndBody(wsi)) status = -1;
+        break;
     case LWS_CALLBACK_HTTP_WRITEABLE: {
+        //woken while receiving the body or by a late ResumeReceive:
+        //nothing to send yet
+        if(ReceivingBody(wsi, ServiceOf< C, S >(user)->Data())) break;
+        Count(wsi, ProtocolMetrics::WRITABLE);
+        const int r = ContinueFileRange(wsi);
+        if(r >= 0) {
+            if(r) {
+                EndBody(wsi);
+                status = -1;
+                break;
+            }
+            lws_set_timeout(wsi, PENDING_TIMEOUT_HTTP_CONTENT, 5);
+            lws_callback_on_writable(wsi);
+            break;
+        }
         const bool allSent = HttpSend< C, S >(context, wsi, user);
-        const S* s = reinterpret_cast< const S* >(user);
+        const S* s = ServiceOf< C, S >(user);
         if(!allSent || s->Sending()) {
             lws_set_timeout(wsi, PENDING_TIMEOUT_HTTP_CONTENT, 5);
             lws_callback_on_writable(wsi);
         } else {
+            //release the session of a deferred POST response, if any
+            EndBody(wsi);
             status = -1;
             break;
         }
@@ -820,8 +2328,9 @@ int WebSocketService::HttpCallback(
         break;
     }
     if(status == -1) {
-        reinterpret_cast< S* >(user)->Destroy();
-        reinterpret_cast< C* >(lws_get_context(wsi))->Clear(user);
+        ServiceOf< C, S >(user)->Destroy();
+        reinterpret_cast< C* >(lws_context_user(lws_get_context(wsi)))
+                                                          ->Clear(user);
     }
     return status;
 }
@@ -0,0 +1,179 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//Minimal blocking WebSocket client used by the benchmarks to drive
+//WebSocketService over loopback: one instance per connection, one
+//thread per instance
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+namespace wsp {
+
+class WSClient {
+public:
+    WSClient() = default;
+    WSClient(const WSClient&) = delete;
+    WSClient& operator=(const WSClient&) = delete;
+    ~WSClient() { Close(); }
+    /// Connect and perform opening handshake
+    /// @param port server port on loopback interface
+    /// @param protocol WebSocket sub-protocol name
+    void Connect(int port, const std::string& protocol) {
+        fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        if(fd_ < 0) throw std::runtime_error("Cannot create socket");
+        if(readChunk_) {
+            const int rcvBuf = int(readChunk_);
+            ::setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &rcvBuf,
+                         sizeof(rcvBuf));
+        }
+        int one = 1;
+        ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(::connect(fd_, (sockaddr*) &addr, sizeof(addr)) < 0)
+            throw std::runtime_error("Cannot connect");
+        const std::string req = "GET / HTTP/1.1\r\n"
+                                "Host: localhost\r\n"
+                                "Upgrade: websocket\r\n"
+                                "Connection: Upgrade\r\n"
+                                "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                "Sec-WebSocket-Protocol: " + protocol + "\r\n"
+                                "Sec-WebSocket-Version: 13\r\n\r\n";
+        WriteAll(req.data(), req.size());
+        //read response header one byte at a time to avoid consuming frames
+        std::string rep;
+        char c = 0;
+        while(rep.size() < 4 || rep.compare(rep.size() - 4, 4, "\r\n\r\n")) {
+            if(!ReadAll(&c, 1))
+                throw std::runtime_error("Connection closed by server");
+            rep.push_back(c);
+        }
+        if(rep.find(" 101 ") == std::string::npos)
+            throw std::runtime_error("Handshake failed: " + rep);
+    }
+    /// Send a single-frame message; payload is masked as required by
+    /// the protocol
+    void Send(const char* data, size_t size, bool binary = true) {
+        out_.resize(14 + size);
+        size_t h = 0;
+        out_[h++] = char(0x80 | (binary ? 0x2 : 0x1));
+        if(size < 126) out_[h++] = char(0x80 | size);
+        else if(size < 0x10000) {
+            out_[h++] = char(0x80 | 126);
+            out_[h++] = char(size >> 8);
+            out_[h++] = char(size);
+        } else {
+            out_[h++] = char(0x80 | 127);
+            for(int i = 7; i >= 0; --i)
+                out_[h++] = char(uint64_t(size) >> (8 * i));
+        }
+        const char mask[4] = {0x12, 0x34, 0x56, 0x78};
+        std::memcpy(&out_[h], mask, 4);
+        h += 4;
+        for(size_t i = 0; i != size; ++i) out_[h + i] = data[i] ^ mask[i & 3];
+        WriteAll(out_.data(), h + size);
+    }
+    /// Receive a complete message, concatenating continuation frames;
+    /// control frames are skipped
+    /// @param msg message payload
+    /// @return @c false if the connection was closed
+    bool Receive(std::vector< char >& msg) {
+        msg.resize(0);
+        while(true) {
+            unsigned char h[2];
+            if(!ReadAll((char*) h, 2)) return false;
+            uint64_t len = h[1] & 0x7f;
+            if(len == 126) {
+                unsigned char e[2];
+                ReadAll((char*) e, 2);
+                len = (uint64_t(e[0]) << 8) | e[1];
+            } else if(len == 127) {
+                unsigned char e[8];
+                ReadAll((char*) e, 8);
+                len = 0;
+                for(int i = 0; i != 8; ++i) len = (len << 8) | e[i];
+            }
+            const int opcode = h[0] & 0xf;
+            const size_t prev = msg.size();
+            msg.resize(prev + len);
+            if(len && !ReadAll(&msg[prev], len)) return false;
+            if(opcode == 0x8) return false; //close
+            if(opcode >= 0x8) { //ping/pong: discard
+                msg.resize(prev);
+                continue;
+            }
+            if(h[0] & 0x80) return true; //FIN
+        }
+    }
+    void Close() {
+        if(fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+    }
+    /// Emulate a slow reader: read at most @c chunk bytes at a time and
+    /// sleep @c delay before each read; call before Connect to also
+    /// shrink the socket receive buffer
+    /// @param chunk max bytes per read, zero for no limit
+    /// @param delay pause before each read
+    void SlowRead(size_t chunk, std::chrono::microseconds delay) {
+        readChunk_ = chunk;
+        readDelay_ = delay;
+    }
+private:
+    void WriteAll(const char* p, size_t n) {
+        while(n) {
+            const ssize_t w = ::send(fd_, p, n, 0);
+            if(w <= 0) throw std::runtime_error("Send error");
+            p += w;
+            n -= size_t(w);
+        }
+    }
+    bool ReadAll(char* p, size_t n) {
+        while(n) {
+            if(readDelay_.count()) std::this_thread::sleep_for(readDelay_);
+            const size_t m = readChunk_ ? std::min(n, readChunk_) : n;
+            const ssize_t r = ::recv(fd_, p, m, 0);
+            if(r <= 0) return false;
+            p += r;
+            n -= size_t(r);
+        }
+        return true;
+    }
+private:
+    int fd_ = -1;
+    std::vector< char > out_;
+    size_t readChunk_ = 0;
+    std::chrono::microseconds readDelay_{0};
+};
+
+} //namespace wsp
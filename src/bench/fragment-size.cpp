@@ -0,0 +1,129 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+//Fragment size benchmark: echo throughput over loopback across message
+//sizes, with fragments of the fixed size suggested by the service and
+//with fragments sized from the socket send buffer; then a single large
+//echo to a slow reader, reporting write callbacks and service thread CPU
+//time: a sender spinning on write callbacks while the socket drains
+//shows CPU time close to the elapsed time
+//
+//usage: bench-fragment-size [messages per size] [max message size]
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <sys/resource.h>
+
+#include "../WebSocketService.h"
+#include "../Context.h"
+#include "../examples/SessionService.h"
+#include "WSClient.h"
+
+using namespace std;
+
+int main(int argc, char** argv) {
+    const int messages = argc > 1 ? stoi(argv[1]) : 200;
+    const size_t maxSize = argc > 2 ? stoul(argv[2]) : (size_t(1) << 23);
+    using namespace wsp;
+    using WSS = WebSocketService;
+    using Service = SessionService< Context<> >;
+    WSS::ResetLogLevels();
+    cout << "message size,fixed MB/s,adaptive MB/s" << endl;
+    int port = 9200;
+    for(size_t size = 1024; size <= maxSize; size *= 4) {
+        cout << size;
+        for(bool adaptive: {false, true}) {
+            WSS::AdaptiveFragmentSize(adaptive);
+            WSS ws;
+            ws.Init(++port, nullptr, nullptr, Context<>(),
+                    WSS::Entry< Service, WSS::REQ_REP >("echo"));
+            atomic< bool > stop(false);
+            thread server([&ws, &stop]() {
+                ws.StartLoop(10, [&stop]() { return !stop; });
+            });
+            double mbs = 0;
+            try {
+                WSClient client;
+                client.Connect(port, "echo");
+                const vector< char > msg(size, 'x');
+                vector< char > reply;
+                using namespace std::chrono;
+                const steady_clock::time_point start = steady_clock::now();
+                for(int m = 0; m != messages; ++m) {
+                    client.Send(msg.data(), msg.size());
+                    if(!client.Receive(reply) || reply.size() != size)
+                        throw runtime_error("Invalid reply");
+                }
+                const duration< double > e = steady_clock::now() - start;
+                mbs = double(size) * messages / e.count() / (1 << 20);
+            } catch(const exception& e) {
+                cerr << e.what() << endl;
+            }
+            stop = true;
+            server.join();
+            cout << ',' << mbs;
+        }
+        cout << endl;
+    }
+    //slow reader: 8 MiB echo read 16 KiB at a time every millisecond
+    cout << "\nslow reader,elapsed ms,write callbacks,service CPU ms" << endl;
+    for(bool adaptive: {false, true}) {
+        WSS::AdaptiveFragmentSize(adaptive);
+        WSS ws;
+        ws.Init(++port, nullptr, nullptr, Context<>(),
+                WSS::Entry< Service, WSS::REQ_REP >("echo"));
+        atomic< bool > stop(false);
+        double cpuMs = 0;
+        thread server([&ws, &stop, &cpuMs]() {
+            ws.StartLoop(10, [&stop]() { return !stop; });
+            rusage u;
+            getrusage(RUSAGE_THREAD, &u);
+            cpuMs = (u.ru_utime.tv_sec + u.ru_stime.tv_sec) * 1e3
+                    + (u.ru_utime.tv_usec + u.ru_stime.tv_usec) / 1e3;
+        });
+        double elapsedMs = 0;
+        try {
+            WSClient client;
+            client.SlowRead(0x4000, std::chrono::microseconds(1000));
+            client.Connect(port, "echo");
+            const vector< char > msg(size_t(8) << 20, 'x');
+            vector< char > reply;
+            using namespace std::chrono;
+            const steady_clock::time_point start = steady_clock::now();
+            client.Send(msg.data(), msg.size());
+            if(!client.Receive(reply) || reply.size() != msg.size())
+                throw runtime_error("Invalid reply");
+            elapsedMs = duration< double, milli >(steady_clock::now()
+                                                  - start).count();
+        } catch(const exception& e) {
+            cerr << e.what() << endl;
+        }
+        stop = true;
+        server.join();
+        const ProtocolMetrics* m = ws.Metrics("echo");
+        cout << (adaptive ? "adaptive" : "fixed") << ',' << elapsedMs << ','
+             << (m ? m->Get(ProtocolMetrics::WRITABLE) : 0) << ','
+             << cpuMs << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+//HTTP header parsing microbenchmark: ns per request to extract the header
+//fields of a typical browser request, hand them to a service and look up
+//the URI, Content-Length and Accept-Encoding; compares the former
+//string -> string map, built from a 1 KiB scratch vector and copied by the
+//service, with wsp::Request. Header fields are read from an in-memory
+//table with the same interface as lws_hdr_total_length/lws_hdr_copy
+//
+//usage: bench-header-parse [requests]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+#include "../http.h"
+
+using namespace std;
+
+//field values of a request sent by a browser
+struct Source {
+    const char* values[wsp::HDR_COUNT] = {};
+    Source() {
+        values[wsp::HDR_GET_URI] = "/static/js/require.js";
+        values[wsp::HDR_HOST] = "localhost:8001";
+        values[wsp::HDR_CONNECTION] = "keep-alive";
+        values[wsp::HDR_ACCEPT] = "*/*";
+        values[wsp::HDR_IF_MODIFIED_SINCE] = "Sat, 17 Oct 2026 01:18:40 GMT";
+        values[wsp::HDR_ACCEPT_ENCODING] = "gzip, deflate, br";
+        values[wsp::HDR_ACCEPT_LANGUAGE] = "en-US,en;q=0.9";
+        values[wsp::HDR_CACHE_CONTROL] = "max-age=0";
+        values[wsp::HDR_COOKIE] = "session=6f1c2a9e4b7d3f80; theme=dark";
+        values[wsp::HDR_REFERER] = "http://localhost:8001/index.html";
+    }
+    int Length(int f) const {
+        return values[f] ? int(strlen(values[f])) : 0;
+    }
+    int Copy(int f, char* buf, int n) const {
+        const int l = Length(f);
+        if(l >= n) return -1;
+        memcpy(buf, values[f], l + 1);
+        return l;
+    }
+};
+
+using Map = unordered_map< string, string >;
+
+//former implementation of ParseHttpHeader
+Map ParseMap(const Source& s) {
+    vector< char > buf(0x400);
+    Map hm;
+    for(int n = 0; n < wsp::HDR_COUNT; ++n) {
+        if(!s.Length(n)) continue;
+        s.Copy(n, &buf[0], int(buf.size()));
+        hm[wsp::Request::Name(wsp::HeaderField(n))] = &buf[0];
+    }
+    return hm;
+}
+
+//former service: copies the header
+struct MapService {
+    explicit MapService(const Map& m) : header(m) {}
+    size_t Lookup() const {
+        auto u = header.find("GET URI");
+        auto l = header.find("Content-Length:");
+        auto e = header.find("Accept-Encoding:");
+        return (u != header.end() ? u->second.size() : 0)
+               + (l != header.end() ? stoi(l->second) : 0)
+               + (e != header.end() ? e->second.size() : 0);
+    }
+    Map header;
+};
+
+size_t Lookup(const wsp::Request& r) {
+    return r.Size(wsp::HDR_GET_URI) + size_t(wsp::GetContentSize(r) + 1)
+           + r.Size(wsp::HDR_ACCEPT_ENCODING);
+}
+
+template < typename F >
+double NsPerRequest(int requests, F f) {
+    using namespace std::chrono;
+    size_t sink = 0;
+    const steady_clock::time_point start = steady_clock::now();
+    for(int i = 0; i != requests; ++i) sink += f();
+    const duration< double, nano > e = steady_clock::now() - start;
+    //keep results alive
+    if(sink == 42) cerr << sink;
+    return e.count() / requests;
+}
+
+int main(int argc, char** argv) {
+    const int requests = argc > 1 ? stoi(argv[1]) : 1000000;
+    const Source src;
+    wsp::Request request;
+    const double map = NsPerRequest(requests, [&src]() {
+        const MapService s(ParseMap(src));
+        return s.Lookup();
+    });
+    const double view = NsPerRequest(requests, [&src, &request]() {
+        request.Parse([&src](int f) { return src.Length(f); },
+                      [&src](int f, char* b, int n) {
+                          return src.Copy(f, b, n);
+                      });
+        return Lookup(request);
+    });
+    const double lookup = NsPerRequest(requests, [&request]() {
+        return Lookup(request);
+    });
+    cout << "parser,ns/request" << endl
+         << "unordered_map," << map << endl
+         << "wsp::Request," << view << endl
+         << "wsp::Request lookups only," << lookup << endl;
+    return 0;
+}
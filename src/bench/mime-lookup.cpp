@@ -0,0 +1,93 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+//MIME type lookup microbenchmark: ns per lookup of the extensions of a
+//mix of typical requests, unknown extensions included; compares the former
+//std::string -> std::string map, searched twice per lookup with a
+//std::string key built from the extension, with the generated perfect hash
+//table (wsp::MimeType) and wsp::GetMimeType
+//
+//usage: bench-mime-lookup [lookups]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cstdlib>
+
+#include "../http.h"
+#include "../mimetypes.h"
+
+using namespace std;
+
+using Map = unordered_map< string, string >;
+
+//former implementation of GetMimeType
+const string& MapMimeType(const Map& m, const string& ext) {
+    static const string emptyString;
+    if(m.find(ext) == m.end()) return emptyString;
+    return m.find(ext)->second;
+}
+
+template < typename F >
+double NsPerLookup(int lookups, const vector< wsp::StringView >& exts, F f) {
+    using namespace std::chrono;
+    size_t sink = 0;
+    const steady_clock::time_point start = steady_clock::now();
+    for(int i = 0; i != lookups; ++i) sink += f(exts[i % exts.size()]);
+    const duration< double, nano > e = steady_clock::now() - start;
+    //keep results alive
+    if(sink == 42) cerr << sink;
+    return e.count() / lookups;
+}
+
+int main(int argc, char** argv) {
+    const int lookups = argc > 1 ? stoi(argv[1]) : 10000000;
+    Map map;
+    for(const wsp::MimeTypeEntry& e: wsp::detail::MIME_TYPES)
+        if(!e.extension.empty()) map[e.extension] = e.type;
+    const char* uris[] = {"/index.html", "/static/js/require.js",
+                          "/static/css/style.css", "/img/logo.gif",
+                          "/img/photo.jpg", "/favicon.ico", "/data/model.bin",
+                          "/docs/manual.pdf", "/app/main.wasm",
+                          "/fonts/icons.woff2", "/download/archive.tar.gz",
+                          "/README"};
+    vector< wsp::StringView > exts;
+    for(const char* u: uris) {
+        exts.push_back(wsp::FileExtension(u));
+        if(MapMimeType(map, exts.back()) != wsp::MimeType(exts.back())) {
+            cerr << "Mismatch: " << exts.back() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    const double m = NsPerLookup(lookups, exts, [&map](wsp::StringView e) {
+        return MapMimeType(map, e).size();
+    });
+    const double h = NsPerLookup(lookups, exts, [](wsp::StringView e) {
+        return wsp::MimeType(e).size();
+    });
+    const double g = NsPerLookup(lookups, exts, [](wsp::StringView e) {
+        return wsp::GetMimeType(e).size();
+    });
+    cout << "lookup,ns/lookup" << endl
+         << "unordered_map," << m << endl
+         << "wsp::MimeType," << h << endl
+         << "wsp::GetMimeType," << g << endl;
+    return 0;
+}
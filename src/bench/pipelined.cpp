@@ -0,0 +1,176 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//Pipelined request benchmark: a single client sends all its requests
+//without waiting for replies; requests take a variable amount of time to
+//process. Compares sequential processing with concurrent processing of
+//requests tagged with request ids (Entry::Concurrent)
+//
+//usage: bench-pipelined [requests] [max task duration us] [pool threads]
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+
+#include "../WebSocketService.h"
+#include "../Context.h"
+#include "../DataFrame.h"
+#include "../PaddedBuffer.h"
+#include "../RequestId.h"
+#include "WSClient.h"
+
+using namespace std;
+
+struct Config {
+    int maxTaskDuration = 2000; //us
+};
+
+//tagged echo, sleeping for a pseudo-random time before replying
+class SlowEcho {
+public:
+    using Context = wsp::Context< Config >;
+    using DataFrame = wsp::DataFrame;
+    SlowEcho(Context* c, const char* = nullptr)
+        : maxDuration_(c->GetServiceData().maxTaskDuration) {}
+    bool PreformattedBuffer() const { return true; }
+    bool Data() const { return !replies_.empty() || !reply_.empty(); }
+    const DataFrame& Get(int chunkSize) {
+        if(reply_.empty()) {
+            reply_ = move(replies_.front());
+            replies_.pop_front();
+            wsp::Init(df_, reply_.data(), reply_.size());
+        }
+        wsp::Update(df_, chunkSize);
+        return df_;
+    }
+    void UpdateOutBuffer(int bytesConsumed) {
+        wsp::Consume(df_, bytesConsumed);
+        if(wsp::Consumed(df_)) reply_.resize(0);
+    }
+    void Put(void* p, size_t len, bool) {
+        const char* b = static_cast< const char* >(p);
+        request_.insert(request_.end(), b, b + len);
+    }
+    function< wsp::PaddedBuffer () > Task() {
+        shared_ptr< wsp::PaddedBuffer > r =
+            make_shared< wsp::PaddedBuffer >(move(request_));
+        request_.clear();
+        const int maxDuration = maxDuration_;
+        return [r, maxDuration]() {
+            uint32_t id = 0;
+            wsp::ReadRequestId(r->data(), r->size(), id);
+            //same duration for the same request in both runs
+            minstd_rand rng(id);
+            this_thread::sleep_for(chrono::microseconds(
+                uniform_int_distribution< int >(0, maxDuration)(rng)));
+            return move(*r);
+        };
+    }
+    void Done(wsp::PaddedBuffer&& r) { replies_.push_back(move(r)); }
+    int GetSuggestedOutChunkSize() const { return 4096; }
+    bool Sending() const { return Data(); }
+    chrono::duration< double > MinDelayBetweenWrites() const {
+        return chrono::duration< double >(0);
+    }
+    void Destroy() { this->~SlowEcho(); }
+private:
+    ~SlowEcho() {}
+private:
+    int maxDuration_;
+    deque< wsp::PaddedBuffer > replies_;
+    wsp::PaddedBuffer request_;
+    wsp::PaddedBuffer reply_;
+    DataFrame df_;
+};
+
+void Run(const char* name, int port, int concurrency, int requests,
+         int poolThreads, const Config& cfg) {
+    using namespace wsp;
+    using namespace std::chrono;
+    using WSS = WebSocketService;
+    WSS ws;
+    ws.SetWorkerThreads(poolThreads);
+    ws.Init(port, nullptr, nullptr, Context< Config >(cfg),
+            WSS::Entry< SlowEcho, WSS::ASYNC_POOL >("echo")
+                .Concurrent(concurrency));
+    atomic< bool > stop(false);
+    thread server([&ws, &stop]() {
+        ws.StartLoop(10, [&stop]() { return !stop; });
+    });
+    double elapsed = 0;
+    int outOfOrder = 0;
+    try {
+        WSClient client;
+        client.Connect(port, "echo");
+        vector< char > msg(64, 'x');
+        const steady_clock::time_point start = steady_clock::now();
+        //send from a separate thread: the client must keep reading
+        //replies while sending to avoid filling the socket buffers
+        thread sender([&client, &msg, requests]() {
+            try {
+                for(int i = 0; i != requests; ++i) {
+                    WriteRequestId(msg.data(), uint32_t(i));
+                    client.Send(msg.data(), msg.size());
+                }
+            } catch(const exception& e) {
+                cerr << e.what() << endl;
+            }
+        });
+        vector< char > reply;
+        vector< bool > received(requests, false);
+        uint32_t prev = 0;
+        bool ok = true;
+        for(int i = 0; i != requests && ok; ++i) {
+            uint32_t id = 0;
+            ok = client.Receive(reply)
+                 && ReadRequestId(reply.data(), reply.size(), id)
+                 && id < uint32_t(requests) && !received[id];
+            if(!ok) break;
+            received[id] = true;
+            if(i && id < prev) ++outOfOrder;
+            prev = id;
+        }
+        //unblock sender
+        if(!ok) client.Close();
+        sender.join();
+        if(!ok) throw runtime_error("Invalid reply");
+        elapsed = duration< double >(steady_clock::now() - start).count();
+    } catch(const exception& e) {
+        cerr << e.what() << endl;
+    }
+    stop = true;
+    server.join();
+    cout << name << ',' << concurrency << ',' << requests / elapsed << ','
+         << outOfOrder << endl;
+}
+
+int main(int argc, char** argv) {
+    const int requests = argc > 1 ? stoi(argv[1]) : 1000;
+    Config cfg;
+    if(argc > 2) cfg.maxTaskDuration = stoi(argv[2]);
+    const int poolThreads = argc > 3 ? stoi(argv[3]) : 0;
+    wsp::WebSocketService::ResetLogLevels();
+    cout << "mode,concurrency,requests/s,out of order replies" << endl;
+    Run("sequential", 9500, 1, requests, poolThreads, cfg);
+    Run("concurrent", 9501, 256, requests, poolThreads, cfg);
+    return 0;
+}
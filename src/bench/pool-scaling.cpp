@@ -0,0 +1,239 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//Connection count scaling benchmark: one echo worker thread per session
+//(ASYNC_REP) versus the shared worker pool (ASYNC_POOL); for each
+//connection count reports the time to open all the connections, the
+//echo throughput with one request in flight per connection, the time to
+//close all the connections and the peak number of process threads
+//
+//usage: bench-pool-scaling [max connections] [rounds] [pool threads]
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+
+#include <sys/resource.h>
+
+#include "../WebSocketService.h"
+#include "../Context.h"
+#include "../DataFrame.h"
+#include "../PaddedBuffer.h"
+#include "../LockFreeQueue.h"
+#include "WSClient.h"
+
+using namespace std;
+
+//number of live service instances, used to detect when all the sessions
+//have been closed by the server
+atomic< int > liveSessions(0);
+
+//reply queue and send state shared by the echo services
+class EchoBase {
+public:
+    using Context = wsp::Context<>;
+    using DataFrame = wsp::DataFrame;
+    EchoBase() { ++liveSessions; }
+    ~EchoBase() { --liveSessions; }
+    bool PreformattedBuffer() const { return true; }
+    bool Data() const { return !replies_.empty() || !reply_.empty(); }
+    const DataFrame& Get(int chunkSize) {
+        if(reply_.empty()) {
+            reply_ = move(replies_.front());
+            replies_.pop_front();
+            wsp::Init(df_, reply_.data(), reply_.size());
+        }
+        wsp::Update(df_, chunkSize);
+        return df_;
+    }
+    void UpdateOutBuffer(int bytesConsumed) {
+        wsp::Consume(df_, bytesConsumed);
+        if(wsp::Consumed(df_)) reply_.resize(0);
+    }
+    int GetSuggestedOutChunkSize() const { return 4096; }
+    chrono::duration< double > MinDelayBetweenWrites() const {
+        return chrono::duration< double >(0);
+    }
+protected:
+    deque< wsp::PaddedBuffer > replies_;
+    wsp::PaddedBuffer request_;
+    wsp::PaddedBuffer reply_;
+    DataFrame df_;
+};
+
+//one worker thread per session, started when the connection is established
+class ThreadEcho : public EchoBase {
+public:
+    ThreadEcho(Context*, const char* = nullptr) {}
+    void SetSession(const wsp::WebSocketService::Session& s) {
+        session_ = s;
+        worker_ = async(launch::async, [this]() {
+            wsp::PaddedBuffer r;
+            while(requests_.Pop(r)) {
+                results_.Push(move(r));
+                wsp::WebSocketService::Wake(session_);
+            }
+        });
+    }
+    bool Data() const { return !results_.Empty() || EchoBase::Data(); }
+    const DataFrame& Get(int chunkSize) {
+        wsp::PaddedBuffer r;
+        while(results_.TryPop(r)) replies_.push_back(move(r));
+        return EchoBase::Get(chunkSize);
+    }
+    void Put(void* p, size_t len, bool done) {
+        const char* b = static_cast< const char* >(p);
+        request_.insert(request_.end(), b, b + len);
+        if(done) {
+            requests_.Push(move(request_));
+            request_.clear();
+        }
+    }
+    bool Sending() const { return Data(); }
+    void Destroy() { this->~ThreadEcho(); }
+private:
+    ~ThreadEcho() {
+        requests_.Close();
+        results_.Close();
+        if(worker_.valid()) worker_.get();
+    }
+private:
+    wsp::WebSocketService::Session session_;
+    wsp::SPSCBlockingQueue< wsp::PaddedBuffer > requests_;
+    wsp::SPSCBlockingQueue< wsp::PaddedBuffer > results_;
+    future< void > worker_;
+};
+
+//replies computed by the worker pool
+class PoolEcho : public EchoBase {
+public:
+    PoolEcho(Context*, const char* = nullptr) {}
+    void Put(void* p, size_t len, bool) {
+        const char* b = static_cast< const char* >(p);
+        request_.insert(request_.end(), b, b + len);
+    }
+    function< wsp::PaddedBuffer () > Task() {
+        shared_ptr< wsp::PaddedBuffer > r =
+            make_shared< wsp::PaddedBuffer >(move(request_));
+        request_.clear();
+        return [r]() { return move(*r); };
+    }
+    void Done(wsp::PaddedBuffer&& r) { replies_.push_back(move(r)); }
+    bool Sending() const { return Data(); }
+    void Destroy() { this->~PoolEcho(); }
+private:
+    ~PoolEcho() {}
+};
+
+//number of threads in this process
+int ThreadCount() {
+    ifstream is("/proc/self/status");
+    string line;
+    while(getline(is, line)) {
+        if(line.compare(0, 8, "Threads:") == 0) return stoi(line.substr(8));
+    }
+    return 0;
+}
+
+template < typename S, wsp::WebSocketService::Type T >
+void Run(const char* name, int port, int connections, int rounds,
+         int poolThreads) {
+    using namespace wsp;
+    using namespace std::chrono;
+    using WSS = WebSocketService;
+    WSS ws;
+    ws.SetWorkerThreads(poolThreads);
+    ws.Init(port, nullptr, nullptr, Context<>(),
+            WSS::Entry< S, T >("echo"));
+    atomic< bool > stop(false);
+    thread server([&ws, &stop]() {
+        ws.StartLoop(10, [&stop]() { return !stop; });
+    });
+    int peakThreads = 0;
+    double connectTime = 0;
+    double rate = 0;
+    double closeTime = 0;
+    try {
+        vector< unique_ptr< WSClient > > clients;
+        const steady_clock::time_point start = steady_clock::now();
+        for(int i = 0; i != connections; ++i) {
+            clients.push_back(unique_ptr< WSClient >(new WSClient));
+            clients.back()->Connect(port, "echo");
+        }
+        while(liveSessions < connections) this_thread::yield();
+        connectTime = duration< double >(steady_clock::now() - start).count();
+        peakThreads = ThreadCount();
+        const vector< char > msg(64, 'x');
+        vector< char > reply;
+        const steady_clock::time_point rstart = steady_clock::now();
+        for(int r = 0; r != rounds; ++r) {
+            for(auto& c: clients) c->Send(msg.data(), msg.size());
+            for(auto& c: clients)
+                if(!c->Receive(reply))
+                    throw runtime_error("Connection closed");
+        }
+        rate = double(connections) * rounds / duration< double >(
+                    steady_clock::now() - rstart).count();
+        const steady_clock::time_point cstart = steady_clock::now();
+        clients.clear();
+        while(liveSessions > 0) this_thread::yield();
+        closeTime = duration< double >(steady_clock::now() - cstart).count();
+    } catch(const exception& e) {
+        cerr << e.what() << endl;
+    }
+    stop = true;
+    server.join();
+    cout << name << ',' << connections << ','
+         << connectTime * 1000 << ',' << rate << ','
+         << closeTime * 1000 << ',' << peakThreads << endl;
+}
+
+int main(int argc, char** argv) {
+    const int maxConnections = argc > 1 ? stoi(argv[1]) : 5000;
+    const int rounds = argc > 2 ? stoi(argv[2]) : 20;
+    const int poolThreads = argc > 3 ? stoi(argv[3]) : 0;
+    //two descriptors per connection: client and server side
+    rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if(rl.rlim_cur != RLIM_INFINITY)
+            cerr << "Max open files: " << rl.rlim_cur << endl;
+    }
+    wsp::WebSocketService::ResetLogLevels();
+    using WSS = wsp::WebSocketService;
+    cout << "mode,connections,connect ms,messages/s,close ms,threads"
+         << endl;
+    vector< int > counts;
+    for(int n = 10; n < maxConnections; n *= 10) counts.push_back(n);
+    counts.push_back(maxConnections);
+    int port = 9400;
+    for(int n: counts) {
+        Run< ThreadEcho, WSS::ASYNC_REP >("thread", port++, n, rounds,
+                                          poolThreads);
+        Run< PoolEcho, WSS::ASYNC_POOL >("pool", port++, n, rounds,
+                                         poolThreads);
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+//Queue microbenchmark: messages/sec through the mutex based SyncQueue
+//used by the pattern examples and through the lock-free queues, with one
+//consumer and one or more producers
+//
+//usage: bench-queues [messages per producer] [max producers] [message size]
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+
+#include "../LockFreeQueue.h"
+#include "../examples/patterns/SyncQueue.h"
+
+using namespace std;
+
+using Message = vector< char >;
+
+//uniform interface
+struct Sync {
+    SyncQueue< Message > q;
+    void Push(Message&& m) { q.Push(m); }
+    void Pop(Message& m) { m = q.Pop(); }
+};
+
+template < typename Q >
+struct LockFree {
+    Q q;
+    void Push(Message&& m) { q.Push(std::move(m)); }
+    void Pop(Message& m) { q.Pop(m); }
+};
+
+template < typename Q >
+double Run(int producers, int messages, size_t size) {
+    Q q;
+    using namespace std::chrono;
+    const steady_clock::time_point start = steady_clock::now();
+    vector< thread > threads;
+    for(int p = 0; p != producers; ++p) {
+        threads.push_back(thread([&q, messages, size]() {
+            for(int i = 0; i != messages; ++i) q.Push(Message(size, 'x'));
+        }));
+    }
+    Message m;
+    for(int i = 0; i != producers * messages; ++i) q.Pop(m);
+    for(auto& t: threads) t.join();
+    const duration< double > e = steady_clock::now() - start;
+    return producers * messages / e.count();
+}
+
+int main(int argc, char** argv) {
+    const int messages = argc > 1 ? stoi(argv[1]) : 1000000;
+    const int maxProducers = argc > 2 ? stoi(argv[2]) : 4;
+    const size_t size = argc > 3 ? stoul(argv[3]) : 64;
+    cout << "producers,SyncQueue msg/s,SPSCQueue msg/s,MPSCQueue msg/s" 
+         << endl;
+    for(int p = 1; p <= maxProducers; p *= 2) {
+        cout << p << ',' << Run< Sync >(p, messages, size) << ',';
+        if(p == 1)
+            cout << Run< LockFree< wsp::SPSCBlockingQueue< Message > > >(
+                        p, messages, size);
+        else cout << '-';
+        cout << ','
+             << Run< LockFree< wsp::MPSCBlockingQueue< Message > > >(
+                    p, messages, size)
+             << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+//Send path benchmark: bytes/sec of chunked websocket framing over a local
+//socket pair when each chunk is copied into a padded scratch buffer (the
+//WebSocketService::Send path for non pre-formatted buffers) versus writing
+//in place from a PaddedBuffer
+//
+//usage: bench-send-copy [message size in bytes] [chunk size] [iterations]
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../PaddedBuffer.h"
+
+using namespace std;
+
+namespace {
+//write websocket frame header into the bytes preceding the payload and send
+//header + payload with a single call, as lws_write does
+void WriteFrame(int fd, unsigned char* p, size_t len, bool first, bool fin) {
+    unsigned char h[10];
+    size_t hl = 0;
+    h[hl++] = (fin ? 0x80 : 0) | (first ? 0x2 : 0x0);
+    if(len < 126) h[hl++] = (unsigned char) len;
+    else if(len < 0x10000) {
+        h[hl++] = 126;
+        h[hl++] = (unsigned char)(len >> 8);
+        h[hl++] = (unsigned char)(len);
+    } else {
+        h[hl++] = 127;
+        for(int i = 7; i >= 0; --i) h[hl++] = (unsigned char)(len >> (8 * i));
+    }
+    std::memcpy(p - hl, h, hl);
+    size_t n = len + hl;
+    unsigned char* b = p - hl;
+    while(n) {
+        const ssize_t w = ::send(fd, b, n, 0);
+        if(w < 0) throw std::runtime_error("send error");
+        b += w;
+        n -= size_t(w);
+    }
+}
+
+//previous Send behaviour: copy each chunk into a padded buffer
+void SendCopy(int fd, const vector< char >& msg, size_t chunk,
+              vector< char >& scratch) {
+    for(size_t b = 0; b < msg.size(); b += chunk) {
+        const size_t n = min(chunk, msg.size() - b);
+        scratch.resize(wsp::PRE_PADDING + n + wsp::POST_PADDING);
+        std::copy(msg.begin() + b, msg.begin() + b + n,
+                  scratch.begin() + wsp::PRE_PADDING);
+        WriteFrame(fd, (unsigned char*) &scratch[wsp::PRE_PADDING], n,
+                   b == 0, b + n == msg.size());
+    }
+}
+
+//current Send behaviour: write in place saving and restoring the bytes
+//overwritten by the frame header
+void SendInPlace(int fd, wsp::PaddedBuffer& msg, size_t chunk) {
+    unsigned char saved[wsp::PRE_PADDING];
+    for(size_t b = 0; b < msg.size(); b += chunk) {
+        const size_t n = min(chunk, msg.size() - b);
+        unsigned char* p = (unsigned char*) msg.data() + b;
+        if(b) std::memcpy(saved, p - wsp::PRE_PADDING, wsp::PRE_PADDING);
+        WriteFrame(fd, p, n, b == 0, b + n == msg.size());
+        if(b) std::memcpy(p - wsp::PRE_PADDING, saved, wsp::PRE_PADDING);
+    }
+}
+
+template < typename F >
+double BytesPerSecond(F&& f, size_t bytes, int iterations) {
+    using namespace std::chrono;
+    const steady_clock::time_point t = steady_clock::now();
+    for(int i = 0; i != iterations; ++i) f();
+    const duration< double > e = steady_clock::now() - t;
+    return double(bytes) * iterations / e.count();
+}
+}
+
+int main(int argc, char** argv) {
+    const size_t size = argc > 1 ? stoul(argv[1]) : 2 * 1024 * 1024;
+    const size_t chunk = argc > 2 ? stoul(argv[2]) : 4096;
+    const int iterations = argc > 3 ? stoi(argv[3]) : 500;
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        cerr << "cannot create socket pair" << endl;
+        return 1;
+    }
+    //reader: drain socket
+    thread reader([&fds]() {
+        vector< char > b(1 << 16);
+        while(::read(fds[1], b.data(), b.size()) > 0);
+    });
+    vector< char > msg(size, 'x');
+    wsp::PaddedBuffer pmsg(size, 'x');
+    vector< char > scratch;
+    const double copy = BytesPerSecond([&]() {
+        SendCopy(fds[0], msg, chunk, scratch); }, size, iterations);
+    const double inPlace = BytesPerSecond([&]() {
+        SendInPlace(fds[0], pmsg, chunk); }, size, iterations);
+    ::shutdown(fds[0], SHUT_WR);
+    reader.join();
+    ::close(fds[0]);
+    ::close(fds[1]);
+    const double MB = 1024 * 1024;
+    cout << "message size: " << size << " chunk size: " << chunk
+         << " iterations: " << iterations << endl
+         << "copy:     " << copy / MB << " MB/s" << endl
+         << "in place: " << inPlace / MB << " MB/s" << endl;
+    return 0;
+}
@@ -0,0 +1,91 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+//Service thread scaling benchmark: echo messages/sec over loopback for
+//1..N service threads
+//
+//usage: bench-service-threads [max threads] [connections] [messages per
+//                             connection] [message size]
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "../WebSocketService.h"
+#include "../Context.h"
+#include "../examples/SessionService.h"
+#include "WSClient.h"
+
+using namespace std;
+
+int main(int argc, char** argv) {
+    const int maxThreads = argc > 1 ? stoi(argv[1])
+                                    : int(thread::hardware_concurrency());
+    const int connections = argc > 2 ? stoi(argv[2]) : 64;
+    const int messages = argc > 3 ? stoi(argv[3]) : 2000;
+    const size_t size = argc > 4 ? stoul(argv[4]) : 1024;
+    using namespace wsp;
+    using WSS = WebSocketService;
+    using Service = SessionService< Context<> >;
+    WSS::ResetLogLevels();
+    cout << "threads,connections,message size,messages/s" << endl;
+    for(int t = 1; t <= maxThreads; ++t) {
+        const int port = 9100 + t;
+        WSS ws;
+        ws.Init(port, WSS::ServiceThreads(t), nullptr, nullptr, Context<>(),
+                WSS::Entry< Service, WSS::REQ_REP >("echo"));
+        atomic< bool > stop(false);
+        thread server([&ws, &stop]() {
+            ws.StartLoop(10, [&stop]() { return !stop; });
+        });
+        vector< thread > clients;
+        atomic< int > errors(0);
+        using namespace std::chrono;
+        const steady_clock::time_point start = steady_clock::now();
+        for(int c = 0; c != connections; ++c) {
+            clients.push_back(thread([=, &errors]() {
+                try {
+                    WSClient client;
+                    client.Connect(port, "echo");
+                    const vector< char > msg(size, 'x');
+                    vector< char > reply;
+                    for(int m = 0; m != messages; ++m) {
+                        client.Send(msg.data(), msg.size());
+                        if(!client.Receive(reply) || reply.size() != size) {
+                            ++errors;
+                            break;
+                        }
+                    }
+                } catch(const exception&) {
+                    ++errors;
+                }
+            }));
+        }
+        for(auto& c: clients) c.join();
+        const duration< double > e = steady_clock::now() - start;
+        stop = true;
+        server.join();
+        cout << t << ',' << connections << ',' << size << ','
+             << double(connections) * messages / e.count();
+        if(errors) cout << " (" << errors << " failed connections)";
+        cout << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,158 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+//Asynchronous reply latency benchmark: request to reply round trip over
+//loopback when replies are computed by a worker thread and
+//- the service polls for replies at a fixed interval (Sending() always
+//  true, throttled by MinDelayBetweenWrites)
+//- the worker wakes the session with WebSocketService::Wake
+//
+//usage: bench-wake-latency [requests] [poll interval ms]
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "../WebSocketService.h"
+#include "../Context.h"
+#include "../DataFrame.h"
+#include "../PaddedBuffer.h"
+#include "../examples/patterns/SyncQueue.h"
+#include "WSClient.h"
+
+using namespace std;
+
+struct Config {
+    double pollInterval = 0.05; //seconds
+};
+
+//echo service replying from a worker thread
+template < bool WAKE >
+class AsyncEcho {
+public:
+    using Context = wsp::Context< Config >;
+    using DataFrame = wsp::DataFrame;
+    AsyncEcho(Context* c, const char* = nullptr)
+        : pollInterval_(c->GetServiceData().pollInterval) {}
+    void SetSession(const wsp::WebSocketService::Session& s) {
+        session_ = s;
+        worker_ = async(launch::async, [this]() {
+            while(true) {
+                wsp::PaddedBuffer r = requests_.Pop();
+                if(r.empty()) break;
+                replies_.Push(r);
+                if(WAKE) wsp::WebSocketService::Wake(session_);
+            }
+        });
+    }
+    bool PreformattedBuffer() const { return true; }
+    bool Data() const { return !replies_.Empty() || !reply_.empty(); }
+    const DataFrame& Get(int chunkSize) {
+        if(reply_.empty()) {
+            reply_ = replies_.Pop();
+            wsp::Init(df_, reply_.data(), reply_.size());
+        }
+        wsp::Update(df_, chunkSize);
+        return df_;
+    }
+    void UpdateOutBuffer(int bytesConsumed) {
+        wsp::Consume(df_, bytesConsumed);
+        if(wsp::Consumed(df_)) reply_.resize(0);
+    }
+    void Put(void* p, size_t len, bool done) {
+        const char* b = static_cast< const char* >(p);
+        request_.insert(request_.end(), b, b + len);
+        if(done) {
+            requests_.Push(request_);
+            request_.resize(0);
+        }
+    }
+    int GetSuggestedOutChunkSize() const { return 4096; }
+    bool Sending() const { return WAKE ? Data() : true; }
+    chrono::duration< double > MinDelayBetweenWrites() const {
+        return chrono::duration< double >(WAKE ? 0 : pollInterval_);
+    }
+    void Destroy() { this->~AsyncEcho(); }
+private:
+    ~AsyncEcho() {
+        requests_.Push(wsp::PaddedBuffer()); //stop worker
+        if(worker_.valid()) worker_.get();
+    }
+private:
+    double pollInterval_;
+    wsp::WebSocketService::Session session_;
+    SyncQueue< wsp::PaddedBuffer > requests_;
+    SyncQueue< wsp::PaddedBuffer > replies_;
+    wsp::PaddedBuffer request_;
+    wsp::PaddedBuffer reply_;
+    DataFrame df_;
+    future< void > worker_;
+};
+
+template < typename S >
+void Run(const char* name, int port, int requests, const Config& cfg) {
+    using namespace wsp;
+    using WSS = WebSocketService;
+    WSS ws;
+    ws.Init(port, nullptr, nullptr, Context< Config >(cfg),
+            WSS::Entry< S, WSS::ASYNC_REP >("echo"));
+    atomic< bool > stop(false);
+    thread server([&ws, &stop]() {
+        ws.StartLoop(50, [&stop]() { return !stop; });
+    });
+    vector< double > latency;
+    try {
+        WSClient client;
+        client.Connect(port, "echo");
+        const vector< char > msg(64, 'x');
+        vector< char > reply;
+        for(int i = 0; i != requests; ++i) {
+            using namespace std::chrono;
+            const steady_clock::time_point start = steady_clock::now();
+            client.Send(msg.data(), msg.size());
+            if(!client.Receive(reply)) throw runtime_error("Connection closed");
+            const duration< double, micro > e = steady_clock::now() - start;
+            latency.push_back(e.count());
+        }
+    } catch(const exception& e) {
+        cerr << e.what() << endl;
+    }
+    stop = true;
+    server.join();
+    if(latency.empty()) return;
+    sort(latency.begin(), latency.end());
+    cout << name << ','
+         << latency[latency.size() / 2] << ','
+         << latency[latency.size() * 99 / 100] << endl;
+}
+
+int main(int argc, char** argv) {
+    const int requests = argc > 1 ? stoi(argv[1]) : 1000;
+    Config cfg;
+    if(argc > 2) cfg.pollInterval = stod(argv[2]) / 1000;
+    wsp::WebSocketService::ResetLogLevels();
+    cout << "mode,p50 us,p99 us" << endl;
+    Run< AsyncEcho< false > >("poll", 9300, requests, cfg);
+    Run< AsyncEcho< true > >("wake", 9301, requests, cfg);
+    return 0;
+}
@@ -0,0 +1,529 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//End-to-end loopback benchmark suite: drives WebSocketService with
+//blocking clients, one thread per connection, and reports throughput and
+//latency percentiles for each scenario, message size and connection count
+//- reqrep: sync request-reply echo (REQ_REP)
+//- async:  async request-reply echo computed by the worker pool (ASYNC_POOL)
+//- stream: server pushes timestamped messages as fast as clients read them
+//- http:   file served through the http-only protocol, one GET per
+//          connection
+//Latency is the request to reply round trip, for streaming the time
+//between the server filling a message and the client receiving it.
+//
+//usage: wsp-bench [--scenarios reqrep,async,stream,http]
+//                 [--sizes 64,4096,65536] [--connections 1,16,64]
+//                 [--messages per connection] [--threads service threads]
+//                 [--json]
+//output: one CSV line (default) or JSON object (--json) per run
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "../WebSocketService.h"
+#include "../Context.h"
+#include "../DataFrame.h"
+#include "../PaddedBuffer.h"
+#include "../http.h"
+#include "../examples/SessionService.h"
+#include "WSClient.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+//==============================================================================
+//Services
+
+//async echo: replies are computed by the worker pool
+class PoolEcho {
+public:
+    using Context = wsp::Context<>;
+    using DataFrame = wsp::DataFrame;
+    PoolEcho(Context*, const char* = nullptr) {}
+    bool PreformattedBuffer() const { return true; }
+    bool Data() const { return !replies_.empty() || !reply_.empty(); }
+    const DataFrame& Get(int chunkSize) {
+        if(reply_.empty()) {
+            reply_ = move(replies_.front());
+            replies_.pop_front();
+            wsp::Init(df_, reply_.data(), reply_.size());
+        }
+        wsp::Update(df_, chunkSize);
+        return df_;
+    }
+    void UpdateOutBuffer(int bytesConsumed) {
+        wsp::Consume(df_, bytesConsumed);
+        if(wsp::Consumed(df_)) reply_.resize(0);
+    }
+    void Put(void* p, size_t len, bool) {
+        const char* b = static_cast< const char* >(p);
+        request_.insert(request_.end(), b, b + len);
+    }
+    function< wsp::PaddedBuffer () > Task() {
+        shared_ptr< wsp::PaddedBuffer > r =
+            make_shared< wsp::PaddedBuffer >(move(request_));
+        request_.clear();
+        return [r]() { return move(*r); };
+    }
+    void Done(wsp::PaddedBuffer&& r) { replies_.push_back(move(r)); }
+    int GetSuggestedOutChunkSize() const { return 4096; }
+    bool Sending() const { return Data(); }
+    chrono::duration< double > MinDelayBetweenWrites() const {
+        return chrono::duration< double >(0);
+    }
+    void Destroy() { this->~PoolEcho(); }
+private:
+    ~PoolEcho() {}
+private:
+    deque< wsp::PaddedBuffer > replies_;
+    wsp::PaddedBuffer request_;
+    wsp::PaddedBuffer reply_;
+    DataFrame df_;
+};
+
+struct StreamConfig {
+    size_t size = 64;
+};
+
+//streaming: a new message is sent as soon as the previous one is out,
+//the first 8 bytes hold the time the message was filled
+class StreamService {
+public:
+    using Context = wsp::Context< StreamConfig >;
+    using DataFrame = wsp::DataFrame;
+    StreamService(Context* c, const char* = nullptr)
+        : buffer_(max(sizeof(int64_t), c->GetServiceData().size), 'x') {}
+    bool PreformattedBuffer() const { return true; }
+    bool Data() const { return true; }
+    const DataFrame& Get(int chunkSize) {
+        if(wsp::Empty(df_) || wsp::Consumed(df_)) {
+            const int64_t t = Clock::now().time_since_epoch().count();
+            memcpy(buffer_.data(), &t, sizeof(t));
+            wsp::Init(df_, buffer_.data(), buffer_.size());
+        }
+        wsp::Update(df_, chunkSize);
+        return df_;
+    }
+    void UpdateOutBuffer(int bytesConsumed) {
+        wsp::Consume(df_, bytesConsumed);
+    }
+    void Put(void*, size_t, bool) {}
+    int GetSuggestedOutChunkSize() const { return 4096; }
+    bool Sending() const { return true; }
+    chrono::duration< double > MinDelayBetweenWrites() const {
+        return chrono::duration< double >(0);
+    }
+    void Destroy() { this->~StreamService(); }
+private:
+    ~StreamService() {}
+private:
+    wsp::PaddedBuffer buffer_;
+    DataFrame df_;
+};
+
+struct HttpConfig {
+    string filePath;
+};
+
+//serves the benchmark file for any request
+class FileService {
+public:
+    using HTTP = int;
+    using DataFrame = wsp::DataFrame;
+    using Context = wsp::Context< HttpConfig >;
+    FileService(Context* c, const char*, size_t, const wsp::Request&)
+        : filePath_(c->GetServiceData().filePath) {}
+    bool Valid() const { return true; }
+    const string& FilePath() const { return filePath_; }
+    const string& FileMimeType() const { return mimeType_; }
+    const DataFrame& Get(int) { return df_; }
+    bool Data() const { return false; }
+    bool Sending() const { return false; }
+    void UpdateOutBuffer(int) {}
+    int GetSuggestedOutChunkSize() const { return 4096; }
+    void Destroy() { this->~FileService(); }
+    void ReceiveStart(size_t, void*) {}
+    void Receive(size_t, void*) {}
+    void ReceiveComplete(int, void*) {}
+private:
+    string filePath_;
+    string mimeType_ = "application/octet-stream";
+    DataFrame df_;
+};
+
+//==============================================================================
+//Clients
+
+//GET request over a new connection; the server closes the connection after
+//sending the file
+/// @return number of body bytes received
+size_t HttpGet(int port, const string& path) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) throw runtime_error("Cannot create socket");
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(::connect(fd, (sockaddr*) &addr, sizeof(addr)) < 0) {
+        ::close(fd);
+        throw runtime_error("Cannot connect");
+    }
+    const string req = "GET " + path + " HTTP/1.1\r\n"
+                       "Host: localhost\r\n"
+                       "Connection: close\r\n\r\n";
+    if(::send(fd, req.data(), req.size(), 0) != ssize_t(req.size())) {
+        ::close(fd);
+        throw runtime_error("Send error");
+    }
+    vector< char > buf(0x10000);
+    string header;
+    size_t body = 0;
+    bool inBody = false;
+    while(true) {
+        const ssize_t r = ::recv(fd, buf.data(), buf.size(), 0);
+        if(r <= 0) break;
+        if(inBody) {
+            body += size_t(r);
+            continue;
+        }
+        header.append(buf.data(), size_t(r));
+        const size_t e = header.find("\r\n\r\n");
+        if(e != string::npos) {
+            inBody = true;
+            body = header.size() - e - 4;
+        }
+    }
+    ::close(fd);
+    if(header.compare(0, 12, "HTTP/1.1 200") && header.compare(0, 12,
+                                                        "HTTP/1.0 200"))
+        throw runtime_error("HTTP error");
+    return body;
+}
+
+//==============================================================================
+//Driver
+
+struct Options {
+    vector< string > scenarios = {"reqrep", "async", "stream", "http"};
+    vector< size_t > sizes = {64, 4096, 65536};
+    vector< int > connections = {1, 16, 64};
+    int messages = 1000;
+    int threads = 1;
+    bool json = false;
+};
+
+struct Result {
+    string scenario;
+    int connections = 0;
+    size_t size = 0;
+    size_t messages = 0;
+    double seconds = 0;
+    size_t bytes = 0;
+    int errors = 0;
+    //microseconds
+    vector< double > latency;
+};
+
+double Percentile(const vector< double >& v, double p) {
+    if(v.empty()) return 0;
+    const size_t i = min(v.size() - 1, size_t(p * v.size()));
+    return v[i];
+}
+
+void Print(Result& r, bool json) {
+    sort(r.latency.begin(), r.latency.end());
+    const double mps = r.seconds > 0 ? r.messages / r.seconds : 0;
+    const double mbps = r.seconds > 0 ? r.bytes / r.seconds / 1E6 : 0;
+    if(json) {
+        cout << "{\"scenario\":\"" << r.scenario << "\","
+             << "\"connections\":" << r.connections << ','
+             << "\"size\":" << r.size << ','
+             << "\"messages\":" << r.messages << ','
+             << "\"messages_per_s\":" << mps << ','
+             << "\"mb_per_s\":" << mbps << ','
+             << "\"p50_us\":" << Percentile(r.latency, 0.5) << ','
+             << "\"p99_us\":" << Percentile(r.latency, 0.99) << ','
+             << "\"p999_us\":" << Percentile(r.latency, 0.999) << ','
+             << "\"errors\":" << r.errors << '}' << endl;
+    } else {
+        cout << r.scenario << ',' << r.connections << ',' << r.size << ','
+             << r.messages << ',' << mps << ',' << mbps << ','
+             << Percentile(r.latency, 0.5) << ','
+             << Percentile(r.latency, 0.99) << ','
+             << Percentile(r.latency, 0.999) << ',' << r.errors << endl;
+    }
+}
+
+//run one client thread per connection and merge their results
+/// @param client function invoked as
+///        <code>client(connection index, latency, bytes)</code>, returning
+///        the number of messages exchanged
+Result RunClients(int connections,
+                  const function< size_t (int, vector< double >&,
+                                          size_t&) >& client) {
+    Result res;
+    vector< thread > threads;
+    vector< vector< double > > latency(connections);
+    vector< size_t > bytes(connections, 0);
+    vector< size_t > messages(connections, 0);
+    atomic< int > errors(0);
+    const Clock::time_point start = Clock::now();
+    for(int c = 0; c != connections; ++c) {
+        threads.push_back(thread([&, c]() {
+            try {
+                messages[c] = client(c, latency[c], bytes[c]);
+            } catch(const exception&) {
+                ++errors;
+            }
+        }));
+    }
+    for(auto& t: threads) t.join();
+    res.seconds = chrono::duration< double >(Clock::now() - start).count();
+    for(int c = 0; c != connections; ++c) {
+        res.latency.insert(res.latency.end(), latency[c].begin(),
+                           latency[c].end());
+        res.bytes += bytes[c];
+        res.messages += messages[c];
+    }
+    res.errors = errors;
+    res.connections = connections;
+    return res;
+}
+
+//start service loop in a separate thread for the lifetime of the instance
+class Server {
+public:
+    Server(wsp::WebSocketService& ws) : ws_(ws), stop_(false),
+        thread_([this]() {
+            ws_.StartLoop(10, [this]() { return !stop_; });
+        }) {}
+    ~Server() {
+        stop_ = true;
+        thread_.join();
+    }
+private:
+    wsp::WebSocketService& ws_;
+    atomic< bool > stop_;
+    thread thread_;
+};
+
+double Micro(const Clock::duration& d) {
+    return chrono::duration< double, micro >(d).count();
+}
+
+//request-reply: each client sends a message and waits for the reply
+template < typename S, wsp::WebSocketService::Type T >
+Result EchoRun(const char* name, int port, int connections, size_t size,
+               const Options& opt) {
+    using WSS = wsp::WebSocketService;
+    WSS ws;
+    ws.Init(port, WSS::ServiceThreads(opt.threads), nullptr, nullptr,
+            wsp::Context<>(), WSS::Entry< S, T >("echo"));
+    Server server(ws);
+    Result r = RunClients(connections,
+        [&](int, vector< double >& latency, size_t& bytes) {
+            wsp::WSClient client;
+            client.Connect(port, "echo");
+            const vector< char > msg(size, 'x');
+            vector< char > reply;
+            latency.reserve(opt.messages);
+            for(int m = 0; m != opt.messages; ++m) {
+                const Clock::time_point t = Clock::now();
+                client.Send(msg.data(), msg.size());
+                if(!client.Receive(reply) || reply.size() != size)
+                    throw runtime_error("Invalid reply");
+                latency.push_back(Micro(Clock::now() - t));
+                bytes += reply.size();
+            }
+            return size_t(opt.messages);
+        });
+    r.scenario = name;
+    r.size = size;
+    return r;
+}
+
+Result StreamRun(int port, int connections, size_t size,
+                 const Options& opt) {
+    using WSS = wsp::WebSocketService;
+    WSS ws;
+    StreamConfig cfg;
+    cfg.size = size;
+    ws.Init(port, WSS::ServiceThreads(opt.threads), nullptr, nullptr,
+            wsp::Context< StreamConfig >(cfg),
+            WSS::Entry< StreamService, WSS::REQ_REP >("stream"));
+    Server server(ws);
+    Result r = RunClients(connections,
+        [&](int, vector< double >& latency, size_t& bytes) {
+            wsp::WSClient client;
+            client.Connect(port, "stream");
+            vector< char > msg;
+            latency.reserve(opt.messages);
+            for(int m = 0; m != opt.messages; ++m) {
+                if(!client.Receive(msg) || msg.size() < sizeof(int64_t))
+                    throw runtime_error("Invalid message");
+                int64_t t = 0;
+                memcpy(&t, msg.data(), sizeof(t));
+                latency.push_back(Micro(Clock::now().time_since_epoch()
+                                        - Clock::duration(t)));
+                bytes += msg.size();
+            }
+            return size_t(opt.messages);
+        });
+    r.scenario = "stream";
+    r.size = size;
+    return r;
+}
+
+Result HttpRun(int port, int connections, size_t size, const Options& opt) {
+    using WSS = wsp::WebSocketService;
+    char path[] = "/tmp/wsp-bench-XXXXXX";
+    const int fd = ::mkstemp(path);
+    if(fd < 0) throw runtime_error("Cannot create file");
+    {
+        const vector< char > data(size, 'x');
+        if(::write(fd, data.data(), data.size()) != ssize_t(data.size())) {
+            ::close(fd);
+            throw runtime_error("Cannot write file");
+        }
+        ::close(fd);
+    }
+    HttpConfig cfg;
+    cfg.filePath = path;
+    Result r;
+    {
+        WSS ws;
+        ws.Init(port, WSS::ServiceThreads(opt.threads), nullptr, nullptr,
+                wsp::Context< HttpConfig >(cfg),
+                WSS::Entry< FileService, WSS::ASYNC_REP >("http-only"));
+        Server server(ws);
+        //a new connection per request: fewer requests than messages
+        const int requests = max(1, opt.messages / 10);
+        r = RunClients(connections,
+            [&](int, vector< double >& latency, size_t& bytes) {
+                latency.reserve(requests);
+                for(int i = 0; i != requests; ++i) {
+                    const Clock::time_point t = Clock::now();
+                    const size_t n = HttpGet(port, "/file");
+                    if(n != size) throw runtime_error("Invalid size");
+                    latency.push_back(Micro(Clock::now() - t));
+                    bytes += n;
+                }
+                return size_t(requests);
+            });
+    }
+    ::unlink(path);
+    r.scenario = "http";
+    r.size = size;
+    return r;
+}
+
+template < typename T >
+vector< T > ParseList(const string& s, const function< T (const string&) >& f) {
+    vector< T > v;
+    istringstream is(s);
+    string item;
+    while(getline(is, item, ',')) if(!item.empty()) v.push_back(f(item));
+    return v;
+}
+
+Options ParseOptions(int argc, char** argv) {
+    Options opt;
+    for(int i = 1; i < argc; ++i) {
+        const string a = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if(a == "--json") opt.json = true;
+        else if(a == "--scenarios" && hasValue)
+            opt.scenarios = ParseList< string >(argv[++i],
+                [](const string& s) { return s; });
+        else if(a == "--sizes" && hasValue)
+            opt.sizes = ParseList< size_t >(argv[++i],
+                [](const string& s) { return size_t(stoul(s)); });
+        else if(a == "--connections" && hasValue)
+            opt.connections = ParseList< int >(argv[++i],
+                [](const string& s) { return stoi(s); });
+        else if(a == "--messages" && hasValue) opt.messages = stoi(argv[++i]);
+        else if(a == "--threads" && hasValue) opt.threads = stoi(argv[++i]);
+        else throw invalid_argument("Invalid argument: " + a);
+    }
+    return opt;
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    try {
+        opt = ParseOptions(argc, argv);
+    } catch(const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    using WSS = wsp::WebSocketService;
+    using Echo = SessionService< wsp::Context<> >;
+    WSS::ResetLogLevels();
+    if(!opt.json)
+        cout << "scenario,connections,size,messages,messages/s,MB/s,"
+                "p50 us,p99 us,p999 us,errors" << endl;
+    int port = 9600;
+    for(const string& s: opt.scenarios) {
+        for(int c: opt.connections) {
+            for(size_t size: opt.sizes) {
+                Result r;
+                try {
+                    if(s == "reqrep")
+                        r = EchoRun< Echo, WSS::REQ_REP >(
+                                "reqrep", port++, c, size, opt);
+                    else if(s == "async")
+                        r = EchoRun< PoolEcho, WSS::ASYNC_POOL >(
+                                "async", port++, c, size, opt);
+                    else if(s == "stream")
+                        r = StreamRun(port++, c, size, opt);
+                    else if(s == "http")
+                        r = HttpRun(port++, c, size, opt);
+                    else {
+                        cerr << "Unknown scenario: " << s << endl;
+                        return 1;
+                    }
+                } catch(const exception& e) {
+                    cerr << s << ": " << e.what() << endl;
+                    continue;
+                }
+                Print(r, opt.json);
+            }
+        }
+    }
+    return 0;
+}
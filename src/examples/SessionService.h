@@ -21,6 +21,9 @@
 #include <vector>
 #include <chrono>
 
+#include "../PaddedBuffer.h"
+#include "../BufferPool.h"
+
 #ifdef BINARY_DATA
 #define BINARY_OPTION true
 #else 
@@ -32,7 +35,9 @@
 /// the class that handles incoming requests and sends back replies.
 /// SessionService instances get created when a WebSocket connection is
 /// established and deleted when the connection terminates.
-/// A single buffer is used to store incoming messages and send responses.
+/// A single buffer is used to store incoming messages and send responses;
+/// it is leased from the context's buffer pool and trimmed before each
+/// new message.
 template < typename ContextT >
 class SessionService {
 public:
@@ -53,6 +58,8 @@ public:
         const char* frameEnd = nullptr;
         /// @c true if data is binary, @c false if it is text
         bool binary = false;
+        /// @c true if binary data is already compressed
+        bool compressed = false;
         /// Default constructor
         DataFrame() = default;
         /// Constructor
@@ -74,8 +81,9 @@ public:
     /// Constructor taking a reference to a Context instance. This constructor
     /// is invoked when a new connection is established through a call to 
     /// a placement new
-    SessionService(Context*, const char* = nullptr)
-        : writeDataFrame_(nullptr, nullptr, nullptr, nullptr, BINARY_OPTION) {
+    SessionService(Context* c, const char* = nullptr)
+        : writeDataFrame_(nullptr, nullptr, nullptr, nullptr, BINARY_OPTION),
+          pool_(&c->GetBufferPool()) {
 
         }
     /// libwebsockets requires the send buffer to be pre and post padded
@@ -83,6 +91,12 @@ public:
     /// this method returns @c true @c false otherwise. In case the buffer is not
     /// pre-formatted WebSocketService takes care of the formatting by
     /// performing an additional copy of the data into another buffer.
+    /// Data sent in place is modified while being written: the frame header
+    /// is built in the padding, which other threads must not be reading or
+    /// writing at the same time. Derived classes sending from the internal
+    /// buffer or from other padded storage owned by the session can
+    /// return @c true; buffers shared among sessions must be copied or
+    /// published through a BROADCAST protocol.
     virtual bool PreformattedBuffer() const { return false; }
    
     /// Returns true if data is ready, false otherwise. In this case Data()
@@ -114,13 +128,11 @@ public:
                                //data packets are received
         if(p == nullptr || len == 0) return;
         if(prevReadCompleted_) {
-            buffer_.resize(0);
+            pool_->Trim(buffer_);
             prevReadCompleted_ = false;
         }
-        const size_t prev = buffer_.size();
-        buffer_.resize(buffer_.size() + len);
+        pool_->Append(buffer_, (const char*) p, len);
         UpdateWriteDataFrame();
-        copy((const char*) p, (const char*) p + len, buffer_.begin() + prev);       
         if(done) {
             prevReadCompleted_ = true;
         }
@@ -168,10 +180,13 @@ private:
 protected:    
     /// virtual destructor, never called through delete since instances of
     /// this class are always created through a placement new call
-    virtual ~SessionService() {}    
+    virtual ~SessionService() {
+        pool_->Release(std::move(buffer_));
+    }    
 private:
-    /// Data buffer, filled in Put() method
-    std::vector< char > buffer_;
+    /// Data buffer, filled in Put() method; padded to allow for sending data
+    /// in place
+    wsp::PaddedBuffer buffer_;
     /// @c false : text data only
     bool binary_ = false;
     /// @c true if data ready
@@ -185,4 +200,6 @@ private:
     bool prevReadCompleted_ = true;
     /// Suggested write chunk size; will be updated in case it is too big.
     int suggestedWriteChunkSize_ = 4096;
+    /// Pool @c buffer_ is leased from
+    wsp::BufferPool* pool_;
 };
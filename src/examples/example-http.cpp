@@ -40,12 +40,14 @@ using namespace std;
 
 
 std::string MapToString(
-    const std::unordered_map< std::string, std::string >& m,
+    const wsp::Request& m,
     const std::string& pre = "",
     const std::string& post = "<br/>") {
     std::ostringstream oss;
-    for(auto& i: m) {
-        oss << pre << i.first << ": " << i.second << post;
+    for(int i = 0; i != wsp::HDR_COUNT; ++i) {
+        const wsp::HeaderField f = wsp::HeaderField(i);
+        if(m.Has(f)) 
+            oss << pre << wsp::Request::Name(f) << ": " << m.Get(f) << post;
     }
     return oss.str();
 }
@@ -74,15 +76,15 @@ public:
     ///@param m request stored as a key-value store
     HttpService(wsp::Context<>* c, const char* req, size_t len,
                 const wsp::Request& m) :
-    df_(nullptr, nullptr, nullptr, nullptr, false), reqHeader_(m) {
+    df_(nullptr, nullptr, nullptr, nullptr, false) {
         request_.resize(len + 1);
         request_.assign(req, req + len);
         request_.push_back('\0');
         const string filePathRoot = GetHomeDir();
-        std::string uri;
-        if(wsp::Has(m, "GET URI")) uri = "GET URI";
-        else if(wsp::Has(m, "POST URI")) uri = "POST URI";
-        if(!uri.empty()) {
+        wsp::HeaderField uri = wsp::HDR_COUNT;
+        if(m.Has(wsp::HDR_GET_URI)) uri = wsp::HDR_GET_URI;
+        else if(m.Has(wsp::HDR_POST_URI)) uri = wsp::HDR_POST_URI;
+        if(uri != wsp::HDR_COUNT) {
             if(!wsp::FileExtension(wsp::Get(m, uri)).empty()) {
                 mimeType_ = wsp::GetMimeType(
                     wsp::FileExtension(wsp::Get(m, uri)));
@@ -169,7 +171,6 @@ private:
     string mimeType_;
     vector< char > request_;
     vector< char > response_;
-    std::unordered_map< string, string > reqHeader_;
     static const char* BODY;
     mutable DataFrame df_;
 };
@@ -182,6 +183,8 @@ int main(int, char**) {
     using WSS = wsp::WebSocketService;
     WSS ws;
     using Service = HttpService;
+    //serve static files from memory, answering 304 when possible
+    ws.CacheFiles();
     //init service
     ws.Init(8001, //port
             nullptr, //SSL certificate path
@@ -41,6 +41,8 @@ public:
     using DataFrame = SessionService::DataFrame;
     StreamService(Context* c, const char* = nullptr) :
             SessionService(c), time_(0x100, 0) {}
+    //time_ is padded and owned by the session
+    bool PreformattedBuffer() const override { return true; }
     bool Data() const { return true; }
     const DataFrame& Get(int requestedChunkLength) {
         using namespace std::chrono;
@@ -64,7 +66,7 @@ public:
         return std::chrono::duration< double >(1);
     }
 private:    
-    std::vector< char > time_;
+    wsp::PaddedBuffer time_; //padded: sent in place
     DataFrame df_;
     std::ostringstream out_;
     std::string tmpstr_;
@@ -50,7 +50,9 @@
 
 #include "../WebSocketService.h"
 #include "../Context.h"
+#include "../LatestValue.h"
 #include "SessionService.h"
+#include "../PaddedBuffer.h"
 
 using namespace std;
 
@@ -70,12 +72,6 @@ const GLenum GL_REAL_T = GL_FLOAT;
 #endif                      
 
 //------------------------------------------------------------------------------
-struct TJDeleter {
-    void operator()(char* p) const {
-        tjFree((unsigned char*) p);
-    }
-};
-
 using ImagePtr = shared_ptr< char >;
 
 struct Image {
@@ -106,8 +102,10 @@ Image ReadImage(tjhandle tj, int width, int height, int quality = 75) {
     cout << E.count() << ' '; //doesn't flush, prints after closing window                    
 #endif    
 
-    char* out = nullptr; 
-    unsigned long size = 0;
+    //compress straight into padded memory, sent in place by the services
+    unsigned long size = tjBufSize(width, height, TJSAMP_444);
+    ImagePtr image = wsp::MakeSharedPadded(size);
+    char* out = image.get();
     tjCompress2(tj,
         (unsigned char*) &img[0],
         width,
@@ -118,9 +116,9 @@ Image ReadImage(tjhandle tj, int width, int height, int quality = 75) {
         &size,
         TJSAMP_444,
         quality,
-        0); 
+        TJFLAG_NOREALLOC); 
        
-    return Image(ImagePtr((char*) out, TJDeleter()), size, count++);
+    return Image(image, size, count++);
 }
 
 //------------------------------------------------------------------------------
@@ -215,9 +213,12 @@ const char vertexShaderSrc[] =
 
 //==============================================================================
 //------------------------------------------------------------------------------
+using ImageSlot = wsp::LatestValue< Image >;
+using ImageContext = wsp::Context< ImageSlot >;
+
 /// Image service: streams a sequence of images
-class ImageService : public SessionService< wsp::Context< Image > > {
-    using Context = wsp::Context< Image >;
+class ImageService : public SessionService< ImageContext > {
+    using Context = ImageContext;
 public:
     using DataFrame = SessionService::DataFrame;
     ImageService(Context* c) :
@@ -225,7 +226,7 @@ public:
         InitDataFrame();
     }
     bool Data() const override { 
-        if(img_.size > 0) return true;
+        if(size_ > 0) return true;
         else {
             InitDataFrame();
             return false;
@@ -256,34 +257,49 @@ public:
         //use 0.0
         return std::chrono::duration< double >(0.001);
     }
+    /// Number of frames skipped because the client was not fast enough
+    uint64_t Dropped() const { return reader_.Dropped(); }
+    ~ImageService() {
+        cout << "Session closed, dropped frames: " << Dropped() << endl;
+    }
 private:
     void InitDataFrame() const {
-        if(ctx_->GetServiceData().id == img_.id) {
+        //single atomic load unless a new frame was published; frames
+        //published since the previous call are skipped and counted
+        if(!reader_.Get(ctx_->GetServiceData(), img_)) {
             if(dontSendIfEqual_) {
-                //do not ever try to delete the memory in the smart pointer:
-                //it is allocated in the main thread and deallocated when
-                //the smart pointer counter reaches zero
-                img_.size = 0;
+                size_ = 0;
                 return;
             }
         }
-        ctx_->GetServiceDataSync(img_);
-        df_.bufferBegin = img_.image.get();
-        df_.bufferEnd = df_.bufferBegin + img_.size;
+        if(!img_) return; //nothing published yet
+        size_ = img_->size;
+        df_.bufferBegin = img_->image.get();
+        df_.bufferEnd = df_.bufferBegin + img_->size;
         df_.frameBegin = df_.bufferBegin;
         df_.frameEnd = df_.frameBegin;
         df_.binary = true;
-    }    
-private:    
+        df_.compressed = true; //JPEG: stored, not deflated again
+    }
+private:
     mutable DataFrame df_;
     mutable Context* ctx_ = nullptr;
-    mutable Image img_;
+    //hold on to the frame being sent: published frames are released when
+    //the last session sending them moves on
+    mutable ImageSlot::Ptr img_;
+    mutable size_t size_ = 0;
+    mutable ImageSlot::Reader reader_;
     bool dontSendIfEqual_ = true;
 };
 
+/// Make image available to all sessions: constant time, independent of the
+/// number of clients
+void Publish(ImageContext& c, Image&& img) {
+    if(img.size > 0) c.GetServiceData().Publish(std::move(img));
+}
 
-//==============================================================================    
-using ImageContext = wsp::Context< Image >;
+
+//==============================================================================
 
 struct UserData {
      GLuint vao;
@@ -512,7 +528,7 @@ int main(int argc, char** argv) {
         glfwGetFramebufferSize(window, &width, &height);      
         Draw(window, data, width, height);
         glfwSwapBuffers(window);
-        data.context->SetServiceDataSync(ReadImage(tj, width, height, 100));
+        Publish(*data.context, ReadImage(tj, width, height, 100));
         ++data.frame;
         const milliseconds E =
                         duration_cast< milliseconds >(steady_clock::now() - t);
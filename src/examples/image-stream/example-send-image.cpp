@@ -34,13 +34,17 @@
 #include <fstream>
 #include <algorithm>
 #include <iterator>
+#include <thread>
 #include "../../WebSocketService.h"
 #include "../../Context.h"
 #include "../SessionService.h"
+#include "../../PaddedBuffer.h"
+#include "../../SharedFrame.h"
 
 using namespace std;
 
-using Image = std::vector< char >;
+//padded: images are moved into broadcast frames without copying
+using Image = wsp::PaddedBuffer;
 
 struct Images {
     std::vector< Image > images;
@@ -82,57 +86,14 @@ struct Images {
 };
 
 //------------------------------------------------------------------------------
-/// Image service: streams a sequence of images
-class ImageService : public SessionService< wsp::Context< Images > > {
-    using Context = wsp::Context< Images >;
+/// Image service: receives the images broadcast by the main thread, all
+/// the sessions share the same frames
+class ImageService : public SessionService< wsp::Context<> > {
+    using Context = wsp::Context<>;
 public:
-    using DataFrame = SessionService::DataFrame;
-    ImageService(Context* c) :
-     SessionService(c), ctx_(c), frameCounter_(0) {
-        InitDataFrame();
-    }
-    bool Data() const override { return true; }
-    //return data frame and update frame end
-    const DataFrame& Get(int requestedChunkLength) {
-        if(df_.frameEnd < df_.bufferEnd) {
-           //frameBegin *MUST* be updated in the UpdateOutBuffer method
-           //because in case the consumed data is less than requestedChunkLength
-           // 
-           //df_.frameBegin = df_.frameEnd;
-           df_.frameEnd += min((ptrdiff_t) requestedChunkLength, 
-                               df_.bufferEnd - df_.frameEnd);
-        } else {
-            frameCounter_ = (frameCounter_ + 1) 
-                            % ctx_->GetServiceData().images.size();  
-            InitDataFrame();
-        }
-        return df_;  
-    }
-    //update frame begin/end
-    void UpdateOutBuffer(int bytesConsumed) {
-        df_.frameBegin += bytesConsumed;
-        df_.frameEnd = df_.frameBegin;
-    }
-    //streaming: always in send mode, no receive
-    bool Sending() const override { return true; }
+    ImageService(Context* c, const char* = nullptr) : SessionService(c) {}
+    //no receive
     void Put(void* p, size_t len, bool done) override {}
-    std::chrono::duration< double > 
-    MinDelayBetweenWrites() const {
-        return std::chrono::duration< double >(0.001);
-    }
-private:
-    void InitDataFrame() {
-        df_.bufferBegin = &(ctx_->GetServiceData().images[frameCounter_][0]);
-        df_.bufferEnd = df_.bufferBegin 
-                        + ctx_->GetServiceData().images[frameCounter_].size();
-        df_.frameBegin = df_.bufferBegin;
-        df_.frameEnd = df_.frameBegin;
-        df_.binary = true;
-    }    
-private:    
-    DataFrame df_;
-    Context* ctx_ = nullptr;
-    unsigned int frameCounter_ = 0;
 };
 
 
@@ -159,18 +120,29 @@ int main(int argc, char** argv) {
     WSS::SetLogger(log, "NOTICE", "WARNING", "ERROR");
     Images images;
     images.Load(stoi(argv[1]), argv[2], stoi(argv[3]), argv[4]);
+    //frame headers are built once, payloads are moved, not copied
+    std::vector< SharedFramePtr > frames;
+    for(auto& i: images.images)
+        frames.push_back(MakeSharedFrame(std::move(i), true));
     //init service
     ws.Init(5000, //port
             nullptr, //SSL certificate path
             nullptr, //SSL key path
-            Context< Images >(images), //context instance,
-                                       //will be copied internally
-            WSS::Entry< ImageService, WSS::ASYNC_REP >("image-stream"));
+            Context<>(), //context instance, will be copied internally
+            WSS::Entry< ImageService, WSS::BROADCAST >("image-stream"));
+    //publish a new image every 10ms to all the connected clients
+    std::thread publisher([&ws, &frames]() {
+        for(size_t i = 0; ; i = (i + 1) % frames.size()) {
+            ws.Broadcast("image-stream", frames[i]);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
     //start event loop: one iteration every >= 50ms
     ws.StartLoop(10, //ms
                  []{return true;} //termination condition (exit on false)
                                   //checked at each iteration, loops forever
                                   //in this case
                  );
+    publisher.join();
     return 0;
 }
@@ -27,7 +27,7 @@ public:
     template < typename FwdT >
     void Buffer(FwdT begin, FwdT end) {
         std::lock_guard< std::mutex > guard(mutex_);
-        while(begin++ != end) queue_.push_back(*begin);
+        while(begin != end) queue_.push_back(*begin++);
         cond_.notify_one();
     }
     T Pop() {
@@ -40,7 +40,7 @@ public:
         return e;
     }
     bool Empty() const {
-        //std::lock_guard< std::mutex > guard(mutex_);
+        std::lock_guard< std::mutex > guard(mutex_);
         return queue_.empty();
     }
 private:
@@ -31,7 +31,8 @@
 #include <WebSocketService.h>
 #include <Context.h>
 #include <DataFrame.h>
-#include "../SyncQueue.h"
+#include <PaddedBuffer.h>
+#include <LockFreeQueue.h>
 #include <functional>
 #include <sstream>
 
@@ -41,6 +42,7 @@
 
 #include <thread>
 #include <future>
+#include <atomic>
 
 #include <chrono>
 #include <ctime>
@@ -63,22 +65,35 @@ public:
            : replyDataFrame_(nullptr, nullptr, nullptr, nullptr,
                              BINARY_OPTION),
              fun_(ctx->GetServiceData().Get(protocol)),
-             stop_(false) {
+             stop_(false),
+             pool_(&ctx->GetBufferPool()) {}
+    //called when the connection is established: start publisher, which
+    //wakes up the session as soon as new data is available
+    void SetSession(const wsp::WebSocketService::Session& s) {
+        session_ = s;
         auto f = [this]() {
+            wsp::PaddedBuffer req;
             while(!this->stop_) {
                 //allow for handling requests to e.g. control the
                 //data stream or request status information
-                if(this->requests_.Empty()) {
-                    this->replies_.Push(this->fun_());
+                if(this->requests_.TryPop(req)) {
+                    //resume reading once the queue has drained
+                    if(--this->queued_ <= MAX_REQUESTS / 2
+                       && this->paused_.exchange(false))
+                        wsp::WebSocketService::ResumeReceive(this->session_);
+                    this->replies_.Push(this->fun_(req, *this->pool_));
+                    this->pool_->Release(std::move(req));
                 } else {
-                    this->replies_.Push(this->fun_(this->requests_.Pop()));
+                    this->replies_.Push(this->fun_(*this->pool_));
                 }
+                wsp::WebSocketService::Wake(this->session_);
                 std::this_thread::sleep_for(std::chrono::seconds(1));
             }
         };
         taskFuture_ = std::async(std::launch::async, f);
     }
-    bool PreformattedBuffer() const { return false; }
+    //replies are stored in padded buffers and sent in place
+    bool PreformattedBuffer() const { return true; }
     bool Data() const {
         //either there is data in reply buffer or there is data
         //in reply queue
@@ -91,24 +106,32 @@ public:
         //end pointer is moved here through Update function
         assert(Data());
         if(reply_.empty()) {
-            reply_ = replies_.Pop();
+            replies_.TryPop(reply_);
             wsp::Init(replyDataFrame_, reply_.data(), reply_.size());
             wsp::Update(replyDataFrame_, requestedChunkLength);
         } else wsp::Update(replyDataFrame_, requestedChunkLength);
         return replyDataFrame_;
     }
-    /// Called when libwebsockets receives data from clients
-    void Put(void* p, size_t len, bool done) {
-        if(p == nullptr || len == 0) return;
-        const size_t prev = requestBuffer_.size();
-        requestBuffer_.resize(requestBuffer_.size() + len);
-        std::copy((const char*) p,
-                  (const char*) p + len, requestBuffer_.data() + prev);
-        //sync execution: data is transformed after read buffer is filled
-        if(done) {
-            requests_.Push(requestBuffer_);
-            requestBuffer_.resize(0);
-        }
+    /// Called with each fragment received from the client: never blocks
+    /// the service thread, reading is paused instead when the worker
+    /// falls behind
+    /// @return @c false to pause reading until the worker resumes it
+    bool OnFragment(const char* p, size_t len, bool) {
+        pool_->Append(requestBuffer_, p, len);
+        //the last slot is kept for the message in progress
+        if(queued_ < MAX_REQUESTS - 1) return true;
+        paused_ = true;
+        //check again in case the worker drained the queue before the
+        //flag was set
+        return queued_ < MAX_REQUESTS - 1 && paused_.exchange(false);
+    }
+    /// Called after the last fragment: hand request over to the worker;
+    /// reading is paused before the queue is full, the push always
+    /// succeeds
+    void OnMessageEnd() {
+        ++queued_;
+        if(!requests_.TryPush(std::move(requestBuffer_))) --queued_;
+        requestBuffer_.clear();
     }
     void SetSuggestedOutChunkSize(int cs) {
         suggestedWriteChunkSize_ = cs;
@@ -116,8 +139,9 @@ public:
     int GetSuggestedOutChunkSize() const {
         return suggestedWriteChunkSize_;
     }
+    //no polling: the publisher calls Wake when data is available
     bool Sending() const {
-        return true;
+        return Data();
     }
     void Destroy() {
         this->~PublishService();
@@ -131,7 +155,7 @@ public:
     void UpdateOutBuffer(size_t bytesConsumed) {
         wsp::Consume(replyDataFrame_, bytesConsumed);
         if(wsp::Consumed(replyDataFrame_)) {
-            reply_.resize(0);
+            pool_->Release(std::move(reply_));
         }
     }
 private:
@@ -140,18 +164,33 @@ private:
     /// and destroyed through a call to Destroy()
     virtual ~PublishService() {
         stop_ = true;
+        requests_.Close(); //unblock worker
+        replies_.Close();
         if(taskFuture_.valid()) taskFuture_.get(); //get() forwards exceptions
+        pool_->Release(std::move(requestBuffer_));
+        pool_->Release(std::move(reply_));
     }
 private:
-    SyncQueue< std::vector< char > > requests_;
-    SyncQueue< std::vector< char > >replies_;
+    //capacity of the request queue
+    static const int MAX_REQUESTS = 1024;
+    //lws thread -> worker
+    wsp::SPSCBlockingQueue< wsp::PaddedBuffer > requests_{MAX_REQUESTS};
+    //requests in the queue
+    std::atomic< int > queued_{0};
+    //@c true if reading is paused
+    std::atomic< bool > paused_{false};
+    //worker -> lws thread
+    wsp::SPSCBlockingQueue< wsp::PaddedBuffer > replies_;
     DataFrame replyDataFrame_;
-    std::vector< char > requestBuffer_; //temporary request storage
+    wsp::PaddedBuffer requestBuffer_; //temporary request storage
     int suggestedWriteChunkSize_ = 4096;
     FunT fun_;
     std::future< void > taskFuture_;
-    bool stop_ = false;
-    std::vector< char > reply_;
+    std::atomic< bool > stop_;
+    wsp::PaddedBuffer reply_;
+    wsp::WebSocketService::Session session_;
+    //request and reply buffers are leased from the context's pool
+    wsp::BufferPool* pool_;
 };
 
 
@@ -162,26 +201,33 @@ private:
 
 using namespace std;
 
-vector< char > Now() {
+wsp::PaddedBuffer Now(wsp::BufferPool& pool) {
     using namespace std::chrono;
     const system_clock::time_point now = system_clock::now();
     ostringstream oss("");
     const std::time_t tt = system_clock::to_time_t(now);
     oss << ctime(&tt);
     const string t = oss.str();
-    return vector< char >(t.begin(), t.end());
+    wsp::PaddedBuffer ret = pool.Acquire(t.size());
+    ret.assign(t.begin(), t.end());
+    return ret;
 }
 
-vector< char > Empty(const vector< char >& ) { return vector< char >(); }
+wsp::PaddedBuffer Empty(const wsp::PaddedBuffer&, wsp::BufferPool&) {
+    return wsp::PaddedBuffer();
+}
 
+//replies are leased from the pool passed as the last argument
 struct Time {
-    function< vector< char > () > pub;
-    function< vector< char > (const vector< char >& ) > req_rep;
-    vector< char > operator()(const vector< char >& req) const {
-        return req_rep(req);
+    function< wsp::PaddedBuffer (wsp::BufferPool&) > pub;
+    function< wsp::PaddedBuffer (const wsp::PaddedBuffer&,
+                                 wsp::BufferPool&) > req_rep;
+    wsp::PaddedBuffer operator()(const wsp::PaddedBuffer& req,
+                                 wsp::BufferPool& pool) const {
+        return req_rep(req, pool);
     }
-    vector< char > operator()() const {
-        return pub();
+    wsp::PaddedBuffer operator()(wsp::BufferPool& pool) const {
+        return pub(pool);
     }
     Time() : pub(Now), req_rep(Empty) {}
 };
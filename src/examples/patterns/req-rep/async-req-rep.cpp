@@ -31,23 +31,25 @@
 #include <WebSocketService.h>
 #include <Context.h>
 #include <DataFrame.h>
-#include "../SyncQueue.h"
+#include <PaddedBuffer.h>
+#include <RequestId.h>
 #include <functional>
 
 #include <cassert>
 #include <vector>
+#include <deque>
 #include <string>
 
-#include <thread>
-#include <future>
-
 
 //==============================================================================
 namespace {
     static const bool BINARY_OPTION = true;
 }
 
-using FunT = std::function< std::vector< char > (const std::vector< char >&) >;
+//request -> reply; replies are leased from the pool passed as the second
+//argument
+using FunT = std::function< wsp::PaddedBuffer (const wsp::PaddedBuffer&,
+                                               wsp::BufferPool&) >;
 
 template < typename ContextT  >
 class FunService {
@@ -60,20 +62,13 @@ public:
            : replyDataFrame_(nullptr, nullptr, nullptr, nullptr,
                              BINARY_OPTION),
              fun_(ctx->GetServiceData().Get(protocol)),
-             stop_(false) {
-        auto f = [this]() {
-            while(!this->stop_) {
-                this->replies_.Push(this->fun_(this->requests_.Pop()));
-            }
-        };
-        taskFuture_ = std::async(std::launch::async, f);
-
-    }
-    bool PreformattedBuffer() const { return false; }
+             pool_(&ctx->GetBufferPool()) {}
+    //replies are stored in padded buffers and sent in place
+    bool PreformattedBuffer() const { return true; }
     bool Data() const {
         //either there is data in reply buffer or there is data
         //in reply queue
-        return !replies_.Empty() || !reply_.empty();
+        return !replies_.empty() || !reply_.empty();
     }
     const DataFrame& Get(int requestedChunkLength) /*const*/ {
         //begin pointer is moved by WebSocketService::Send method through
@@ -82,7 +77,8 @@ public:
         //end pointer is moved here through Update function
         assert(Data());
         if(reply_.empty()) {
-            reply_ = replies_.Pop();
+            reply_ = std::move(replies_.front());
+            replies_.pop_front();
             wsp::Init(replyDataFrame_, reply_.data(), reply_.size());
             wsp::Update(replyDataFrame_, requestedChunkLength);
         } else wsp::Update(replyDataFrame_, requestedChunkLength);
@@ -91,15 +87,21 @@ public:
     /// Called when libwebsockets receives data from clients
     void Put(void* p, size_t len, bool done) {
         if(p == nullptr || len == 0) return;
-        const size_t prev = requestBuffer_.size();
-        requestBuffer_.resize(requestBuffer_.size() + len);
-        std::copy((const char*) p,
-                  (const char*) p + len, requestBuffer_.data() + prev);
-        //sync execution: data is transformed after read buffer is filled
-        if(done) {
-            requests_.Push(requestBuffer_);
-            requestBuffer_.resize(0);
-        }
+        pool_->Append(requestBuffer_, (const char*) p, len);
+    }
+    /// Called after a complete request is received: returns the work
+    /// to execute in the worker pool, which must not reference this
+    /// instance since the session might be closed in the meantime
+    std::function< wsp::PaddedBuffer () > Task() {
+        auto task = std::bind(&FunService::Run, fun_,
+                              std::move(requestBuffer_), pool_);
+        requestBuffer_.clear();
+        return task;
+    }
+    /// Called in the service thread with the result of Task()
+    void Done(wsp::PaddedBuffer&& reply) {
+        if(!reply.empty()) replies_.push_back(std::move(reply));
+        else pool_->Release(std::move(reply));
     }
     void SetSuggestedOutChunkSize(int cs) {
         suggestedWriteChunkSize_ = cs;
@@ -107,8 +109,9 @@ public:
     int GetSuggestedOutChunkSize() const {
         return suggestedWriteChunkSize_;
     }
+    //no polling: a write callback is requested after each Done call
     bool Sending() const {
-        return true;
+        return Data();
     }
     void Destroy() {
         this->~FunService();
@@ -122,31 +125,38 @@ public:
     void UpdateOutBuffer(size_t bytesConsumed) {
         wsp::Consume(replyDataFrame_, bytesConsumed);
         if(wsp::Consumed(replyDataFrame_)) {
-            reply_.resize(0);
+            pool_->Release(std::move(reply_));
         }
     }
-    std::future< void > Stop() {
-        stop_ = true;
-        return taskFuture_.get();
-    }
 private:
     /// destructor, never called through delete since instances of
     /// this class are always created through a placement new call
     /// and destroyed through a call to Destroy()
     virtual ~FunService() {
-        stop_ = true;
-        if(taskFuture_.valid()) taskFuture_.get(); //get() forwards exceptions
+        pool_->Release(std::move(requestBuffer_));
+        pool_->Release(std::move(reply_));
+        for(auto& r: replies_) pool_->Release(std::move(r));
+    }
+    /// Executed by the worker pool: computes the reply and returns the
+    /// request buffer to the pool
+    static wsp::PaddedBuffer Run(const FunT& f,
+                                 wsp::PaddedBuffer& request,
+                                 wsp::BufferPool* pool) {
+        wsp::PaddedBuffer reply = f(request, *pool);
+        pool->Release(std::move(request));
+        return reply;
     }
 private:
-    SyncQueue< std::vector< char > > requests_;
-    SyncQueue< std::vector< char > >replies_;
+    //replies computed by the worker pool, accessed from the service
+    //thread only
+    std::deque< wsp::PaddedBuffer > replies_;
     DataFrame replyDataFrame_;
-    std::vector< char > requestBuffer_; //temporary request storage
+    wsp::PaddedBuffer requestBuffer_; //temporary request storage
     int suggestedWriteChunkSize_ = 4096;
     FunT fun_;
-    std::future< void > taskFuture_;
-    bool stop_ = false;
-    std::vector< char > reply_;
+    wsp::PaddedBuffer reply_;
+    //request and reply buffers are leased from the context's pool
+    wsp::BufferPool* pool_;
 };
 
 
@@ -157,15 +167,33 @@ private:
 ///
 using namespace std;
 
-FunT reverse = [](const vector< char >& v) {
-    vector< char > ret(v.size());
-    copy(v.rbegin(), v.rend(), ret.begin());
+FunT reverse = [](const wsp::PaddedBuffer& v, wsp::BufferPool& pool) {
+    wsp::PaddedBuffer ret = pool.Acquire(v.size());
+    ret.assign(v.rbegin(), v.rend());
     return ret;
 };
-FunT echo = [](const vector< char >& v) {
-    return v;
+FunT echo = [](const wsp::PaddedBuffer& v, wsp::BufferPool& pool) {
+    wsp::PaddedBuffer ret = pool.Acquire(v.size());
+    ret.assign(v.begin(), v.end());
+    return ret;
 };
 
+//concurrent protocols: requests start with an id which is copied in front
+//of the reply, replies are sent in completion order
+FunT Tagged(const FunT& f) {
+    return [f](const wsp::PaddedBuffer& v, wsp::BufferPool& pool) {
+        uint32_t id = 0;
+        if(!wsp::ReadRequestId(v.data(), v.size(), id))
+            return wsp::PaddedBuffer(); //malformed: no reply
+        wsp::PaddedBuffer body = pool.Acquire(v.size());
+        body.assign(v.begin() + wsp::REQUEST_ID_SIZE, v.end());
+        wsp::PaddedBuffer ret = f(body, pool);
+        pool.Release(std::move(body));
+        wsp::TagReply(ret, id);
+        return ret;
+    };
+}
+
 //note template is currently useless since the return type is the same
 //for both reverse and echo
 
@@ -174,12 +202,17 @@ FunT echo = [](const vector< char >& v) {
 //instance is created
 struct Functions {
     Functions(const FunT& r, const FunT& e)
-            : reverse(r), echo(e) {}
+            : reverse(r), echo(e),
+              reverseTagged(Tagged(r)), echoTagged(Tagged(e)) {}
     FunT reverse;
     FunT echo;
+    FunT reverseTagged;
+    FunT echoTagged;
     const FunT& Get(const char* protocol) const {
         if(protocol == string("reverse")) return this->reverse;
         else if(protocol == string("echo")) return this->echo;
+        else if(protocol == string("reverse-id")) return this->reverseTagged;
+        else if(protocol == string("echo-id")) return this->echoTagged;
         else {
             throw std::domain_error("Protocol " + std::string(protocol)
                                     + " not supported");
@@ -202,6 +235,11 @@ int main(int, char**) {
 
     using Service = FunService< Context< Functions > >;
 
+    //threads shared by all the sessions, must be set before Init
+    ws.SetWorkerThreads(4);
+    //counters at http://localhost:9001/metrics
+    ws.MetricsEndpoint();
+
     //init service
     ws.Init(9001, //port
             nullptr, //SSL certificate path
@@ -209,10 +247,16 @@ int main(int, char**) {
             //context instance, will be copied internally
             MakeContext(Functions(::reverse, echo)),
             //protocol->service mapping
-            //sync request-reply: at each request a reply is immediately sent
-            //to the client
-            WSS::Entry< Service, WSS::ASYNC_REP >("reverse", readBufferSize),
-            WSS::Entry< Service, WSS::ASYNC_REP >("echo", readBufferSize)
+            //async request-reply: replies are computed by the worker pool
+            //shared by all the sessions and sent as soon as ready
+            WSS::Entry< Service, WSS::ASYNC_POOL >("reverse", readBufferSize),
+            WSS::Entry< Service, WSS::ASYNC_POOL >("echo", readBufferSize),
+            //up to 256 requests per session processed in parallel
+            WSS::Entry< Service, WSS::ASYNC_POOL >("reverse-id",
+                                                   readBufferSize)
+                .Concurrent(256),
+            WSS::Entry< Service, WSS::ASYNC_POOL >("echo-id", readBufferSize)
+                .Concurrent(256)
 
     );
     //start event loop: one iteration every >= 50ms
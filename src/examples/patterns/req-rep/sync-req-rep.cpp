@@ -31,6 +31,7 @@
 #include <WebSocketService.h>
 #include <Context.h>
 #include <DataFrame.h>
+#include <PaddedBuffer.h>
 #include <deque>
 #include <functional>
 
@@ -44,7 +45,10 @@ namespace {
     static const bool BINARY_OPTION = false;
 }
 
-using FunT = std::function< std::vector< char > (const std::vector< char >&) >;
+//request -> reply; replies are leased from the pool passed as the second
+//argument
+using FunT = std::function< wsp::PaddedBuffer (const wsp::PaddedBuffer&,
+                                               wsp::BufferPool&) >;
 
 template < typename ContextT  >
 class FunService {
@@ -56,10 +60,12 @@ public:
     FunService(Context* ctx, const char* protocol = nullptr)
            : replyDataFrame_(nullptr, nullptr, nullptr, nullptr,
                              BINARY_OPTION),
-             fun_(ctx->GetServiceData().Get(protocol)) {
+             fun_(ctx->GetServiceData().Get(protocol)),
+             pool_(&ctx->GetBufferPool()) {
 
     }
-    bool PreformattedBuffer() const { return false; }
+    //replies are stored in padded buffers and sent in place
+    bool PreformattedBuffer() const { return true; }
     bool Data() const {
         //either there is data in reply buffer or there is data
         //in reply queue
@@ -82,14 +88,11 @@ public:
     /// Called when libwebsockets receives data from clients
     void Put(void* p, size_t len, bool done) {
         if(p == nullptr || len == 0) return;
-        const size_t prev = requestBuffer_.size();
-        requestBuffer_.resize(requestBuffer_.size() + len);
-        std::copy((const char*) p,
-                  (const char*) p + len, requestBuffer_.data() + prev);
+        pool_->Append(requestBuffer_, (const char*) p, len);
         //sync execution: data is transformed after read buffer is filled
         if(done) {
-            replies_.push_back(fun_(requestBuffer_));
-            requestBuffer_.resize(0);
+            replies_.push_back(fun_(requestBuffer_, *pool_));
+            pool_->Trim(requestBuffer_);
         }
     }
     void SetSuggestedOutChunkSize(int cs) {
@@ -113,21 +116,27 @@ public:
     void UpdateOutBuffer(size_t bytesConsumed) {
         wsp::Consume(replyDataFrame_, bytesConsumed);
         if(wsp::Consumed(replyDataFrame_)) {
-            reply_.resize(0);
+            pool_->Release(std::move(reply_));
         }
     }
 private:
     /// destructor, never called through delete since instances of
     /// this class are always created through a placement new call
     /// and destroyed through a call to Destroy()
-    virtual ~FunService() {}
+    virtual ~FunService() {
+        pool_->Release(std::move(requestBuffer_));
+        pool_->Release(std::move(reply_));
+        for(auto& r: replies_) pool_->Release(std::move(r));
+    }
 private:
-    std::deque< std::vector< char > > replies_;
+    std::deque< wsp::PaddedBuffer > replies_;
     DataFrame replyDataFrame_;
-    std::vector< char > requestBuffer_; //temporary request storage
+    wsp::PaddedBuffer requestBuffer_; //temporary request storage
     int suggestedWriteChunkSize_ = 4096;
     FunT fun_;
-    std::vector< char > reply_;
+    wsp::PaddedBuffer reply_;
+    //request and reply buffers are leased from the context's pool
+    wsp::BufferPool* pool_;
 };
 
 
@@ -138,13 +147,15 @@ private:
 ///
 using namespace std;
 
-FunT reverse = [](const vector< char >& v) {
-    vector< char > ret(v.size());
-    copy(v.rbegin(), v.rend(), ret.begin());
+FunT reverse = [](const wsp::PaddedBuffer& v, wsp::BufferPool& pool) {
+    wsp::PaddedBuffer ret = pool.Acquire(v.size());
+    ret.assign(v.rbegin(), v.rend());
     return ret;
 };
-FunT echo = [](const vector< char >& v) {
-    return v;
+FunT echo = [](const wsp::PaddedBuffer& v, wsp::BufferPool& pool) {
+    wsp::PaddedBuffer ret = pool.Acquire(v.size());
+    ret.assign(v.begin(), v.end());
+    return ret;
 };
 
 //note template is currently useless since the return type is the same
@@ -182,6 +193,10 @@ int main(int, char**) {
     const int readBufferSize = 4096; //the default anyway
 
     using Service = FunService< Context< Functions > >;
+    //text replies: compress with permessage-deflate when offered by client,
+    //small replies are not worth it
+    WSS::Deflate deflate;
+    deflate.minSize = 128;
 
     //init service
     ws.Init(9001, //port
@@ -192,8 +207,10 @@ int main(int, char**) {
             //protocol->service mapping
             //sync request-reply: at each request a reply is immediately sent
             //to the client
-            WSS::Entry< Service, WSS::REQ_REP >("reverse", readBufferSize),
+            WSS::Entry< Service, WSS::REQ_REP >("reverse", readBufferSize)
+                .Compress(deflate),
             WSS::Entry< Service, WSS::REQ_REP >("echo", readBufferSize)
+                .Compress(deflate)
 
     );
     //start event loop: one iteration every >= 50ms
@@ -31,17 +31,15 @@
 #include <WebSocketService.h>
 #include <Context.h>
 #include <DataFrame.h>
-#include "../SyncQueue.h"
+#include <PaddedBuffer.h>
 #include <functional>
 #include <sstream>
 
 #include <cassert>
 #include <vector>
+#include <deque>
 #include <string>
 
-#include <thread>
-#include <future>
-
 #include <chrono>
 #include <ctime>
 
@@ -63,22 +61,13 @@ public:
            : replyDataFrame_(nullptr, nullptr, nullptr, nullptr,
                              BINARY_OPTION),
              fun_(ctx->GetServiceData().Get(protocol)),
-             stop_(false) {
-        auto f = [this]() {
-            while(!this->stop_) {
-                const std::vector< char > req = requests_.Pop();
-                const std::vector< char > res
-                    = this->fun_(req);
-                if(!res.empty()) this->replies_.Push(res);
-            }
-        };
-        taskFuture_ = std::async(std::launch::async, f);
-    }
-    bool PreformattedBuffer() const { return false; }
+             pool_(&ctx->GetBufferPool()) {}
+    //replies are stored in padded buffers and sent in place
+    bool PreformattedBuffer() const { return true; }
     bool Data() const {
         //either there is data in reply buffer or there is data
         //in reply queue
-        return !replies_.Empty() || !reply_.empty();
+        return !replies_.empty() || !reply_.empty();
     }
     const DataFrame& Get(int requestedChunkLength) /*const*/ {
         //begin pointer is moved by WebSocketService::Send method through
@@ -87,7 +76,8 @@ public:
         //end pointer is moved here through Update function
         assert(Data());
         if(reply_.empty()) {
-            reply_ = replies_.Pop();
+            reply_ = std::move(replies_.front());
+            replies_.pop_front();
             wsp::Init(replyDataFrame_, reply_.data(), reply_.size());
             wsp::Update(replyDataFrame_, requestedChunkLength);
         } else wsp::Update(replyDataFrame_, requestedChunkLength);
@@ -96,15 +86,20 @@ public:
     /// Called when libwebsockets receives data from clients
     void Put(void* p, size_t len, bool done) {
         if(p == nullptr || len == 0) return;
-        const size_t prev = requestBuffer_.size();
-        requestBuffer_.resize(requestBuffer_.size() + len);
-        std::copy((const char*) p,
-                  (const char*) p + len, requestBuffer_.data() + prev);
-        //sync execution: data is transformed after read buffer is filled
-        if(done) {
-            requests_.Push(requestBuffer_);
-            requestBuffer_.resize(0);
-        }
+        pool_->Append(requestBuffer_, (const char*) p, len);
+    }
+    /// Called after a complete request is received: returns the work
+    /// to execute in the worker pool
+    std::function< wsp::PaddedBuffer () > Task() {
+        auto task = std::bind(&SubscriptionService::Run, fun_,
+                              std::move(requestBuffer_), pool_);
+        requestBuffer_.clear();
+        return task;
+    }
+    /// Called in the service thread with the result of Task()
+    void Done(wsp::PaddedBuffer&& reply) {
+        if(!reply.empty()) replies_.push_back(std::move(reply));
+        else pool_->Release(std::move(reply));
     }
     void SetSuggestedOutChunkSize(int cs) {
         suggestedWriteChunkSize_ = cs;
@@ -127,7 +122,7 @@ public:
     void UpdateOutBuffer(size_t bytesConsumed) {
         wsp::Consume(replyDataFrame_, bytesConsumed);
         if(wsp::Consumed(replyDataFrame_)) {
-            reply_.resize(0);
+            pool_->Release(std::move(reply_));
         }
     }
 private:
@@ -135,19 +130,30 @@ private:
     /// this class are always created through a placement new call
     /// and destroyed through a call to Destroy()
     virtual ~SubscriptionService() {
-        stop_ = true;
-        if(taskFuture_.valid()) taskFuture_.get(); //get() forwards exceptions
+        pool_->Release(std::move(requestBuffer_));
+        pool_->Release(std::move(reply_));
+        for(auto& r: replies_) pool_->Release(std::move(r));
+    }
+    /// Executed by the worker pool: computes the reply and returns the
+    /// request buffer to the pool
+    static wsp::PaddedBuffer Run(const FunT& f,
+                                 wsp::PaddedBuffer& request,
+                                 wsp::BufferPool* pool) {
+        wsp::PaddedBuffer reply = f(request, *pool);
+        pool->Release(std::move(request));
+        return reply;
     }
 private:
-    SyncQueue< std::vector< char > > requests_;
-    SyncQueue< std::vector< char > >replies_;
+    //replies computed by the worker pool, accessed from the service
+    //thread only
+    std::deque< wsp::PaddedBuffer > replies_;
     DataFrame replyDataFrame_;
-    std::vector< char > requestBuffer_; //temporary request storage
+    wsp::PaddedBuffer requestBuffer_; //temporary request storage
     int suggestedWriteChunkSize_ = 4096;
     FunT fun_;
-    std::future< void > taskFuture_;
-    bool stop_ = false;
-    std::vector< char > reply_;
+    wsp::PaddedBuffer reply_;
+    //request and reply buffers are leased from the context's pool
+    wsp::BufferPool* pool_;
 };
 
 
@@ -159,7 +165,10 @@ private:
 using namespace std;
 
 
-using Print = function< vector< char > (const vector< char >&) >;
+//message -> reply; replies are leased from the pool passed as the second
+//argument
+using Print = function< wsp::PaddedBuffer (const wsp::PaddedBuffer&,
+                                           wsp::BufferPool&) >;
 
 //note: template is currently useless since the return type is the same
 //for both reverse and echo
@@ -202,14 +211,15 @@ int main(int, char**) {
             nullptr, //SSL certificate path
             nullptr, //SSL key path
             //context instance, will be copied internally
-            MakeContext(Functions([](const vector< char >& msg) {
+            MakeContext(Functions([](const wsp::PaddedBuffer& msg,
+                                     wsp::BufferPool&) {
                 cout << string(begin(msg), end(msg)) << endl;
-                return vector< char >();
+                return wsp::PaddedBuffer();
             })),
             //protocol->service mapping
-            //sync request-reply: at each request a reply is immediately sent
-            //to the client
-            WSS::Entry< Service, WSS::REQ_REP >("recv", readBufferSize)
+            //messages are processed by the worker pool shared by all
+            //the sessions
+            WSS::Entry< Service, WSS::ASYNC_POOL >("recv", readBufferSize)
 
     );
     //start event loop: one iteration every >= 50ms
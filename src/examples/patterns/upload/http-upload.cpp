@@ -0,0 +1,175 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+//clang++ -std=c++11 -I ../src -I /usr/local/libwebsockets/include  \
+//../src/examples/patterns/upload/http-upload.cpp ../src/WebSocketService.cpp \
+//../src/http.cpp ../src/mimetypes.cpp ../src/FileCache.cpp \
+//-L /usr/local/libwebsockets/lib -lwebsockets -lz -pthread
+
+//Streaming HTTP upload: the body of each POST request is written to a file
+//by a BodyWriter thread as it arrives, in constant memory regardless of
+//the size of the upload. Reading from the connection is paused when the
+//disk falls behind and resumed when it catches up; bodies larger than
+//4 GiB are rejected with 413 before being read. The response is sent
+//once the writer has flushed the body, without blocking the service
+//thread while it does.
+//
+//    curl -T big.iso -X POST http://localhost:8002/
+#include <iostream>
+#include <WebSocketService.h>
+#include <Context.h>
+#include <DataFrame.h>
+#include <BodyWriter.h>
+#include <http.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+//==============================================================================
+class HttpUploadService {
+public:
+    using HTTP = int; //mark as http service
+    using DataFrame = wsp::DataFrame;
+    HttpUploadService(wsp::Context<>* c, const char*, size_t,
+                      const wsp::Request& m)
+        : df_(nullptr, nullptr, nullptr, nullptr, false),
+          size_(wsp::GetContentSize(m)),
+          pool_(&c->GetBufferPool()) {
+        Compose("POST a file to upload it\n");
+    }
+    //called before the first chunk of a POST body: open file, start writer
+    void SetSession(const wsp::WebSocketService::Session& s) {
+        session_ = s;
+        posting_ = true;
+        path_ = "upload-" + std::to_string(s.id);
+        fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                     0644);
+        if(fd_ < 0) return;
+        writer_.reset(new wsp::BodyWriter(*pool_,
+            wsp::BodyWriter::FileDescriptor(fd_),
+            [s]() { wsp::WebSocketService::ResumeReceive(s); }));
+    }
+    //pause reading when the writer falls behind
+    bool OnBody(const char* p, size_t len) {
+        return !writer_ || writer_->Write(p, len);
+    }
+    //answer after the writer has caught up: zero defers the response
+    //until Wake is called from the writer thread
+    int OnBodyEnd() {
+        if(!writer_) return HTTP_STATUS_INTERNAL_SERVER_ERROR;
+        const wsp::WebSocketService::Session s = session_;
+        writer_->Finish([this, s](bool ok) {
+            ok_ = ok;
+            flushed_ = true;
+            wsp::WebSocketService::Wake(s);
+        });
+        return 0;
+    }
+    bool Valid() const { return true; }
+    const DataFrame& Get(int requestedChunkLength) {
+        if(posting_) {
+            posting_ = false;
+            const std::string r = std::to_string(writer_->Written()) + " of "
+                                  + std::to_string(size_)
+                                  + " bytes written to " + path_ + "\n";
+            std::cout << r;
+            Compose(ok_ ? r : "write error\n",
+                    ok_ ? "200 OK" : "500 Internal Server Error");
+        }
+        sending_ = df_.frameEnd < df_.bufferEnd;
+        df_.frameEnd += std::min(ptrdiff_t(requestedChunkLength),
+                                 df_.bufferEnd - df_.frameEnd);
+        return df_;
+    }
+    bool Sending() const { return sending_; }
+    void UpdateOutBuffer(int bytesConsumed) {
+        df_.frameBegin += bytesConsumed;
+        df_.frameEnd = df_.frameBegin;
+    }
+    //POST: nothing to send until the body has been written
+    bool Data() const { return !posting_ || flushed_; }
+    int GetSuggestedOutChunkSize() const { return 0x1000; }
+    const std::string& FilePath() const { return none_; }
+    const std::string& FileMimeType() const { return none_; }
+    //also called without OnBodyEnd if the client disconnects
+    void Destroy() {
+        this->~HttpUploadService();
+    }
+private:
+    ~HttpUploadService() {
+        writer_.reset();
+        if(fd_ >= 0) ::close(fd_);
+    }
+    void Compose(const std::string& text,
+                 const std::string& status = "200 OK") {
+        const std::string r = "HTTP/1.0 " + status + "\r\n"
+                              "Content-Type: text/plain\r\n"
+                              "Content-Length: "
+                              + std::to_string(text.size()) + "\r\n\r\n"
+                              + text;
+        response_.assign(r.begin(), r.end());
+        df_.bufferBegin = response_.data();
+        df_.bufferEnd = response_.data() + response_.size();
+        df_.frameBegin = df_.frameEnd = df_.bufferBegin;
+    }
+private:
+    DataFrame df_;
+    std::vector< char > response_;
+    bool sending_ = true;
+    std::int64_t size_;
+    std::string path_;
+    std::string none_;
+    int fd_ = -1;
+    //chunks are leased from the context's pool
+    wsp::BufferPool* pool_;
+    wsp::WebSocketService::Session session_;
+    //POST request whose response has not been composed yet
+    bool posting_ = false;
+    //set by the writer thread
+    std::atomic< bool > flushed_{false};
+    std::atomic< bool > ok_{false};
+    std::unique_ptr< wsp::BodyWriter > writer_;
+};
+
+
+//==============================================================================
+int main(int, char**) {
+    using WSS = wsp::WebSocketService;
+    WSS ws;
+    //limits the Content-Length of POST requests
+    const std::size_t MAX_UPLOAD_SIZE = std::size_t(4) << 30;
+    ws.Init(8002, //port
+            nullptr, //SSL certificate path
+            nullptr, //SSL key path
+            wsp::Context<>(), //context instance, will be copied internally
+            WSS::Entry< HttpUploadService, WSS::ASYNC_REP >("http-only")
+                .MaxMessage(MAX_UPLOAD_SIZE));
+    //start event loop: one iteration every >= 50ms
+    ws.StartLoop(50, //ms
+                 []{return true;} //continuation condition (exit on false)
+                                  //checked at each iteration, loops forever
+                                  //in this case
+                 );
+    return 0;
+}
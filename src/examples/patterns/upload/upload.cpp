@@ -0,0 +1,188 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//clang++ -std=c++11 -I ../src -I /usr/local/libwebsockets/include  \
+//../src/examples/patterns/upload/upload.cpp ../src/WebSocketService.cpp \
+//-L /usr/local/libwebsockets/lib -lwebsockets -pthread
+
+//Streaming receive: each message is an upload written to a file by a
+//worker thread as fragments arrive, memory is bounded by the amount of
+//data queued for the writer regardless of the size of the upload.
+//Reading from the connection is paused when the writer falls behind and
+//resumed when it catches up; a text reply with the number of bytes
+//written is sent after each upload
+#include <iostream>
+#include <WebSocketService.h>
+#include <Context.h>
+#include <DataFrame.h>
+#include <PaddedBuffer.h>
+#include <BufferPool.h>
+#include <BodyWriter.h>
+#include <LockFreeQueue.h>
+
+#include <cassert>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+
+//==============================================================================
+template < typename ContextT  >
+class UploadService {
+public:
+    using Context = ContextT;
+    using DataFrame = wsp::DataFrame;
+public:
+    UploadService() = delete;
+    UploadService(Context* ctx, const char* = nullptr)
+           : replyDataFrame_(nullptr, nullptr, nullptr, nullptr, false),
+             replies_(16),
+             pool_(&ctx->GetBufferPool()) {}
+    //called when the connection is established: start writer, which
+    //pauses and resumes reading as the disk falls behind and catches up
+    void SetSession(const wsp::WebSocketService::Session& s) {
+        session_ = s;
+        writer_.reset(new wsp::BodyWriter(*pool_,
+            [this](const char* p, std::size_t n) { return Store(p, n); },
+            [s]() { wsp::WebSocketService::ResumeReceive(s); }));
+    }
+    /// Called with each fragment as it arrives: hand it over to the writer
+    bool OnFragment(const char* p, size_t len, bool) {
+        return !writer_ || writer_->Write(p, len);
+    }
+    /// Called after the last fragment: the writer receives an empty chunk
+    /// marking the end of the upload
+    void OnMessageEnd() {
+        if(writer_) writer_->End();
+    }
+    bool PreformattedBuffer() const { return true; }
+    bool Data() const {
+        return !replies_.Empty() || !reply_.empty();
+    }
+    const DataFrame& Get(int requestedChunkLength) {
+        assert(Data());
+        if(reply_.empty()) {
+            replies_.TryPop(reply_);
+            wsp::Init(replyDataFrame_, reply_.data(), reply_.size());
+        }
+        wsp::Update(replyDataFrame_, requestedChunkLength);
+        return replyDataFrame_;
+    }
+    void SetSuggestedOutChunkSize(int cs) {
+        suggestedWriteChunkSize_ = cs;
+    }
+    int GetSuggestedOutChunkSize() const {
+        return suggestedWriteChunkSize_;
+    }
+    //no polling: the writer calls Wake when a reply is available
+    bool Sending() const {
+        return Data();
+    }
+    void Destroy() {
+        this->~UploadService();
+    }
+    std::chrono::duration< double >
+    MinDelayBetweenWrites() const {
+        return std::chrono::duration< double >(0);
+    }
+    void UpdateOutBuffer(size_t bytesConsumed) {
+        wsp::Consume(replyDataFrame_, bytesConsumed);
+        if(wsp::Consumed(replyDataFrame_)) {
+            pool_->Release(std::move(reply_));
+        }
+    }
+private:
+    virtual ~UploadService() {
+        //replies are no longer consumed: do not let the writer wait for
+        //space in the queue
+        replies_.Close();
+        writer_.reset();
+        if(file_) std::fclose(file_);
+        pool_->Release(std::move(reply_));
+    }
+    //writer thread: append chunks to the current file, one file per
+    //upload; an empty chunk marks the end of the upload
+    bool Store(const char* p, std::size_t n) {
+        if(!started_) {
+            path_ = "upload-" + std::to_string(session_.id) + "-"
+                    + std::to_string(uploads_++);
+            file_ = std::fopen(path_.c_str(), "wb");
+            written_ = 0;
+            started_ = true;
+        }
+        if(n) {
+            if(file_) written_ += std::fwrite(p, 1, n, file_);
+            return true;
+        }
+        if(file_) std::fclose(file_);
+        file_ = nullptr;
+        started_ = false;
+        const std::string r = std::to_string(written_)
+                              + " bytes written to " + path_;
+        wsp::PaddedBuffer reply = pool_->Acquire(r.size());
+        reply.assign(r.begin(), r.end());
+        if(replies_.Push(std::move(reply)))
+            wsp::WebSocketService::Wake(session_);
+        return true;
+    }
+private:
+    DataFrame replyDataFrame_;
+    //writer -> service thread
+    wsp::SPSCBlockingQueue< wsp::PaddedBuffer > replies_;
+    wsp::PaddedBuffer reply_;
+    int suggestedWriteChunkSize_ = 4096;
+    wsp::BufferPool* pool_;
+    wsp::WebSocketService::Session session_;
+    //writer thread only
+    std::FILE* file_ = nullptr;
+    bool started_ = false;
+    std::size_t written_ = 0;
+    std::string path_;
+    int uploads_ = 0;
+    std::unique_ptr< wsp::BodyWriter > writer_;
+};
+
+
+//==============================================================================
+int main(int, char**) {
+    using namespace wsp;
+    using WSS = WebSocketService;
+    WSS ws;
+    WSS::ResetLogLevels(); // clear all loggers
+    auto log = [](int level, const char* msg) {
+        std::cout << WSS::Level(level) << "> " << msg << std::endl;
+    };
+    WSS::SetLogger(log, "NOTICE", "WARNING", "ERROR");
+    const int readBufferSize = 1 << 16;
+
+    using Service = UploadService< Context<> >;
+
+    ws.Init(9004, //port
+            nullptr, //SSL certificate path
+            nullptr, //SSL key path
+            //context instance, will be copied internally
+            Context<>(),
+            //protocol->service mapping
+            WSS::Entry< Service, WSS::ASYNC_REP >("upload", readBufferSize)
+    );
+    //start event loop: one iteration every >= 50ms
+    ws.StartLoop(50, //ms
+                 []{return true;} //continuation condition (exit on false)
+                                  //checked at each iteration, loops forever
+                                  //in this case
+                 );
+    return 0;
+}
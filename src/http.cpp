@@ -22,13 +22,19 @@
 #include <chrono>
 #include <ctime>
 #include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+#include <strings.h>
 
 #include <libwebsockets.h>
 
 #include "http.h"
 
 namespace wsp {
-Request ParseHttpHeader(lws *wsi) {
+const char* Request::Name(HeaderField f) {
     //copied from test-server.c part of libwebsockets distribution.
     static const char *tokenNames[] = {
         /*[WSI_TOKEN_GET_URI]       =*/ "GET URI",
@@ -57,6 +63,7 @@ Request ParseHttpHeader(lws *wsi) {
         /*[WSI_TOKEN_HTTP]      =*/ "Http",
         "Accept:",
         "If-Modified-Since:",
+        "If-None-Match:",
         "Accept-Encoding:",
         "Accept-Language:",
         "Pragma:",
@@ -69,16 +76,70 @@ Request ParseHttpHeader(lws *wsi) {
         "Range:",
         "Referer:",
         "Uri-Args:",
-        /*[WSI_TOKEN_MUXURL]    =*/ "MuxURL",
     };
-    std::vector< char > buf(0x400);
-    Request hm;
-    for (int n = 0; n < sizeof(tokenNames) / sizeof(tokenNames[0]); ++n) {
-        if(!lws_hdr_total_length(wsi, lws_token_indexes(n))) continue;         
-        lws_hdr_copy(wsi, &buf[0], buf.size(), lws_token_indexes(n));
-        hm[tokenNames[n]] = &buf[0];
-    }
-    return hm;
+    static_assert(sizeof(tokenNames) / sizeof(tokenNames[0]) == HDR_COUNT,
+                  "Header field names and HeaderField out of sync");
+    return f >= 0 && f < HDR_COUNT ? tokenNames[f] : "";
+}
+
+HeaderField Request::Field(const char* name) {
+    for(int f = 0; f != HDR_COUNT; ++f)
+        if(!std::strcmp(name, Name(HeaderField(f)))) return HeaderField(f);
+    return HDR_COUNT;
+}
+
+int HeaderToken(HeaderField f) {
+    //token values differ among libwebsockets versions: never cast a
+    //HeaderField to lws_token_indexes
+    static const lws_token_indexes tokens[] = {
+        WSI_TOKEN_GET_URI,
+        WSI_TOKEN_POST_URI,
+        WSI_TOKEN_HOST,
+        WSI_TOKEN_CONNECTION,
+        WSI_TOKEN_KEY1,
+        WSI_TOKEN_KEY2,
+        WSI_TOKEN_PROTOCOL,
+        WSI_TOKEN_UPGRADE,
+        WSI_TOKEN_ORIGIN,
+        WSI_TOKEN_DRAFT,
+        WSI_TOKEN_CHALLENGE,
+        WSI_TOKEN_KEY,
+        WSI_TOKEN_VERSION,
+        WSI_TOKEN_SWORIGIN,
+        WSI_TOKEN_EXTENSIONS,
+        WSI_TOKEN_ACCEPT,
+        WSI_TOKEN_NONCE,
+        WSI_TOKEN_HTTP,
+        WSI_TOKEN_HTTP_ACCEPT,
+        WSI_TOKEN_HTTP_IF_MODIFIED_SINCE,
+        WSI_TOKEN_HTTP_IF_NONE_MATCH,
+        WSI_TOKEN_HTTP_ACCEPT_ENCODING,
+        WSI_TOKEN_HTTP_ACCEPT_LANGUAGE,
+        WSI_TOKEN_HTTP_PRAGMA,
+        WSI_TOKEN_HTTP_CACHE_CONTROL,
+        WSI_TOKEN_HTTP_AUTHORIZATION,
+        WSI_TOKEN_HTTP_COOKIE,
+        WSI_TOKEN_HTTP_CONTENT_LENGTH,
+        WSI_TOKEN_HTTP_CONTENT_TYPE,
+        WSI_TOKEN_HTTP_DATE,
+        WSI_TOKEN_HTTP_RANGE,
+        WSI_TOKEN_HTTP_REFERER,
+        WSI_TOKEN_HTTP_URI_ARGS,
+    };
+    static_assert(sizeof(tokens) / sizeof(tokens[0]) == HDR_COUNT,
+                  "Header field tokens and HeaderField out of sync");
+    return tokens[f];
+}
+
+void ParseHttpHeader(lws* wsi, Request& req) {
+    req.Parse([wsi](int f) {
+                  return lws_hdr_total_length(wsi, lws_token_indexes(
+                      HeaderToken(HeaderField(f))));
+              },
+              [wsi](int f, char* buf, int n) {
+                  return lws_hdr_copy(wsi, buf, n, lws_token_indexes(
+                      HeaderToken(HeaderField(f))));
+              });
 }
 
 
@@ -111,28 +172,41 @@ URIParameters UriParameters(const std::string& p) {
     return m;
 }
 
-std::string FileExtension(const std::string& p) {
-    const size_t d = p.find('.');
-    if(d == std::string::npos) return "";
-    return std::string(p, d + 1, std::string::npos);    
+StringView FileExtension(StringView p) {
+    const char* segment = p.end();
+    while(segment != p.begin() && segment[-1] != '/') --segment;
+    const char* d = p.end();
+    while(d != segment && d[-1] != '.') --d;
+    //no '.' or hidden file without extension
+    if(d == segment || d - 1 == segment) return StringView();
+    return StringView(d, p.end() - d);
 }
 
 bool Has(const Request& req, const std::string& k) {
-    if(req.find(k) == req.end()) return false;
-    return true;
+    const HeaderField f = Request::Field(k.c_str());
+    return f != HDR_COUNT && req.Has(f);
+}
+
+const char* Get(const Request& req, const std::string& k) {
+    const HeaderField f = Request::Field(k.c_str());
+    return f != HDR_COUNT ? req.Get(f) : "";
 }
 
-const std::string& Get(const Request& req, const std::string& k) {
-    static const std::string emptyString;
-    if(!Has(req, k)) return emptyString;
-    return req.find(k)->second;
+std::int64_t GetContentSize(const Request& req) {
+    if(!req.Has(HDR_CONTENT_LENGTH)) return -1;
+    return ParseContentLength(req.Get(HDR_CONTENT_LENGTH));
 }
 
-int GetContentSize(const Request& req) {
-    if(!Has(req, "Content-Length:")) return -1;
-    const std::string l = Get(req, "Content-Length:");
-    if(l.empty()) return -1;
-    return std::stoi(l);
+std::int64_t ParseContentLength(const char* p) {
+    while(*p == ' ' || *p == '\t') ++p;
+    if(*p < '0' || *p > '9') return -1;
+    std::int64_t size = 0;
+    for(; *p >= '0' && *p <= '9'; ++p) {
+        if(size > (INT64_MAX - (*p - '0')) / 10) return -1; //overflow
+        size = size * 10 + (*p - '0');
+    }
+    while(*p == ' ' || *p == '\t') ++p;
+    return *p ? -1 : size;
 }
 
 //note: when name=made_write_conn cookie lasts until the browser is closed
@@ -164,5 +238,183 @@ std::string CreateTime(int h, int m, int s) {
     return ctime(&t);
 }
 
+namespace {
+//parse decimal number, @c false if no digits or overflow
+bool ParseNumber(const char*& p, std::uint64_t& n) {
+    const char* b = p;
+    n = 0;
+    for(; *p >= '0' && *p <= '9'; ++p) {
+        if(n > (UINT64_MAX - 9) / 10) return false;
+        n = 10 * n + std::uint64_t(*p - '0');
+    }
+    return p != b;
+}
+
+void SkipSpaces(const char*& p) {
+    while(*p == ' ' || *p == '\t') ++p;
+}
 
-}
\ No newline at end of file
+//invalid Range headers are ignored, RFC 7233 section 3.1
+RangeStatus Ignore(ByteRanges& ranges) {
+    ranges.clear();
+    return RANGE_NONE;
+}
+
+const char* BOUNDARY = "wsp-byteranges-c0a3e9f1";
+}
+
+RangeStatus ParseRange(const char* p, std::uint64_t size,
+                       ByteRanges& ranges) {
+    ranges.clear();
+    if(!p) return RANGE_NONE;
+    SkipSpaces(p);
+    if(std::strncmp(p, "bytes=", 6)) return RANGE_NONE;
+    p += 6;
+    std::size_t count = 0;
+    while(true) {
+        SkipSpaces(p);
+        std::uint64_t first = 0;
+        std::uint64_t last = 0;
+        if(*p == '-') {
+            //suffix: last n bytes
+            ++p;
+            std::uint64_t n = 0;
+            if(!ParseNumber(p, n)) return Ignore(ranges);
+            if(n > 0 && size > 0) {
+                first = n < size ? size - n : 0;
+                ranges.push_back({first, size - 1});
+            }
+        } else {
+            if(!ParseNumber(p, first) || *p != '-') return Ignore(ranges);
+            ++p;
+            const bool open = !ParseNumber(p, last);
+            if(!open && last < first) return Ignore(ranges);
+            if(first < size)
+                ranges.push_back({first, open || last >= size ? size - 1
+                                                               : last});
+        }
+        if(++count > MAX_RANGES) return Ignore(ranges);
+        SkipSpaces(p);
+        if(*p == '\0') break;
+        if(*p++ != ',') return Ignore(ranges);
+    }
+    if(ranges.empty()) return RANGE_UNSATISFIABLE;
+    std::sort(ranges.begin(), ranges.end(),
+              [](const ByteRange& a, const ByteRange& b) {
+                  return a.first < b.first;
+              });
+    std::size_t n = 0;
+    for(std::size_t i = 1; i != ranges.size(); ++i) {
+        if(ranges[i].first <= ranges[n].last + 1)
+            ranges[n].last = std::max(ranges[n].last, ranges[i].last);
+        else ranges[++n] = ranges[i];
+    }
+    ranges.resize(n + 1);
+    return RANGE_PARTIAL;
+}
+
+std::vector< ResponsePart > PartialContent(const ByteRanges& ranges,
+                                           std::uint64_t size,
+                                           const std::string& mimeType,
+                                           const std::string& headers) {
+    std::vector< ResponsePart > parts(1);
+    std::string header = "HTTP/1.1 206 Partial Content\r\n";
+    if(ranges.size() == 1) {
+        const ByteRange& r = ranges[0];
+        if(!mimeType.empty()) header += "Content-Type: " + mimeType + "\r\n";
+        header += "Content-Range: bytes " + std::to_string(r.first) + "-"
+                  + std::to_string(r.last) + "/" + std::to_string(size)
+                  + "\r\nContent-Length: " + std::to_string(r.Size())
+                  + "\r\n" + headers + "\r\n";
+        parts[0].text = header;
+        ResponsePart p;
+        p.offset = r.first;
+        p.size = r.Size();
+        parts.push_back(p);
+        return parts;
+    }
+    std::uint64_t length = 0;
+    for(auto& r: ranges) {
+        ResponsePart t;
+        t.text = std::string("\r\n--") + BOUNDARY + "\r\n";
+        if(!mimeType.empty()) t.text += "Content-Type: " + mimeType + "\r\n";
+        t.text += "Content-Range: bytes " + std::to_string(r.first) + "-"
+                  + std::to_string(r.last) + "/" + std::to_string(size)
+                  + "\r\n\r\n";
+        ResponsePart p;
+        p.offset = r.first;
+        p.size = r.Size();
+        length += t.text.size() + p.size;
+        parts.push_back(t);
+        parts.push_back(p);
+    }
+    ResponsePart end;
+    end.text = std::string("\r\n--") + BOUNDARY + "--\r\n";
+    length += end.text.size();
+    parts.push_back(end);
+    header += std::string("Content-Type: multipart/byteranges; boundary=")
+              + BOUNDARY + "\r\nContent-Length: " + std::to_string(length)
+              + "\r\n" + headers + "\r\n";
+    parts[0].text = header;
+    return parts;
+}
+
+std::string RangeNotSatisfiable(std::uint64_t size) {
+    return "HTTP/1.1 416 Range Not Satisfiable\r\n"
+           "Content-Range: bytes */" + std::to_string(size) + "\r\n"
+           "Content-Length: 0\r\n\r\n";
+}
+
+int AcceptedEncodings(const char* p) {
+    int accepted = ENCODING_IDENTITY;
+    if(!p) return accepted;
+    while(*p) {
+        while(*p == ' ' || *p == '\t' || *p == ',') ++p;
+        const char* b = p;
+        while(*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') ++p;
+        const std::string coding(b, p);
+        //q=0 means not acceptable, RFC 7231 section 5.3.4
+        bool zero = false;
+        while(*p && *p != ',') {
+            if((*p == 'q' || *p == 'Q') && p[1] == '=') {
+                p += 2;
+                zero = std::strtod(p, nullptr) <= 0.;
+            }
+            ++p;
+        }
+        if(zero) continue;
+        //codings are case-insensitive, RFC 7231 section 3.1.2.1
+        const char* c = coding.c_str();
+        if(!strcasecmp(c, "gzip") || !strcasecmp(c, "x-gzip"))
+            accepted |= ENCODING_GZIP;
+        else if(!strcasecmp(c, "br")) accepted |= ENCODING_BR;
+        else if(coding == "*") accepted |= ENCODING_GZIP | ENCODING_BR;
+    }
+    return accepted;
+}
+
+const char* EncodingName(ContentEncoding e) {
+    switch(e) {
+    case ENCODING_GZIP: return "gzip";
+    case ENCODING_BR: return "br";
+    default: return "";
+    }
+}
+
+const char* EncodingSuffix(ContentEncoding e) {
+    switch(e) {
+    case ENCODING_GZIP: return ".gz";
+    case ENCODING_BR: return ".br";
+    default: return "";
+    }
+}
+
+bool Compressible(const std::string& m) {
+    const auto has = [&m](const char* s) {
+        return m.find(s) != std::string::npos;
+    };
+    return !m.compare(0, 5, "text/") || has("javascript") || has("json")
+           || has("xml") || has("wasm");
+}
+
+}
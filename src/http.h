@@ -18,30 +18,129 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <cstdint>
+#include <cstring>
+
+#include "StringView.h"
+
+struct lws;
 
 namespace wsp {
 
 using URIPath = std::vector< std::string >;
-using Request = std::unordered_map< std::string, std::string >;
 using URIParameters = std::unordered_multimap< std::string, std::string >;
 
+///Request header fields extracted by ParseHttpHeader; values are indices
+///into Request, not libwebsockets token indices: ParseHttpHeader maps each
+///field to its WSI_TOKEN_* constant, see HeaderToken
+enum HeaderField {
+    HDR_GET_URI, HDR_POST_URI, HDR_HOST, HDR_CONNECTION, HDR_KEY1, HDR_KEY2,
+    HDR_PROTOCOL, HDR_UPGRADE, HDR_ORIGIN, HDR_DRAFT, HDR_CHALLENGE, HDR_KEY,
+    HDR_VERSION, HDR_SWORIGIN, HDR_EXTENSIONS, HDR_WS_ACCEPT, HDR_NONCE,
+    HDR_HTTP, HDR_ACCEPT, HDR_IF_MODIFIED_SINCE, HDR_IF_NONE_MATCH,
+    HDR_ACCEPT_ENCODING, HDR_ACCEPT_LANGUAGE, HDR_PRAGMA, HDR_CACHE_CONTROL,
+    HDR_AUTHORIZATION, HDR_COOKIE, HDR_CONTENT_LENGTH, HDR_CONTENT_TYPE,
+    HDR_DATE, HDR_RANGE, HDR_REFERER, HDR_URI_ARGS,
+    HDR_COUNT
+};
+
+///Request header: field values are stored back to back, NUL terminated,
+///in a fixed size buffer and indexed by HeaderField; parsing and lookups
+///do not allocate, copies are a single memcpy
+class Request {
+public:
+    ///Bytes available for field values, terminating NULs included; values
+    ///which do not fit are dropped, see Truncated
+    enum { CAPACITY = 4096 };
+    ///Default constructor: empty header
+    Request() { Clear(); }
+    ///Remove all fields
+    void Clear() {
+        std::memset(offset_, 0, sizeof(offset_));
+        std::memset(length_, 0, sizeof(length_));
+        //offset zero holds the empty string returned for missing fields
+        size_ = 1;
+        truncated_ = false;
+        data_[0] = '\0';
+    }
+    ///@c true if field is present and not empty
+    bool Has(HeaderField f) const { return length_[f] != 0; }
+    ///Field value, empty string if not present
+    const char* Get(HeaderField f) const { return data_ + offset_[f]; }
+    ///Length of field value
+    std::size_t Size(HeaderField f) const { return length_[f]; }
+    ///@c true if some fields did not fit into the buffer
+    bool Truncated() const { return truncated_; }
+    ///Field name, as used by the string based lookup functions
+    static const char* Name(HeaderField f);
+    ///Field with the given name, @c HDR_COUNT if none
+    static HeaderField Field(const char* name);
+    ///Read fields from any header source
+    /// @param length callable returning the length of field @c f, zero if
+    ///        missing: <code>int (int f)</code>
+    /// @param copy callable copying field @c f, NUL terminated, into a
+    ///        buffer of @c n bytes and returning the value length:
+    ///        <code>int (int f, char* buf, int n)</code>
+    template < typename LengthF, typename CopyF >
+    void Parse(const LengthF& length, const CopyF& copy) {
+        Clear();
+        for(int f = 0; f != HDR_COUNT; ++f) {
+            const int n = length(f);
+            if(n < 1) continue;
+            if(size_ + n + 1 > CAPACITY) {
+                truncated_ = true;
+                continue;
+            }
+            const int c = copy(f, data_ + size_, n + 1);
+            if(c < 1) continue;
+            offset_[f] = std::uint16_t(size_);
+            length_[f] = std::uint16_t(c);
+            size_ += c + 1;
+        }
+    }
+private:
+    std::uint16_t offset_[HDR_COUNT];
+    std::uint16_t length_[HDR_COUNT];
+    int size_;
+    bool truncated_;
+    char data_[CAPACITY];
+};
+
+///libwebsockets token (lws_token_indexes) field @c f is read from
+int HeaderToken(HeaderField f);
+///Read header fields of request being serviced
+void ParseHttpHeader(lws* wsi, Request& req);
+
 ///Path converted to an array of strings: request parameters are not part
 ///of the URI
 URIPath UriPath(const std::string& path); 
 ///Return #c true if request contains key, @c false otherwise
+inline bool Has(const Request& req, HeaderField key) {
+    return req.Has(key);
+}
+///Return value associated with passed key, empty string if not present
+inline const char* Get(const Request& req, HeaderField key) {
+    return req.Get(key);
+}
+///Return #c true if request contains key, @c false otherwise; @c key is
+///a name returned by Request::Name, e.g. "GET URI" or "Content-Length:"
 bool Has(const Request& req, const std::string& key);
-///Return value associated with passed key
-const std::string& Get(const Request& req, const std::string& key);
+///Return value associated with passed key, empty string if not present
+const char* Get(const Request& req, const std::string& key);
 ///Create a param name -> param value map from URI parameters
 URIParameters UriParameters(const std::string& params);
-///Return file extention from string
-std::string FileExtension(const std::string& filepath);
+///Return file extension: the text after the last '.' of the last path
+///segment, empty if there is none or the segment starts with the only '.';
+///the returned view refers to @c filepath
+StringView FileExtension(StringView filepath);
 ///Return MIME type associated with extension or empty string if no MIME type
-///found
-const std::string& GetMimeType(const std::string& ext);
+///found; case insensitive, see mimetypes.h for a constexpr version
+const std::string& GetMimeType(StringView ext);
 ///Return content size if 'Content-Length' field is present in request header
-///@c -1 otherwise
-int GetContentSize(const Request&);
+///and holds a valid size, @c -1 otherwise; 64 bit, bodies can exceed 2 GiB
+std::int64_t GetContentSize(const Request&);
+///Parse value of a Content-Length header, @c -1 if not a valid size
+std::int64_t ParseContentLength(const char* value);
 ///Create cookie string
 std::string CreateCookie(const std::unordered_map< std::string,
                          std::string>& m);
@@ -52,4 +151,70 @@ std::string CreateCookie(const std::unordered_map< std::string,
 ///@param s second offset
 std::string CreateTime(int h, int m, int s);
 
+///Inclusive byte range
+struct ByteRange {
+    std::uint64_t first;
+    std::uint64_t last;
+    std::uint64_t Size() const { return last - first + 1; }
+};
+using ByteRanges = std::vector< ByteRange >;
+///Outcome of Range header parsing
+enum RangeStatus {
+    ///No or invalid Range header: send the complete content
+    RANGE_NONE,
+    ///Send the requested ranges with status 206
+    RANGE_PARTIAL,
+    ///No requested range overlaps the content: status 416
+    RANGE_UNSATISFIABLE
+};
+///Max number of ranges in a request; Range headers with more ranges are
+///ignored and the complete content is sent
+const std::size_t MAX_RANGES = 16;
+///Parse Range header value (RFC 7233); ranges are clamped to the content
+///size, sorted and overlapping or adjacent ranges are merged
+///@param range header value e.g. "bytes=0-99,200-,-50"
+///@param size content size
+///@param ranges satisfiable ranges
+RangeStatus ParseRange(const char* range, std::uint64_t size,
+                       ByteRanges& ranges);
+///Piece of a response: text if @c text is not empty, content slice
+///otherwise
+struct ResponsePart {
+    std::string text;
+    std::uint64_t offset = 0;
+    std::uint64_t size = 0;
+};
+///Layout of a 206 response: status line and header followed by the
+///single range or by a multipart/byteranges body
+///@param ranges ranges returned by ParseRange
+///@param size content size
+///@param mimeType content type, can be empty
+///@param headers additional header lines, each terminated by CRLF
+std::vector< ResponsePart > PartialContent(const ByteRanges& ranges,
+                                           std::uint64_t size,
+                                           const std::string& mimeType,
+                                           const std::string& headers);
+///416 response
+///@param size content size
+std::string RangeNotSatisfiable(std::uint64_t size);
+
+///Content codings, combined as bit mask by AcceptedEncodings
+enum ContentEncoding {
+    ENCODING_IDENTITY = 1,
+    ENCODING_GZIP = 2,
+    ENCODING_BR = 4
+};
+///Content codings accepted by the client, codings with q=0 excluded;
+///identity is always included
+///@param acceptEncoding Accept-Encoding header value, can be null
+///@return bit mask of ContentEncoding values
+int AcceptedEncodings(const char* acceptEncoding);
+///Token used in Content-Encoding header, empty for identity
+const char* EncodingName(ContentEncoding e);
+///Suffix of precompressed sibling files e.g. ".gz", empty for identity
+const char* EncodingSuffix(ContentEncoding e);
+///@c true if content of type @c mimeType usually shrinks when compressed:
+///text, JavaScript, JSON, XML, SVG and WebAssembly
+bool Compressible(const std::string& mimeType);
+
 }
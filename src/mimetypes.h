@@ -0,0 +1,366 @@
+// Websockets+ : C++11 server-side websocket library based on libwebsockets;
+//               supports easy creation of services and built-in throttling
+// Copyright (C) 2014  Ugo Varetto
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+//GENERATED by mimetypes.py from mimetypes.txt, do not edit
+//File extension -> MIME type perfect hash table
+
+#include <cstddef>
+#include <cstdint>
+
+#include "StringView.h"
+
+namespace wsp {
+
+struct MimeTypeEntry {
+    ///Lower case extension, empty if slot is unused
+    StringView extension;
+    StringView type;
+};
+
+namespace detail {
+
+constexpr std::size_t MIME_BUCKETS = 128;
+constexpr std::size_t MIME_SLOTS = 256;
+constexpr std::size_t MAX_EXTENSION_SIZE = 7;
+
+constexpr std::uint16_t MIME_DISPLACEMENT[MIME_BUCKETS] = {
+    1, 4, 1, 4, 0, 1, 8, 0, 1, 3, 4, 1,
+    1, 3, 0, 1, 2, 3, 3, 2, 1, 2, 1, 1,
+    1, 0, 1, 0, 1, 0, 0, 1, 2, 2, 4, 2,
+    1, 1, 0, 0, 2, 5, 0, 0, 1, 5, 0, 1,
+    1, 1, 4, 0, 1, 4, 1, 1, 1, 0, 0, 1,
+    2, 2, 2, 10, 0, 1, 1, 6, 2, 0, 1, 1,
+    1, 1, 0, 1, 0, 1, 5, 0, 0, 0, 0, 5,
+    7, 0, 0, 1, 3, 0, 8, 3, 0, 1, 5, 2,
+    1, 0, 0, 2, 0, 7, 1, 1, 2, 4, 2, 2,
+    0, 7, 0, 2, 0, 3, 1, 1, 3, 1, 7, 9,
+    0, 2, 0, 3, 5, 1, 1, 13,
+};
+
+constexpr MimeTypeEntry MIME_TYPES[MIME_SLOTS] = {
+    {{"doc", 3}, {"application/msword", 18}},
+    {{"xlc", 3}, {"application/vnd.ms-excel", 24}},
+    {{"ras", 3}, {"image/x-cmu-raster", 18}},
+    {{"ms", 2}, {"application/x-troff-ms", 22}},
+    {{"asf", 3}, {"video/x-ms-asf", 14}},
+    {{"tr", 2}, {"application/x-troff", 19}},
+    {{"rmi", 3}, {"audio/mid", 9}},
+    {{"iii", 3}, {"application/x-iphone", 20}},
+    {{"pfx", 3}, {"application/x-pkcs12", 20}},
+    {{"ppt", 3}, {"application/vnd.ms-powerpoint", 29}},
+    {{"me", 2}, {"application/x-troff-me", 22}},
+    {{"ra", 2}, {"audio/x-pn-realaudio", 20}},
+    {{"uls", 3}, {"text/iuls", 9}},
+    {{"xpm", 3}, {"image/x-xpixmap", 15}},
+    {{"lha", 3}, {"application/octet-stream", 24}},
+    {{"p7r", 3}, {"application/x-pkcs7-certreqresp", 31}},
+    {{"dll", 3}, {"application/x-msdownload", 24}},
+    {},
+    {{"pma", 3}, {"application/x-perfmon", 21}},
+    {},
+    {{"rtx", 3}, {"text/richtext", 13}},
+    {{"lsf", 3}, {"video/x-la-asf", 14}},
+    {},
+    {{"xaf", 3}, {"x-world/x-vrml", 14}},
+    {{"bmp", 3}, {"image/bmp", 9}},
+    {},
+    {{"sv4cpio", 7}, {"application/x-sv4cpio", 21}},
+    {{"hta", 3}, {"application/hta", 15}},
+    {{"t", 1}, {"application/x-troff", 19}},
+    {{"ins", 3}, {"application/x-internet-signup", 29}},
+    {{"htc", 3}, {"text/x-component", 16}},
+    {{"cat", 3}, {"application/vnd.ms-pkiseccat", 28}},
+    {{"vcf", 3}, {"text/x-vcard", 12}},
+    {{"stl", 3}, {"application/vnd.ms-pkistl", 25}},
+    {{"wrl", 3}, {"x-world/x-vrml", 14}},
+    {{"wps", 3}, {"application/vnd.ms-works", 24}},
+    {},
+    {{"wcm", 3}, {"application/vnd.ms-works", 24}},
+    {},
+    {},
+    {},
+    {},
+    {{"pub", 3}, {"application/x-mspublisher", 25}},
+    {},
+    {},
+    {{"pbm", 3}, {"image/x-portable-bitmap", 23}},
+    {{"lsx", 3}, {"video/x-la-asf", 14}},
+    {{"asx", 3}, {"video/x-ms-asf", 14}},
+    {{"mvb", 3}, {"application/x-msmediaview", 25}},
+    {{"setpay", 6}, {"application/set-payment-initiation", 34}},
+    {},
+    {},
+    {{"pnm", 3}, {"image/x-portable-anymap", 23}},
+    {{"crt", 3}, {"application/x-x509-ca-cert", 26}},
+    {{"gif", 3}, {"image/gif", 9}},
+    {{"wks", 3}, {"application/vnd.ms-works", 24}},
+    {{"cod", 3}, {"image/cis-cod", 13}},
+    {{"mpg", 3}, {"video/mpeg", 10}},
+    {{"bas", 3}, {"text/plain", 10}},
+    {{"xla", 3}, {"application/vnd.ms-excel", 24}},
+    {},
+    {{"hdf", 3}, {"application/x-hdf", 17}},
+    {{"trm", 3}, {"application/x-msterminal", 24}},
+    {},
+    {},
+    {{"aiff", 4}, {"audio/x-aiff", 12}},
+    {{"p12", 3}, {"application/x-pkcs12", 20}},
+    {{"gtar", 4}, {"application/x-gtar", 18}},
+    {{"zip", 3}, {"application/zip", 15}},
+    {{"tcl", 3}, {"application/x-tcl", 17}},
+    {{"sst", 3}, {"application/vnd.ms-pkicertstore", 31}},
+    {{"axs", 3}, {"application/olescript", 21}},
+    {},
+    {},
+    {},
+    {},
+    {{"au", 2}, {"audio/basic", 11}},
+    {{"crl", 3}, {"application/pkix-crl", 20}},
+    {{"isp", 3}, {"application/x-internet-signup", 29}},
+    {{"qt", 2}, {"video/quicktime", 15}},
+    {{"avi", 3}, {"video/x-msvideo", 15}},
+    {{"bin", 3}, {"application/octet-stream", 24}},
+    {{"setreg", 6}, {"application/set-registration-initiation", 39}},
+    {{"tgz", 3}, {"application/x-compressed", 24}},
+    {},
+    {},
+    {},
+    {{"xlt", 3}, {"application/vnd.ms-excel", 24}},
+    {{"hlp", 3}, {"application/winhlp", 18}},
+    {},
+    {},
+    {{"tiff", 4}, {"image/tiff", 10}},
+    {{"mp3", 3}, {"audio/mpeg", 10}},
+    {{"wdb", 3}, {"application/vnd.ms-works", 24}},
+    {{"scd", 3}, {"application/x-msschedule", 24}},
+    {},
+    {{"tif", 3}, {"image/tiff", 10}},
+    {{"snd", 3}, {"audio/basic", 11}},
+    {{"wmf", 3}, {"application/x-msmetafile", 24}},
+    {{"dcr", 3}, {"application/x-director", 22}},
+    {{"dms", 3}, {"application/octet-stream", 24}},
+    {{"jfif", 4}, {"image/pipeg", 11}},
+    {{"acx", 3}, {"application/internet-property-stream", 36}},
+    {{"css", 3}, {"text/css", 8}},
+    {{"bcpio", 5}, {"application/x-bcpio", 19}},
+    {{"mdb", 3}, {"application/x-msaccess", 22}},
+    {},
+    {},
+    {{"ppm", 3}, {"image/x-portable-pixmap", 23}},
+    {},
+    {},
+    {},
+    {{"man", 3}, {"application/x-troff-man", 23}},
+    {{"oda", 3}, {"application/oda", 15}},
+    {{"p10", 3}, {"application/pkcs10", 18}},
+    {{"roff", 4}, {"application/x-troff", 19}},
+    {},
+    {{"xls", 3}, {"application/vnd.ms-excel", 24}},
+    {},
+    {{"pmr", 3}, {"application/x-perfmon", 21}},
+    {{"pgm", 3}, {"image/x-portable-graymap", 24}},
+    {{"jpg", 3}, {"image/jpeg", 10}},
+    {{"html", 4}, {"text/html", 9}},
+    {{"gz", 2}, {"application/x-gzip", 18}},
+    {{"sit", 3}, {"application/x-stuffit", 21}},
+    {},
+    {{"tex", 3}, {"application/x-tex", 17}},
+    {{"ps", 2}, {"application/postscript", 22}},
+    {{"m13", 3}, {"application/x-msmediaview", 25}},
+    {{"sct", 3}, {"text/scriptlet", 14}},
+    {{"m3u", 3}, {"audio/x-mpegurl", 15}},
+    {},
+    {{"txt", 3}, {"text/plain", 10}},
+    {{"wrz", 3}, {"x-world/x-vrml", 14}},
+    {{"rgb", 3}, {"image/x-rgb", 11}},
+    {{"movie", 5}, {"video/x-sgi-movie", 17}},
+    {{"mpp", 3}, {"application/vnd.ms-project", 26}},
+    {{"nc", 2}, {"application/x-netcdf", 20}},
+    {{"ico", 3}, {"image/x-icon", 12}},
+    {{"z", 1}, {"application/x-compress", 22}},
+    {{"htm", 3}, {"text/html", 9}},
+    {{"pko", 3}, {"application/ynd.ms-pkipko", 25}},
+    {{"p7c", 3}, {"application/x-pkcs7-mime", 24}},
+    {{"xlm", 3}, {"application/vnd.ms-excel", 24}},
+    {{"jpeg", 4}, {"image/jpeg", 10}},
+    {},
+    {},
+    {{"sh", 2}, {"application/x-sh", 16}},
+    {{"htt", 3}, {"text/webviewhtml", 16}},
+    {{"c", 1}, {"text/plain", 10}},
+    {},
+    {{"p7m", 3}, {"application/x-pkcs7-mime", 24}},
+    {{"eps", 3}, {"application/postscript", 22}},
+    {{"asr", 3}, {"video/x-ms-asf", 14}},
+    {{"csh", 3}, {"application/x-csh", 17}},
+    {{"mid", 3}, {"audio/mid", 9}},
+    {},
+    {{"xlw", 3}, {"application/vnd.ms-excel", 24}},
+    {{"texi", 4}, {"application/x-texinfo", 21}},
+    {{"msg", 3}, {"application/vnd.ms-outlook", 26}},
+    {{"sv4crc", 6}, {"application/x-sv4crc", 20}},
+    {{"mny", 3}, {"application/x-msmoney", 21}},
+    {{"aifc", 4}, {"audio/x-aiff", 12}},
+    {{"cdf", 3}, {"application/x-cdf", 17}},
+    {},
+    {{"p7s", 3}, {"application/x-pkcs7-signature", 29}},
+    {{"*", 1}, {"application/octet-stream", 24}},
+    {{"evy", 3}, {"application/envoy", 17}},
+    {{"xof", 3}, {"x-world/x-vrml", 14}},
+    {{"pml", 3}, {"application/x-perfmon", 21}},
+    {{"class", 5}, {"application/octet-stream", 24}},
+    {{"texinfo", 7}, {"application/x-texinfo", 21}},
+    {{"vrml", 4}, {"x-world/x-vrml", 14}},
+    {{"ustar", 5}, {"application/x-ustar", 19}},
+    {},
+    {},
+    {{"dvi", 3}, {"application/x-dvi", 17}},
+    {{"spl", 3}, {"application/futuresplash", 24}},
+    {},
+    {},
+    {},
+    {{"stm", 3}, {"text/html", 9}},
+    {{"hqx", 3}, {"application/mac-binhex40", 24}},
+    {},
+    {{"pdf", 3}, {"application/pdf", 15}},
+    {{"323", 3}, {"text/h323", 9}},
+    {{"jpe", 3}, {"image/jpeg", 10}},
+    {},
+    {},
+    {{"nws", 3}, {"message/rfc822", 14}},
+    {},
+    {{"mov", 3}, {"video/quicktime", 15}},
+    {{"ram", 3}, {"audio/x-pn-realaudio", 20}},
+    {},
+    {},
+    {{"swf", 3}, {"application/x-shockwave-flash", 29}},
+    {{"ief", 3}, {"image/ief", 9}},
+    {{"ai", 2}, {"application/postscript", 22}},
+    {{"xwd", 3}, {"image/x-xwindowdump", 19}},
+    {{"wav", 3}, {"audio/x-wav", 11}},
+    {{"pmw", 3}, {"application/x-perfmon", 21}},
+    {{"cer", 3}, {"application/x-x509-ca-cert", 26}},
+    {{"mhtml", 5}, {"message/rfc822", 14}},
+    {{"mpa", 3}, {"video/mpeg", 10}},
+    {{"latex", 5}, {"application/x-latex", 19}},
+    {{"wri", 3}, {"application/x-mswrite", 21}},
+    {{"svg", 3}, {"image/svg+xml", 13}},
+    {},
+    {{"js", 2}, {"application/x-javascript", 24}},
+    {},
+    {},
+    {{"cpio", 4}, {"application/x-cpio", 18}},
+    {},
+    {},
+    {{"pmc", 3}, {"application/x-perfmon", 21}},
+    {},
+    {{"spc", 3}, {"application/x-pkcs7-certificates", 32}},
+    {{"flr", 3}, {"x-world/x-vrml", 14}},
+    {},
+    {{"dot", 3}, {"application/msword", 18}},
+    {},
+    {{"exe", 3}, {"application/octet-stream", 24}},
+    {{"aif", 3}, {"audio/x-aiff", 12}},
+    {},
+    {{"der", 3}, {"application/x-x509-ca-cert", 26}},
+    {{"cmx", 3}, {"image/x-cmx", 11}},
+    {},
+    {{"mp2", 3}, {"video/mpeg", 10}},
+    {{"m14", 3}, {"application/x-msmediaview", 25}},
+    {{"crd", 3}, {"application/x-mscardfile", 24}},
+    {{"h", 1}, {"text/plain", 10}},
+    {{"rtf", 3}, {"application/rtf", 15}},
+    {{"dxr", 3}, {"application/x-director", 22}},
+    {{"xbm", 3}, {"image/x-xbitmap", 15}},
+    {{"pps", 3}, {"application/vnd.ms-powerpoint", 29}},
+    {{"fif", 3}, {"application/fractals", 20}},
+    {{"src", 3}, {"application/x-wais-source", 25}},
+    {},
+    {{"dir", 3}, {"application/x-director", 22}},
+    {{"prf", 3}, {"application/pics-rules", 22}},
+    {},
+    {{"shar", 4}, {"application/x-shar", 18}},
+    {},
+    {{"etx", 3}, {"text/x-setext", 13}},
+    {},
+    {{"mpeg", 4}, {"video/mpeg", 10}},
+    {{"mpv2", 4}, {"video/mpeg", 10}},
+    {{"tar", 3}, {"application/x-tar", 17}},
+    {{"lzh", 3}, {"application/octet-stream", 24}},
+    {{"p7b", 3}, {"application/x-pkcs7-certificates", 32}},
+    {},
+    {{"tsv", 3}, {"text/tab-separated-values", 25}},
+    {{"clp", 3}, {"application/x-msclip", 20}},
+    {{"mht", 3}, {"message/rfc822", 14}},
+    {{"pot", 3}, {"application/vnd.ms-powerpoint", 29}},
+    {{"mpe", 3}, {"video/mpeg", 10}},
+};
+
+constexpr char Lower(char c) {
+    return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+///FNV-1a of lower case characters, high bits folded into low bits
+constexpr std::uint32_t Hash(const char* s, std::size_t n,
+                             std::uint32_t h) {
+    return n == 0 ? h ^ (h >> 16)
+                  : Hash(s + 1, n - 1,
+                         (h ^ std::uint8_t(Lower(*s))) * 16777619u);
+}
+
+constexpr std::uint32_t Hash(StringView s, std::uint32_t seed) {
+    return Hash(s.data(), s.size(), 2166136261u ^ seed);
+}
+
+///@c e is lower case
+constexpr bool EqualNoCase(const char* e, const char* s,
+                           std::size_t n) {
+    return n == 0 || (*e == Lower(*s) && EqualNoCase(e + 1, s + 1, n - 1));
+}
+
+constexpr std::size_t Slot(StringView ext) {
+    return Hash(ext, MIME_DISPLACEMENT[Hash(ext, 0) % MIME_BUCKETS])
+           % MIME_SLOTS;
+}
+
+constexpr int Match(StringView ext, std::size_t slot) {
+    return MIME_TYPES[slot].extension.size() == ext.size()
+           && EqualNoCase(MIME_TYPES[slot].extension.data(),
+                          ext.data(), ext.size())
+           ? int(slot) : -1;
+}
+
+constexpr StringView Type(int index) {
+    return index < 0 ? StringView() : MIME_TYPES[index].type;
+}
+
+} //namespace detail
+
+///Index of @c ext in the MIME type table, -1 if not found;
+///case insensitive
+constexpr int MimeTypeIndex(StringView ext) {
+    return ext.empty() || ext.size() > detail::MAX_EXTENSION_SIZE
+           ? -1 : detail::Match(ext, detail::Slot(ext));
+}
+
+///MIME type associated with extension, empty if not found; case
+///insensitive, the returned view refers to static storage
+constexpr StringView MimeType(StringView ext) {
+    return detail::Type(MimeTypeIndex(ext));
+}
+
+} //namespace wsp
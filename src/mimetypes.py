@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+# Websockets+ : C++11 server-side websocket library based on libwebsockets;
+#               supports easy creation of services and built-in throttling
+# Copyright (C) 2014  Ugo Varetto
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Generate mimetypes.h from mimetypes.txt: a perfect hash table built with
+# the hash and displace method. Each extension is hashed once to select a
+# bucket; the bucket's displacement is then used as seed of a second hash
+# which gives the extension's slot. Displacements are chosen, largest
+# buckets first, so that no two extensions share a slot.
+#
+# usage: mimetypes.py [mimetypes.txt [mimetypes.h]]
+
+import os
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+BASIS = 2166136261
+PRIME = 16777619
+MASK = 0xffffffff
+
+
+def fnv(ext, seed):
+    """Must match detail::Hash in the generated header"""
+    h = BASIS ^ seed
+    for c in ext.lower().encode():
+        h = ((h ^ c) * PRIME) & MASK
+    return h ^ (h >> 16)
+
+
+def pow2(n):
+    p = 1
+    while p < n:
+        p *= 2
+    return p
+
+
+def build(keys):
+    buckets = pow2(len(keys)) // 2
+    slots = pow2(len(keys) * 5 // 4)
+    members = [[] for _ in range(buckets)]
+    for k in keys:
+        members[fnv(k, 0) % buckets].append(k)
+    displacement = [0] * buckets
+    table = [None] * slots
+    for b in sorted(range(buckets), key=lambda b: -len(members[b])):
+        if not members[b]:
+            break
+        for d in range(1, 0x10000):
+            s = [fnv(k, d) % slots for k in members[b]]
+            if len(set(s)) == len(s) and all(table[i] is None for i in s):
+                break
+        else:
+            sys.exit("no displacement found for bucket %d" % b)
+        displacement[b] = d
+        for k, i in zip(members[b], s):
+            table[i] = k
+    return displacement, table
+
+
+def main():
+    src = sys.argv[1] if len(sys.argv) > 1 \
+        else os.path.join(HERE, "mimetypes.txt")
+    dst = sys.argv[2] if len(sys.argv) > 2 \
+        else os.path.join(HERE, "mimetypes.h")
+    types = {}
+    keys = []
+    with open(src) as f:
+        for line in f:
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            ext, mime = line.split()
+            ext = ext.lower()
+            if ext not in types:
+                types[ext] = mime
+                keys.append(ext)
+    displacement, table = build(keys)
+    with open(os.path.join(HERE, "PaddedBuffer.h")) as f:
+        license = "".join(f.readlines()[:16])
+    out = [license.rstrip("\n"),
+           "#pragma once",
+           "//GENERATED by mimetypes.py from mimetypes.txt, do not edit",
+           "//File extension -> MIME type perfect hash table",
+           "",
+           "#include <cstddef>",
+           "#include <cstdint>",
+           "",
+           '#include "StringView.h"',
+           "",
+           "namespace wsp {",
+           "",
+           "struct MimeTypeEntry {",
+           "    ///Lower case extension, empty if slot is unused",
+           "    StringView extension;",
+           "    StringView type;",
+           "};",
+           "",
+           "namespace detail {",
+           "",
+           "constexpr std::size_t MIME_BUCKETS = %d;" % len(displacement),
+           "constexpr std::size_t MIME_SLOTS = %d;" % len(table),
+           "constexpr std::size_t MAX_EXTENSION_SIZE = %d;"
+           % max(len(k) for k in keys),
+           "",
+           "constexpr std::uint16_t MIME_DISPLACEMENT[MIME_BUCKETS] = {"]
+    for i in range(0, len(displacement), 12):
+        out.append("    " + ", ".join(str(d) for d in
+                                      displacement[i:i + 12]) + ",")
+    out += ["};",
+            "",
+            "constexpr MimeTypeEntry MIME_TYPES[MIME_SLOTS] = {"]
+    for k in table:
+        if k is None:
+            out.append("    {},")
+        else:
+            out.append('    {{"%s", %d}, {"%s", %d}},'
+                       % (k, len(k), types[k], len(types[k])))
+    out += ["};",
+            "",
+            "constexpr char Lower(char c) {",
+            "    return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;",
+            "}",
+            "",
+            "///FNV-1a of lower case characters, high bits folded into low bits",
+            "constexpr std::uint32_t Hash(const char* s, std::size_t n,",
+            "                             std::uint32_t h) {",
+            "    return n == 0 ? h ^ (h >> 16)",
+            "                  : Hash(s + 1, n - 1,",
+            "                         (h ^ std::uint8_t(Lower(*s))) * %du);"
+            % PRIME,
+            "}",
+            "",
+            "constexpr std::uint32_t Hash(StringView s, std::uint32_t seed) {",
+            "    return Hash(s.data(), s.size(), %du ^ seed);" % BASIS,
+            "}",
+            "",
+            "///@c e is lower case",
+            "constexpr bool EqualNoCase(const char* e, const char* s,",
+            "                           std::size_t n) {",
+            "    return n == 0 || (*e == Lower(*s) "
+            "&& EqualNoCase(e + 1, s + 1, n - 1));",
+            "}",
+            "",
+            "constexpr std::size_t Slot(StringView ext) {",
+            "    return Hash(ext, MIME_DISPLACEMENT[Hash(ext, 0) % MIME_BUCKETS])",
+            "           % MIME_SLOTS;",
+            "}",
+            "",
+            "constexpr int Match(StringView ext, std::size_t slot) {",
+            "    return MIME_TYPES[slot].extension.size() == ext.size()",
+            "           && EqualNoCase(MIME_TYPES[slot].extension.data(),",
+            "                          ext.data(), ext.size())",
+            "           ? int(slot) : -1;",
+            "}",
+            "",
+            "constexpr StringView Type(int index) {",
+            "    return index < 0 ? StringView() : MIME_TYPES[index].type;",
+            "}",
+            "",
+            "} //namespace detail",
+            "",
+            "///Index of @c ext in the MIME type table, -1 if not found;",
+            "///case insensitive",
+            "constexpr int MimeTypeIndex(StringView ext) {",
+            "    return ext.empty() || ext.size() > detail::MAX_EXTENSION_SIZE",
+            "           ? -1 : detail::Match(ext, detail::Slot(ext));",
+            "}",
+            "",
+            "///MIME type associated with extension, empty if not found; case",
+            "///insensitive, the returned view refers to static storage",
+            "constexpr StringView MimeType(StringView ext) {",
+            "    return detail::Type(MimeTypeIndex(ext));",
+            "}",
+            "",
+            "} //namespace wsp",
+            ""]
+    with open(dst, "w") as f:
+        f.write("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()